@@ -107,11 +107,16 @@ public:
 			char const *arg = argv[i];
 			bool valid = false;
 			if (arg[0] == '-' && arg[1] == '-') {
+				// Split arguments of the form "--arg=value"
 				arg = &arg[2];
+				const char *eq = strchr(arg, '=');
+				const size_t len = eq ? size_t(eq - arg) : strlen(arg);
 				for (size_t j = 0; j < m_args.size(); j++) {
-					if (strcmp(m_args[j].name, arg) == 0) {
+					if (strlen(m_args[j].name) == len &&
+					    strncmp(m_args[j].name, arg, len) == 0) {
+						const char *name = m_args[j].name;
 						if (specified_args[j]) {
-							std::cerr << "\"" << argv[i]
+							std::cerr << "\"--" << name
 							          << "\" specified multiple times."
 							          << std::endl;
 							exit(EXIT_FAILURE);
@@ -119,26 +124,35 @@ public:
 						specified_args[j] = true;
 
 						char const *value = nullptr;
-						if (!m_args[j].is_switch) {
-							if (i + 1 < argc) {
-								value = argv[++i];
-							}
-							else {
-								std::cerr << "Expected value for \"" << argv[i]
-								          << "\"" << std::endl;
+						if (m_args[j].is_switch) {
+							if (eq) {
+								std::cerr << "Switch \"--" << name
+								          << "\" does not take a value"
+								          << std::endl;
 								exit(EXIT_FAILURE);
 							}
 						}
+						else if (eq) {
+							value = eq + 1;
+						}
+						else if (i + 1 < argc) {
+							value = argv[++i];
+						}
+						else {
+							std::cerr << "Expected value for \"--" << name
+							          << "\"" << std::endl;
+							exit(EXIT_FAILURE);
+						}
 
 						if (!(m_args[j].cback(value))) {
 							if (value) {
-								std::cerr << "Error while parsing argument \""
-								          << argv[i] << "=" << value << "\""
+								std::cerr << "Error while parsing argument \"--"
+								          << name << "=" << value << "\""
 								          << std::endl;
 							}
 							else {
-								std::cerr << "Error while parsing switch \""
-								          << argv[i] << "\"" << std::endl;
+								std::cerr << "Error while parsing switch \"--"
+								          << name << "\"" << std::endl;
 							}
 							exit(EXIT_FAILURE);
 						}
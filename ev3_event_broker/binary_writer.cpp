@@ -0,0 +1,315 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <ev3_event_broker/binary_writer.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static uint8_t *put_u16(uint8_t *tar, uint16_t value)
+{
+	*(tar++) = uint8_t(value);
+	*(tar++) = uint8_t(value >> 8);
+	return tar;
+}
+
+static uint8_t *put_u32(uint8_t *tar, uint32_t value)
+{
+	*(tar++) = uint8_t(value);
+	*(tar++) = uint8_t(value >> 8);
+	*(tar++) = uint8_t(value >> 16);
+	*(tar++) = uint8_t(value >> 24);
+	return tar;
+}
+
+static uint8_t *put_chars(uint8_t *tar, const char *str, size_t n)
+{
+	// Fixed-width field, zero-padded but not necessarily zero-terminated
+	const size_t len = strnlen(str, n);
+	memcpy(tar, str, len);
+	memset(tar + len, 0, n - len);
+	return tar + n;
+}
+
+static uint32_t fnv1a(uint32_t h, const char *str)
+{
+	for (; *str; str++) {
+		h = (h ^ uint8_t(*str)) * 0x01000193U;
+	}
+	return h;
+}
+
+/******************************************************************************
+ * Class BinaryWriter                                                         *
+ ******************************************************************************/
+
+BinaryWriter::BinaryWriter(OutputBuffer &output) : m_output(output), m_ptr(0)
+{
+	memset(m_source_table, 0, sizeof(m_source_table));
+	memset(m_device_table, 0, sizeof(m_device_table));
+	m_n_sources = 0;
+	m_n_devices = 0;
+}
+
+void BinaryWriter::clear()
+{
+	memset(m_source_table, 0, sizeof(m_source_table));
+	memset(m_device_table, 0, sizeof(m_device_table));
+	m_n_sources = 0;
+	m_n_devices = 0;
+	record(BINARY_CLEAR, BINARY_HEADER_SIZE);
+}
+
+uint8_t *BinaryWriter::record(uint8_t type, size_t size)
+{
+	if (m_ptr + size > BUF_SIZE) {
+		flush();
+	}
+	uint8_t *tar = m_buf + m_ptr;
+	m_ptr += size;
+	tar = put_u16(tar, uint16_t(size));
+	*(tar++) = type;
+	*(tar++) = 0;
+	return tar;
+}
+
+uint16_t BinaryWriter::source_id(const Demarshaller::Header &header,
+                                 const socket::Address &address)
+{
+	uint32_t h = fnv1a(0x811C9DC5U, header.source_name);
+	h = fnv1a(h, header.source_hash);
+	h = (h ^ ((uint32_t(address.a) << 24) | (uint32_t(address.b) << 16) |
+	          (uint32_t(address.c) << 8) | uint32_t(address.d))) *
+	    0x01000193U;
+	h = (h ^ address.port) * 0x01000193U;
+
+	const size_t n_table = 2 * MAX_SOURCES;
+	for (size_t i = h % n_table;; i = (i + 1) % n_table) {
+		if (m_source_table[i] == 0) {
+			// Intern and announce the new source
+			const uint16_t id = uint16_t(m_n_sources++);
+			Source &s = m_sources[id];
+			strncpy(s.name, header.source_name, sizeof(s.name));
+			strncpy(s.hash, header.source_hash, sizeof(s.hash));
+			s.address = address;
+			m_source_table[i] = id + 1;
+
+			uint8_t *tar = record(BINARY_SOURCE, BINARY_HEADER_SIZE + 32);
+			tar = put_u16(tar, id);
+			tar = put_u16(tar, address.port);
+			*(tar++) = address.a;
+			*(tar++) = address.b;
+			*(tar++) = address.c;
+			*(tar++) = address.d;
+			tar = put_chars(tar, header.source_name, N_SOURCE_NAME_CHARS);
+			put_chars(tar, header.source_hash, N_SOURCE_HASH_CHARS);
+			return id;
+		}
+
+		const uint16_t id = m_source_table[i] - 1;
+		const Source &s = m_sources[id];
+		if (s.address.a == address.a && s.address.b == address.b &&
+		    s.address.c == address.c && s.address.d == address.d &&
+		    s.address.port == address.port &&
+		    strcmp(s.hash, header.source_hash) == 0 &&
+		    strcmp(s.name, header.source_name) == 0) {
+			return id;
+		}
+	}
+}
+
+uint16_t BinaryWriter::device_id(const char *name)
+{
+	const size_t n_table = 2 * MAX_DEVICES;
+	for (size_t i = fnv1a(0x811C9DC5U, name) % n_table;;
+	     i = (i + 1) % n_table) {
+		if (m_device_table[i] == 0) {
+			// Intern and announce the new device name
+			const uint16_t id = uint16_t(m_n_devices++);
+			strncpy(m_devices[id].name, name, sizeof(m_devices[id].name));
+			m_device_table[i] = id + 1;
+
+			uint8_t *tar = record(BINARY_DEVICE, BINARY_HEADER_SIZE + 20);
+			tar = put_u16(tar, id);
+			tar = put_u16(tar, 0);
+			put_chars(tar, name, N_DEVICE_NAME_CHARS);
+			return id;
+		}
+
+		const uint16_t id = m_device_table[i] - 1;
+		if (strcmp(m_devices[id].name, name) == 0) {
+			return id;
+		}
+	}
+}
+
+uint8_t *BinaryWriter::data_record(uint8_t type, size_t payload_size,
+                                   const Demarshaller::Header &header,
+                                   const socket::Address &address,
+                                   const char *device)
+{
+	// Make sure there is space for one more source and device, then resolve
+	// the ids; this may emit announcements, which must precede the record
+	if (m_n_sources == MAX_SOURCES || m_n_devices == MAX_DEVICES) {
+		clear();
+	}
+	const uint16_t source = source_id(header, address);
+	const uint16_t dev = device ? device_id(device) : BINARY_NO_DEVICE;
+
+	uint8_t *tar = record(type, BINARY_RECORD_PREFIX_SIZE + payload_size);
+	tar = put_u16(tar, source);
+	tar = put_u16(tar, dev);
+	return put_u32(tar, header.sequence);
+}
+
+void BinaryWriter::position(const Demarshaller::Header &header,
+                            const socket::Address &address, const char *device,
+                            int32_t position)
+{
+	put_u32(data_record(BINARY_POSITION, 4, header, address, device),
+	        uint32_t(position));
+}
+
+void BinaryWriter::velocity(const Demarshaller::Header &header,
+                            const socket::Address &address, const char *device,
+                            int32_t velocity)
+{
+	put_u32(data_record(BINARY_VELOCITY, 4, header, address, device),
+	        uint32_t(velocity));
+}
+
+void BinaryWriter::prediction(const Demarshaller::Header &header,
+                              const socket::Address &address,
+                              const char *device, int32_t position)
+{
+	put_u32(data_record(BINARY_PREDICTION, 4, header, address, device),
+	        uint32_t(position));
+}
+
+void BinaryWriter::telemetry(const Demarshaller::Header &header,
+                             const socket::Address &address,
+                             const char *device, uint8_t attribute,
+                             int32_t value)
+{
+	uint8_t *tar = data_record(BINARY_TELEMETRY, 8, header, address, device);
+	*(tar++) = attribute;
+	*(tar++) = 0;
+	tar = put_u16(tar, 0);
+	put_u32(tar, uint32_t(value));
+}
+
+void BinaryWriter::sensor(const Demarshaller::Header &header,
+                          const socket::Address &address, const char *device,
+                          uint8_t decimals, const int32_t *values,
+                          size_t n_values)
+{
+	uint8_t *tar = data_record(BINARY_SENSOR, 4 + 4 * SENSOR_MAX_VALUES,
+	                           header, address, device);
+	*(tar++) = decimals;
+	*(tar++) = uint8_t(n_values);
+	tar = put_u16(tar, 0);
+	for (size_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+		tar = put_u32(tar, (i < n_values) ? uint32_t(values[i]) : 0U);
+	}
+}
+
+void BinaryWriter::trajectory_underrun(const Demarshaller::Header &header,
+                                       const socket::Address &address,
+                                       const char *device)
+{
+	data_record(BINARY_TRAJECTORY_UNDERRUN, 0, header, address, device);
+}
+
+void BinaryWriter::heartbeat(const Demarshaller::Header &header,
+                             const socket::Address &address)
+{
+	data_record(BINARY_HEARTBEAT, 0, header, address, nullptr);
+}
+
+void BinaryWriter::report_mode(const Demarshaller::Header &header,
+                               const socket::Address &address,
+                               int32_t deadband, uint32_t keyframe_period)
+{
+	uint8_t *tar =
+	    data_record(BINARY_REPORT_MODE, 8, header, address, nullptr);
+	tar = put_u32(tar, uint32_t(deadband));
+	put_u32(tar, keyframe_period);
+}
+
+void BinaryWriter::rtt(const Demarshaller::Header &header,
+                       const socket::Address &address, uint32_t n_sent,
+                       uint32_t n_received, uint32_t p50, uint32_t p95,
+                       uint32_t p99, uint32_t max)
+{
+	uint8_t *tar = data_record(BINARY_RTT, 24, header, address, nullptr);
+	tar = put_u32(tar, n_sent);
+	tar = put_u32(tar, n_received);
+	tar = put_u32(tar, p50);
+	tar = put_u32(tar, p95);
+	tar = put_u32(tar, p99);
+	put_u32(tar, max);
+}
+
+void BinaryWriter::clock(const Demarshaller::Header &header,
+                         const socket::Address &address, int64_t offset,
+                         int32_t skew, uint32_t delay)
+{
+	uint8_t *tar = data_record(BINARY_CLOCK, 16, header, address, nullptr);
+	tar = put_u32(tar, uint32_t(uint64_t(offset)));
+	tar = put_u32(tar, uint32_t(uint64_t(offset) >> 32));
+	tar = put_u32(tar, uint32_t(skew));
+	put_u32(tar, delay);
+}
+
+void BinaryWriter::error(const char *what)
+{
+	const size_t len =
+	    std::min(strlen(what), MAX_RECORD_SIZE - BINARY_HEADER_SIZE);
+	memcpy(record(BINARY_ERROR, BINARY_HEADER_SIZE + len), what, len);
+}
+
+void BinaryWriter::conflate(uint32_t n_updates, uint32_t n_records)
+{
+	uint8_t *tar = record(BINARY_CONFLATE, BINARY_HEADER_SIZE + 8);
+	tar = put_u32(tar, n_updates);
+	put_u32(tar, n_records);
+}
+
+void BinaryWriter::overflow(uint64_t dropped_bytes)
+{
+	clear();
+	uint8_t *tar = record(BINARY_OVERFLOW, BINARY_HEADER_SIZE + 8);
+	tar = put_u32(tar, uint32_t(dropped_bytes));
+	put_u32(tar, uint32_t(dropped_bytes >> 32));
+}
+
+void BinaryWriter::flush()
+{
+	if (m_ptr > 0) {
+		m_output.write(m_buf, m_ptr);
+		m_ptr = 0;
+	}
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,264 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file binary_writer.hpp
+ *
+ * Serializes incoming messages as fixed-layout little-endian records that can
+ * be decoded without parsing text.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/output_buffer.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Each record starts with a four byte header consisting of the total record
+ * size in bytes (uint16), the record type (uint8) and a reserved byte.
+ */
+static constexpr size_t BINARY_HEADER_SIZE = 4;
+
+/**
+ * Announces the numeric id of a source; sent before the first record
+ * referencing the source. Layout: uint16 source id, uint16 port, uint8 ip[4],
+ * char name[16], char hash[8].
+ */
+static constexpr uint8_t BINARY_SOURCE = 0x01;
+
+/**
+ * Announces the numeric id of a device name. Layout: uint16 device id, uint16
+ * reserved, char name[16].
+ */
+static constexpr uint8_t BINARY_DEVICE = 0x02;
+
+/**
+ * Error message; the payload is the UTF-8 encoded text.
+ */
+static constexpr uint8_t BINARY_ERROR = 0x03;
+
+/**
+ * All previously announced ids are invalid. Sent when the id tables are full.
+ */
+static constexpr uint8_t BINARY_CLEAR = 0x04;
+
+/**
+ * Summary of a conflated batch, see --conflate. Layout: uint32 number of
+ * received records, uint32 number of records in the batch.
+ */
+static constexpr uint8_t BINARY_CONFLATE = 0x05;
+
+/**
+ * Output was discarded because the reader did not keep up. Invalidates all
+ * previously announced ids. Layout: uint64 total number of discarded bytes.
+ */
+static constexpr uint8_t BINARY_OVERFLOW = 0x06;
+
+/**
+ * All following records share a common prefix after the header: uint16 source
+ * id, uint16 device id, uint32 sequence number.
+ */
+static constexpr size_t BINARY_RECORD_PREFIX_SIZE = BINARY_HEADER_SIZE + 8;
+
+/**
+ * Motor position; int32 position in degrees.
+ */
+static constexpr uint8_t BINARY_POSITION = 0x10;
+
+/**
+ * Motor velocity; int32 velocity in thousandths of degrees per second.
+ */
+static constexpr uint8_t BINARY_VELOCITY = 0x11;
+
+/**
+ * Telemetry; uint8 attribute, uint8 reserved[3], int32 value.
+ */
+static constexpr uint8_t BINARY_TELEMETRY = 0x12;
+
+/**
+ * Sensor values; uint8 decimals, uint8 number of values, uint16 reserved,
+ * int32 values[SENSOR_MAX_VALUES]. Unused values are zero.
+ */
+static constexpr uint8_t BINARY_SENSOR = 0x13;
+
+/**
+ * Trajectory underrun; no payload.
+ */
+static constexpr uint8_t BINARY_TRAJECTORY_UNDERRUN = 0x14;
+
+/**
+ * Heartbeat; no payload, the device id is BINARY_NO_DEVICE.
+ */
+static constexpr uint8_t BINARY_HEARTBEAT = 0x15;
+
+/**
+ * Round trip time statistics of a source, see --ping-rate; the device id is
+ * BINARY_NO_DEVICE. Layout: uint32 pings sent, uint32 pongs received, uint32
+ * median, 95th and 99th percentile and maximum round trip time in
+ * microseconds.
+ */
+static constexpr uint8_t BINARY_RTT = 0x16;
+
+/**
+ * Clock offset estimate of a source, see --ping-rate; the device id is
+ * BINARY_NO_DEVICE. Layout: int64 offset of the source clock in nanoseconds,
+ * int32 skew in parts per billion, uint32 round trip delay of the exchange
+ * the estimate is based on in microseconds.
+ */
+static constexpr uint8_t BINARY_CLOCK = 0x17;
+
+/**
+ * Predicted motor position, see --predict; follows the corresponding
+ * BINARY_POSITION record. Layout: int32 position in thousandths of degrees.
+ */
+static constexpr uint8_t BINARY_PREDICTION = 0x18;
+
+/**
+ * Report mode of a source, sent along with its heartbeats; the device id is
+ * BINARY_NO_DEVICE. Layout: int32 deadband in degrees, negative if every
+ * sample is reported, uint32 keyframe period in milliseconds.
+ */
+static constexpr uint8_t BINARY_REPORT_MODE = 0x19;
+
+/**
+ * Device id used for records that do not refer to a device.
+ */
+static constexpr uint16_t BINARY_NO_DEVICE = 0xFFFF;
+
+/**
+ * The BinaryWriter class is the binary counterpart of the JsonWriter. Source
+ * and device names are interned: each distinct source and device name is
+ * announced once with a BINARY_SOURCE or BINARY_DEVICE record, all further
+ * records only contain the numeric ids.
+ */
+class BinaryWriter {
+public:
+	static constexpr size_t BUF_SIZE = 16384;
+
+	/**
+	 * Maximum size of a single record.
+	 */
+	static constexpr size_t MAX_RECORD_SIZE = 256;
+
+	/**
+	 * Maximum number of interned sources and devices.
+	 */
+	static constexpr size_t MAX_SOURCES = 1024;
+	static constexpr size_t MAX_DEVICES = 1024;
+
+private:
+	struct Source {
+		char name[N_SOURCE_NAME_CHARS + 1];
+		char hash[N_SOURCE_HASH_CHARS + 1];
+		socket::Address address;
+	};
+
+	struct Device {
+		char name[N_DEVICE_NAME_CHARS + 1];
+	};
+
+	OutputBuffer &m_output;
+	size_t m_ptr;
+	uint8_t m_buf[BUF_SIZE];
+
+	// Interned names and open-addressing hash tables mapping onto them; table
+	// entries are the id plus one, zero marks an empty slot
+	Source m_sources[MAX_SOURCES];
+	Device m_devices[MAX_DEVICES];
+	uint16_t m_source_table[2 * MAX_SOURCES];
+	uint16_t m_device_table[2 * MAX_DEVICES];
+	size_t m_n_sources;
+	size_t m_n_devices;
+
+	void clear();
+	uint8_t *record(uint8_t type, size_t size);
+	uint16_t source_id(const Demarshaller::Header &header,
+	                   const socket::Address &address);
+	uint16_t device_id(const char *name);
+	uint8_t *data_record(uint8_t type, size_t payload_size,
+	                     const Demarshaller::Header &header,
+	                     const socket::Address &address, const char *device);
+
+public:
+	explicit BinaryWriter(OutputBuffer &output);
+
+	void position(const Demarshaller::Header &header,
+	              const socket::Address &address, const char *device,
+	              int32_t position);
+
+	void velocity(const Demarshaller::Header &header,
+	              const socket::Address &address, const char *device,
+	              int32_t velocity);
+
+	void prediction(const Demarshaller::Header &header,
+	                const socket::Address &address, const char *device,
+	                int32_t position);
+
+	void telemetry(const Demarshaller::Header &header,
+	               const socket::Address &address, const char *device,
+	               uint8_t attribute, int32_t value);
+
+	void sensor(const Demarshaller::Header &header,
+	            const socket::Address &address, const char *device,
+	            uint8_t decimals, const int32_t *values, size_t n_values);
+
+	void trajectory_underrun(const Demarshaller::Header &header,
+	                         const socket::Address &address,
+	                         const char *device);
+
+	void heartbeat(const Demarshaller::Header &header,
+	               const socket::Address &address);
+
+	void report_mode(const Demarshaller::Header &header,
+	                 const socket::Address &address, int32_t deadband,
+	                 uint32_t keyframe_period);
+
+	void rtt(const Demarshaller::Header &header,
+	         const socket::Address &address, uint32_t n_sent,
+	         uint32_t n_received, uint32_t p50, uint32_t p95, uint32_t p99,
+	         uint32_t max);
+
+	void clock(const Demarshaller::Header &header,
+	           const socket::Address &address, int64_t offset, int32_t skew,
+	           uint32_t delay);
+
+	void error(const char *what);
+
+	void conflate(uint32_t n_updates, uint32_t n_records);
+
+	/**
+	 * Reports that output was discarded. Since the discarded records may have
+	 * announced ids, the id tables are cleared.
+	 */
+	void overflow(uint64_t dropped_bytes);
+
+	/**
+	 * Passes all buffered records to the output buffer.
+	 */
+	void flush();
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,334 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <ev3_event_broker/client.hpp>
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/event_loop.hpp>
+#include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/source_directory.hpp>
+#include <ev3_event_broker/source_id.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Class Client::Impl                                                         *
+ ******************************************************************************/
+
+class Client::Impl : public Demarshaller::Listener {
+private:
+	Clock &m_clock;
+	SourceId m_source_id;
+	socket::UDP m_sock;
+	int m_event_fd;
+	int m_stop_fd;
+
+	// State only accessed by the background thread
+	Demarshaller m_demarshaller;
+	socket::Address m_source_address;
+
+	// Event queue and known sources, protected by m_mutex
+	mutable std::mutex m_mutex;
+	std::vector<ev3_broker_event> m_queue;
+	size_t m_head;
+	size_t m_count;
+	uint64_t m_dropped;
+	SourceDirectory m_directory;
+
+	// Marshaller used to send commands, protected by m_send_mutex
+	std::mutex m_send_mutex;
+	socket::Address m_target_address;
+	Marshaller m_marshaller;
+
+	std::thread m_thread;
+
+	void push(const ev3_broker_event &event)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_count == m_queue.size()) {
+			// Drop the oldest event
+			m_head = (m_head + 1) % m_queue.size();
+			m_count--;
+			m_dropped++;
+		}
+		m_queue[(m_head + m_count) % m_queue.size()] = event;
+		if (m_count++ == 0) {
+			const uint64_t one = 1;
+			err(write(m_event_fd, &one, sizeof(one)));
+		}
+	}
+
+	ev3_broker_event make_event(const Demarshaller::Header &header,
+	                            uint32_t type, const char *device)
+	{
+		ev3_broker_event event;
+		memset(&event, 0, sizeof(event));
+		event.type = type;
+		event.seq = header.sequence;
+		event.t_ns = m_clock.now_ns();
+		// All names are stored in zero-padded buffers of the same size
+		memcpy(event.source_name, header.source_name,
+		       sizeof(event.source_name));
+		memcpy(event.source_hash, header.source_hash,
+		       sizeof(event.source_hash));
+		if (device) {
+			memcpy(event.device, device, sizeof(event.device));
+		}
+		event.ip[0] = m_source_address.a;
+		event.ip[1] = m_source_address.b;
+		event.ip[2] = m_source_address.c;
+		event.ip[3] = m_source_address.d;
+		event.port = m_source_address.port;
+		return event;
+	}
+
+	void run()
+	{
+		try {
+			EventLoop(m_clock)
+			    .register_event(m_sock,
+			                    [this]() -> bool {
+				                    socket::Message msg;
+				                    if (m_sock.recv(m_source_address, msg)) {
+					                    m_demarshaller.parse(*this, msg.buf(),
+					                                         msg.size());
+				                    }
+				                    return true;
+			                    })
+			    .register_event_fd(m_stop_fd, []() -> bool { return false; })
+			    .run();
+		}
+		catch (std::system_error &) {
+			// Nothing sensible to do on the background thread; the
+			// application notices that no more events arrive
+		}
+	}
+
+public:
+	Impl(int port, const char *name, size_t queue_size, Clock &clock)
+	    : m_clock(clock),
+	      m_source_id(name),
+	      m_sock(socket::Address(0, 0, 0, 0, port)),
+	      m_event_fd(err(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))),
+	      m_stop_fd(err(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))),
+	      m_queue(std::max<size_t>(queue_size, 1)),
+	      m_head(0),
+	      m_count(0),
+	      m_dropped(0),
+	      m_marshaller(
+	          [this](const uint8_t *buf, size_t buf_size) -> bool {
+		          socket::Message msg(buf, buf_size);
+		          return m_sock.send(m_target_address, msg);
+	          },
+	          m_source_id.name(), m_source_id.hash())
+	{
+		m_thread = std::thread([this]() { run(); });
+	}
+
+	~Impl()
+	{
+		const uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) == sizeof(one)) {
+			m_thread.join();
+		}
+		else {
+			m_thread.detach();
+		}
+		close(m_stop_fd);
+		close(m_event_fd);
+	}
+
+	int fd() const { return m_event_fd; }
+
+	size_t drain(ev3_broker_event *events, size_t n_events)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t n = 0;
+		for (; n < n_events && m_count > 0; n++, m_count--) {
+			events[n] = m_queue[m_head];
+			m_head = (m_head + 1) % m_queue.size();
+		}
+		if (n > 0 && m_count == 0) {
+			uint64_t value;
+			if (read(m_event_fd, &value, sizeof(value)) < 0 &&
+			    errno != EAGAIN) {
+				throw std::system_error(errno, std::system_category());
+			}
+		}
+		return n;
+	}
+
+	uint64_t dropped() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_dropped;
+	}
+
+	bool send(const char *source, const WriteCallback &write)
+	{
+		socket::Address address;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const SourceDirectory::Entry *entry = m_directory.find(source);
+			if (!entry) {
+				return false;
+			}
+			address = entry->address;
+		}
+
+		std::lock_guard<std::mutex> lock(m_send_mutex);
+		m_target_address = address;
+		write(m_marshaller);
+		m_marshaller.flush();
+		return true;
+	}
+
+	/**
+	 * Discards messages originating from this client and remembers the
+	 * address of all other sources.
+	 */
+	bool filter(const Demarshaller::Header &header) override
+	{
+		if (m_source_id.matches(header.source_name, header.source_hash)) {
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_directory.update(header, m_source_address, m_clock.now_ns());
+		return true;
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		ev3_broker_event event =
+		    make_event(header, EV3_BROKER_POSITION, position.device_name);
+		event.value = position.position;
+		push(event);
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		ev3_broker_event event =
+		    make_event(header, EV3_BROKER_VELOCITY, velocity.device_name);
+		event.value = velocity.velocity;
+		push(event);
+	}
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		ev3_broker_event event =
+		    make_event(header, EV3_BROKER_TELEMETRY, telemetry.device_name);
+		event.attribute = telemetry.attribute;
+		event.value = telemetry.value;
+		push(event);
+	}
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override
+	{
+		push(make_event(header, EV3_BROKER_TRAJECTORY_UNDERRUN,
+		                underrun.device_name));
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		ev3_broker_event event =
+		    make_event(header, EV3_BROKER_SENSOR, sensor.device_name);
+		event.decimals = sensor.decimals;
+		event.n_values = sensor.n_values;
+		memcpy(event.values, sensor.values,
+		       sensor.n_values * sizeof(event.values[0]));
+		push(event);
+	}
+
+	void on_heartbeat(const Demarshaller::Header &header) override
+	{
+		push(make_event(header, EV3_BROKER_HEARTBEAT, nullptr));
+	}
+
+	void on_report_mode(const Demarshaller::Header &header,
+	                    const Demarshaller::ReportMode &mode) override
+	{
+		ev3_broker_event event =
+		    make_event(header, EV3_BROKER_REPORT_MODE, nullptr);
+		event.value = mode.deadband;
+		event.values[0] = int32_t(mode.keyframe_period);
+		push(event);
+	}
+};
+
+/******************************************************************************
+ * Class Client                                                               *
+ ******************************************************************************/
+
+Client::Client(int port, const char *name, size_t queue_size, Clock &clock)
+    : m_impl(new Impl(port, name, queue_size, clock))
+{
+}
+
+Client::~Client()
+{
+	// Implicitly destroy m_impl, which stops the background thread
+}
+
+int Client::fd() const { return m_impl->fd(); }
+
+size_t Client::drain(ev3_broker_event *events, size_t n_events)
+{
+	return m_impl->drain(events, n_events);
+}
+
+size_t Client::poll(const EventCallback &cback)
+{
+	ev3_broker_event events[64];
+	size_t n_total = 0, n;
+	while ((n = m_impl->drain(events, 64)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			cback(events[i]);
+		}
+		n_total += n;
+		if (n < 64) {
+			break;  // Do not chase events arriving while handling the queue
+		}
+	}
+	return n_total;
+}
+
+uint64_t Client::dropped() const { return m_impl->dropped(); }
+
+bool Client::send(const char *source, const WriteCallback &write)
+{
+	return m_impl->send(source, write);
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,98 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file client.hpp
+ *
+ * Client receiving messages from EV3 Event Broker servers on a background
+ * thread. This is the implementation of libev3_broker_client.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/ev3_broker_client.h>
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The Client class listens for messages on a UDP port and queues the
+ * server --> client messages as ev3_broker_event instances until the
+ * application fetches them. Commands are sent from the calling thread to
+ * sources identified by their name; the address of a source is learned from
+ * the messages it sends. All member functions are thread-safe.
+ */
+class Client {
+public:
+	using WriteCallback = std::function<void(Marshaller &)>;
+	using EventCallback = std::function<void(const ev3_broker_event &)>;
+
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Opens the socket and starts the background thread. Throws a
+	 * std::system_error if the socket cannot be opened. Event timestamps are
+	 * read from the given clock, which is accessed from the background
+	 * thread.
+	 */
+	Client(int port, const char *name, size_t queue_size,
+	       Clock &clock = Clock::monotonic());
+	~Client();
+
+	/**
+	 * Returns a file descriptor that is readable while events are queued.
+	 */
+	int fd() const;
+
+	/**
+	 * Moves at most n_events events into the given buffer and returns the
+	 * number of events written.
+	 */
+	size_t drain(ev3_broker_event *events, size_t n_events);
+
+	/**
+	 * Calls the callback for all queued events and returns their number. The
+	 * callback is not called while the queue is locked.
+	 */
+	size_t poll(const EventCallback &cback);
+
+	/**
+	 * Returns the number of events dropped because the queue was full.
+	 */
+	uint64_t dropped() const;
+
+	/**
+	 * Calls the given function to write commands into a marshaller and sends
+	 * the resulting messages to the named source. Returns false if the
+	 * source is unknown.
+	 */
+	bool send(const char *source, const WriteCallback &write);
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,51 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include <ev3_event_broker/clock.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Class Clock                                                                *
+ ******************************************************************************/
+
+Clock::~Clock()
+{
+	// Do nothing here
+}
+
+Clock &Clock::monotonic()
+{
+	static MonotonicClock clock;
+	return clock;
+}
+
+/******************************************************************************
+ * Class MonotonicClock                                                       *
+ ******************************************************************************/
+
+int64_t MonotonicClock::now_ns() const
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return int64_t(tp.tv_sec) * 1000000000LL + int64_t(tp.tv_nsec);
+}
+
+}  // namespace ev3_event_broker
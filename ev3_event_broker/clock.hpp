@@ -0,0 +1,101 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file clock.hpp
+ *
+ * Time sources shared by the event loop, the servers and the simulation.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace ev3_event_broker {
+
+/**
+ * The Clock class is the abstract interface of all time sources. Times are
+ * measured in nanoseconds relative to an arbitrary, clock-specific origin.
+ */
+class Clock {
+public:
+	virtual ~Clock();
+
+	/**
+	 * Returns the current time in nanoseconds.
+	 */
+	virtual int64_t now_ns() const = 0;
+
+	/**
+	 * Returns true if the clock only advances when advance_to() is called. The
+	 * event loop does not wait for timers of a virtual clock but immediately
+	 * skips to the next deadline.
+	 */
+	virtual bool is_virtual() const { return false; }
+
+	/**
+	 * Advances a virtual clock to the given time in nanoseconds. Does nothing
+	 * for real-time clocks or if the given time lies in the past.
+	 */
+	virtual void advance_to(int64_t) {}
+
+	/**
+	 * Returns the current time in seconds.
+	 */
+	double now() const { return double(now_ns()) * 1e-9; }
+
+	/**
+	 * Returns a process-wide instance of the MonotonicClock.
+	 */
+	static Clock &monotonic();
+};
+
+/**
+ * Clock reading the system CLOCK_MONOTONIC.
+ */
+class MonotonicClock : public Clock {
+public:
+	int64_t now_ns() const override;
+};
+
+/**
+ * Clock that starts at zero and only advances when told to. Used to run
+ * simulations deterministically and faster than real time.
+ */
+class VirtualClock : public Clock {
+private:
+	int64_t m_t;
+
+public:
+	VirtualClock() : m_t(0) {}
+
+	int64_t now_ns() const override { return m_t; }
+
+	bool is_virtual() const override { return true; }
+
+	void advance_to(int64_t t) override
+	{
+		if (t > m_t) {
+			m_t = t;
+		}
+	}
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,109 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+
+#include <ev3_event_broker/clock_estimator.hpp>
+
+namespace ev3_event_broker {
+
+void ClockEstimator::reset()
+{
+	m_n_filter = 0;
+	m_filter_t = 0;
+	m_filter_offset = 0;
+	m_filter_delay = 0;
+	m_head = 0;
+	m_count = 0;
+	m_t_ref = 0;
+	m_offset_ref = 0;
+	m_skew = 0.0;
+	m_delay = 0;
+}
+
+void ClockEstimator::update(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+	// The remote processing time does not count towards the delay; a negative
+	// delay is possible due to rounding or a coarse clock
+	int64_t delay = (t4 - t1) - (t3 - t2);
+	if (delay < 0) {
+		delay = 0;
+	}
+	const int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+	if (m_n_filter == 0 || delay < m_filter_delay) {
+		m_filter_t = t1 + (t4 - t1) / 2;
+		m_filter_offset = offset;
+		m_filter_delay = delay;
+	}
+	if (++m_n_filter < FILTER_SIZE) {
+		return;
+	}
+
+	// Add the exchange with the smallest delay to the history
+	m_t[m_head] = m_filter_t;
+	m_offset[m_head] = m_filter_offset;
+	m_head = (m_head + 1) % HISTORY_SIZE;
+	if (m_count < HISTORY_SIZE) {
+		m_count++;
+	}
+	m_delay = m_filter_delay;
+	m_n_filter = 0;
+	fit();
+}
+
+void ClockEstimator::fit()
+{
+	// Times and offsets are taken relative to the newest sample to preserve
+	// precision
+	const size_t newest = (m_head + HISTORY_SIZE - 1) % HISTORY_SIZE;
+	m_t_ref = m_t[newest];
+	m_offset_ref = m_offset[newest];
+	m_skew = 0.0;
+	if (m_count < 2) {
+		return;
+	}
+
+	double t_mean = 0.0, x_mean = 0.0;
+	for (size_t i = 0; i < m_count; i++) {
+		t_mean += double(m_t[i] - m_t_ref);
+		x_mean += double(m_offset[i] - m_offset_ref);
+	}
+	t_mean /= m_count;
+	x_mean /= m_count;
+
+	double cov = 0.0, var = 0.0;
+	for (size_t i = 0; i < m_count; i++) {
+		const double dt = double(m_t[i] - m_t_ref) - t_mean;
+		cov += dt * (double(m_offset[i] - m_offset_ref) - x_mean);
+		var += dt * dt;
+	}
+	if (var <= 0.0) {
+		return;
+	}
+
+	// Evaluate the regression line at the newest sample
+	m_skew = cov / var;
+	m_offset_ref += std::llround(x_mean - m_skew * t_mean);
+}
+
+int64_t ClockEstimator::offset(int64_t t_local) const
+{
+	return m_offset_ref + std::llround(m_skew * double(t_local - m_t_ref));
+}
+
+}  // namespace ev3_event_broker
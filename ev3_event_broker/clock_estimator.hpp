@@ -0,0 +1,112 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file clock_estimator.hpp
+ *
+ * Estimates the offset and skew between the local clock and the clock of a
+ * remote source.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ev3_event_broker {
+
+/**
+ * The ClockEstimator class estimates the offset of a remote clock from a
+ * series of NTP-style exchanges. Each exchange consists of four timestamps:
+ * the local time t1 at which the request was sent, the remote times t2 and t3
+ * at which the request was received and answered, and the local time t4 at
+ * which the answer was received. Of every FILTER_SIZE exchanges only the one
+ * with the smallest round trip delay is kept, since queueing delays make the
+ * offset estimate of the others less accurate. The skew between both clocks
+ * is the least-squares slope of the last HISTORY_SIZE filtered offsets.
+ */
+class ClockEstimator {
+public:
+	/**
+	 * Number of exchanges the minimum-delay filter selects from.
+	 */
+	static constexpr size_t FILTER_SIZE = 8;
+
+	/**
+	 * Number of filtered offsets used to estimate the skew.
+	 */
+	static constexpr size_t HISTORY_SIZE = 16;
+
+private:
+	// Current filter window
+	size_t m_n_filter;
+	int64_t m_filter_t;
+	int64_t m_filter_offset;
+	int64_t m_filter_delay;
+
+	// Local times and offsets selected by the filter
+	int64_t m_t[HISTORY_SIZE];
+	int64_t m_offset[HISTORY_SIZE];
+	size_t m_head;
+	size_t m_count;
+
+	// Fitted model; the offset at time m_t_ref is m_offset_ref
+	int64_t m_t_ref;
+	int64_t m_offset_ref;
+	double m_skew;
+	int64_t m_delay;
+
+	void fit();
+
+public:
+	ClockEstimator() { reset(); }
+
+	void reset();
+
+	/**
+	 * Adds an exchange; all times are in nanoseconds.
+	 */
+	void update(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+	/**
+	 * Returns true once the first filter window is complete.
+	 */
+	bool valid() const { return m_count > 0; }
+
+	/**
+	 * Returns the estimated difference between the remote and the local
+	 * clock in nanoseconds at the given local time.
+	 */
+	int64_t offset(int64_t t_local) const;
+
+	/**
+	 * Returns the rate at which the offset changes, i.e. the remote clock
+	 * runs 1 + skew() times as fast as the local clock.
+	 */
+	double skew() const { return m_skew; }
+
+	/**
+	 * Returns the round trip delay in nanoseconds of the most recent exchange
+	 * selected by the filter.
+	 */
+	int64_t delay() const { return m_delay; }
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,357 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/command_parser.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static void skip_ws(const char *&src)
+{
+	while (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n') {
+		src++;
+	}
+}
+
+static bool expect(const char *&src, char c)
+{
+	skip_ws(src);
+	if (*src != c) {
+		return false;
+	}
+	src++;
+	return true;
+}
+
+/**
+ * Reads a string without escape sequences of at most n characters into the
+ * given zero-terminated buffer.
+ */
+static bool parse_string(const char *&src, char *tar, size_t n)
+{
+	if (!expect(src, '"')) {
+		return false;
+	}
+	size_t i = 0;
+	for (; *src != '"'; src++, i++) {
+		if (*src == '\0' || *src == '\\' || i == n) {
+			return false;
+		}
+		tar[i] = *src;
+	}
+	tar[i] = '\0';
+	src++;
+	return true;
+}
+
+/**
+ * Reads an integer literal; numbers with a fraction or an exponent are
+ * rejected.
+ */
+static bool parse_int(const char *&src, int64_t min, int64_t max,
+                      int64_t &value)
+{
+	skip_ws(src);
+	if (*src != '-' && (*src < '0' || *src > '9')) {
+		return false;
+	}
+	char *endptr;
+	errno = 0;
+	const long long res = strtoll(src, &endptr, 10);
+	if (errno != 0 || *endptr == '.' || *endptr == 'e' || *endptr == 'E' ||
+	    res < min || res > max) {
+		return false;
+	}
+	src = endptr;
+	value = res;
+	return true;
+}
+
+static bool parse_number(const char *&src, double &value)
+{
+	skip_ws(src);
+	if (*src != '-' && (*src < '0' || *src > '9')) {
+		return false;
+	}
+	char *endptr;
+	value = strtod(src, &endptr);
+	src = endptr;
+	return std::isfinite(value);
+}
+
+static bool parse_bool(const char *&src, bool &value)
+{
+	skip_ws(src);
+	if (strncmp(src, "true", 4) == 0) {
+		src += 4;
+		value = true;
+		return true;
+	}
+	if (strncmp(src, "false", 5) == 0) {
+		src += 5;
+		value = false;
+		return true;
+	}
+	return false;
+}
+
+static int32_t to_milli(double value)
+{
+	return int32_t(std::round(value * 1000.0));
+}
+
+/**
+ * Keys of the command schema. The bit masks are used to keep track of which
+ * keys were present.
+ */
+enum : uint32_t {
+	KEY_TYPE = 1 << 0,
+	KEY_IP = 1 << 1,
+	KEY_PORT = 1 << 2,
+	KEY_DEVICE = 1 << 3,
+	KEY_VALUE = 1 << 4,
+	KEY_MODE = 1 << 5,
+	KEY_POINTS = 1 << 6,
+	KEY_TARGET = 1 << 7
+};
+
+/******************************************************************************
+ * Class CommandParser                                                        *
+ ******************************************************************************/
+
+CommandParser::CommandParser() : m_n_commands(0), m_n_points(0) {}
+
+bool CommandParser::parse_points(const char *&src, Command &cmd)
+{
+	cmd.points_offs = m_n_points;
+	cmd.n_points = 0;
+	if (!expect(src, '[')) {
+		return false;
+	}
+	skip_ws(src);
+	if (*src == ']') {
+		src++;
+		return true;
+	}
+	do {
+		int64_t t, v;
+		if (m_n_points == MAX_POINTS || !expect(src, '[') ||
+		    !parse_int(src, 0, UINT32_MAX, t) || !expect(src, ',') ||
+		    !parse_int(src, INT32_MIN, INT32_MAX, v) || !expect(src, ']')) {
+			return false;
+		}
+		m_points[m_n_points].time = uint32_t(t);
+		m_points[m_n_points].value = int32_t(v);
+		m_n_points++;
+		cmd.n_points++;
+	} while (expect(src, ','));
+	return expect(src, ']');
+}
+
+bool CommandParser::parse_command(const char *&src)
+{
+	if (m_n_commands == MAX_COMMANDS || !expect(src, '{')) {
+		return false;
+	}
+	Command &cmd = m_commands[m_n_commands];
+	cmd = Command();
+
+	char type[24], key[16], mode[N_SENSOR_MODE_CHARS + 1] = "duty_cycle";
+	char interpolation[16] = "linear", underrun[16] = "hold";
+	bool start = false, end = false;
+	double kp = 0.0, ki = 0.0, kd = 0.0;
+	uint32_t keys = 0;
+	do {
+		if (!parse_string(src, key, sizeof(key) - 1) || !expect(src, ':')) {
+			return false;
+		}
+
+		int64_t value;
+		bool ok = true;
+		if (strcmp(key, "type") == 0) {
+			ok = parse_string(src, type, sizeof(type) - 1);
+			keys |= KEY_TYPE;
+		}
+		else if (strcmp(key, "ip") == 0) {
+			int64_t ip[4] = {0, 0, 0, 0};
+			ok = expect(src, '[') && parse_int(src, 0, 255, ip[0]) &&
+			     expect(src, ',') && parse_int(src, 0, 255, ip[1]) &&
+			     expect(src, ',') && parse_int(src, 0, 255, ip[2]) &&
+			     expect(src, ',') && parse_int(src, 0, 255, ip[3]) &&
+			     expect(src, ']');
+			cmd.target.a = uint8_t(ip[0]);
+			cmd.target.b = uint8_t(ip[1]);
+			cmd.target.c = uint8_t(ip[2]);
+			cmd.target.d = uint8_t(ip[3]);
+			keys |= KEY_IP;
+		}
+		else if (strcmp(key, "port") == 0) {
+			ok = parse_int(src, 0, 65535, value);
+			cmd.target.port = uint16_t(value);
+			keys |= KEY_PORT;
+		}
+		else if (strcmp(key, "target") == 0) {
+			ok = parse_string(src, cmd.target_name, N_SOURCE_NAME_CHARS) &&
+			     cmd.target_name[0] != '\0';
+			keys |= KEY_TARGET;
+		}
+		else if (strcmp(key, "device") == 0) {
+			ok = parse_string(src, cmd.device_name, N_DEVICE_NAME_CHARS);
+			keys |= KEY_DEVICE;
+		}
+		else if (strcmp(key, "duty_cycle") == 0 ||
+		         strcmp(key, "position") == 0 ||
+		         strcmp(key, "velocity") == 0) {
+			ok = parse_int(src, INT32_MIN, INT32_MAX, value);
+			cmd.value = int32_t(value);
+			keys |= KEY_VALUE;
+		}
+		else if (strcmp(key, "kp") == 0) {
+			ok = parse_number(src, kp);
+		}
+		else if (strcmp(key, "ki") == 0) {
+			ok = parse_number(src, ki);
+		}
+		else if (strcmp(key, "kd") == 0) {
+			ok = parse_number(src, kd);
+		}
+		else if (strcmp(key, "mode") == 0) {
+			ok = parse_string(src, mode, N_SENSOR_MODE_CHARS);
+			keys |= KEY_MODE;
+		}
+		else if (strcmp(key, "interpolation") == 0) {
+			ok = parse_string(src, interpolation, sizeof(interpolation) - 1);
+		}
+		else if (strcmp(key, "underrun") == 0) {
+			ok = parse_string(src, underrun, sizeof(underrun) - 1);
+		}
+		else if (strcmp(key, "start") == 0) {
+			ok = parse_bool(src, start);
+		}
+		else if (strcmp(key, "end") == 0) {
+			ok = parse_bool(src, end);
+		}
+		else if (strcmp(key, "points") == 0) {
+			ok = parse_points(src, cmd);
+			keys |= KEY_POINTS;
+		}
+		else {
+			ok = false;
+		}
+		if (!ok) {
+			return false;
+		}
+	} while (expect(src, ','));
+	if (!expect(src, '}')) {
+		return false;
+	}
+
+	// Check the type and the presence of the required keys; the target is
+	// either given by name or by address
+	uint32_t required = KEY_TYPE;
+	if ((keys & KEY_TARGET) == 0) {
+		required |= KEY_IP | KEY_PORT;
+	}
+	if ((keys & KEY_TYPE) == 0) {
+		return false;
+	}
+	else if (strcmp(type, "set_duty_cycle") == 0) {
+		cmd.type = Command::Type::SET_DUTY_CYCLE;
+		required |= KEY_DEVICE | KEY_VALUE;
+	}
+	else if (strcmp(type, "set_position_target") == 0) {
+		cmd.type = Command::Type::SET_POSITION_TARGET;
+		required |= KEY_DEVICE | KEY_VALUE;
+	}
+	else if (strcmp(type, "set_velocity_target") == 0) {
+		cmd.type = Command::Type::SET_VELOCITY_TARGET;
+		required |= KEY_DEVICE | KEY_VALUE;
+	}
+	else if (strcmp(type, "trajectory") == 0) {
+		cmd.type = Command::Type::TRAJECTORY;
+		required |= KEY_DEVICE | KEY_POINTS;
+	}
+	else if (strcmp(type, "set_sensor_mode") == 0) {
+		cmd.type = Command::Type::SET_SENSOR_MODE;
+		required |= KEY_DEVICE | KEY_MODE;
+	}
+	else if (strcmp(type, "reset") == 0) {
+		cmd.type = Command::Type::RESET;
+	}
+	else {
+		return false;
+	}
+	if ((keys & required) != required) {
+		return false;
+	}
+
+	cmd.kp = to_milli(kp);
+	cmd.ki = to_milli(ki);
+	cmd.kd = to_milli(kd);
+	memcpy(cmd.mode, mode, sizeof(cmd.mode));
+	if (cmd.type == Command::Type::TRAJECTORY) {
+		cmd.trajectory_mode = (strcmp(mode, "position") == 0)
+		                          ? TRAJECTORY_MODE_POSITION
+		                          : TRAJECTORY_MODE_DUTY_CYCLE;
+		cmd.trajectory_options =
+		    ((strcmp(interpolation, "cubic") == 0) ? TRAJECTORY_CUBIC : 0) |
+		    ((strcmp(underrun, "stop") == 0) ? TRAJECTORY_STOP_ON_UNDERRUN
+		                                     : 0) |
+		    (start ? TRAJECTORY_START : 0) | (end ? TRAJECTORY_END : 0);
+	}
+	m_n_commands++;
+	return true;
+}
+
+bool CommandParser::parse(const char *line)
+{
+	m_n_commands = 0;
+	m_n_points = 0;
+
+	const char *src = line;
+	skip_ws(src);
+	if (*src == '[') {
+		src++;
+		skip_ws(src);
+		if (*src != ']') {
+			do {
+				if (!parse_command(src)) {
+					return false;
+				}
+			} while (expect(src, ','));
+		}
+		if (!expect(src, ']')) {
+			return false;
+		}
+	}
+	else if (!parse_command(src)) {
+		return false;
+	}
+	skip_ws(src);
+	return *src == '\0';
+}
+
+}  // namespace ev3_event_broker
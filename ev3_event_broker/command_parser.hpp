@@ -0,0 +1,134 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file command_parser.hpp
+ *
+ * Allocation-free parser for the JSON commands read by ev3_broker_client.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * A single client --> server command as described in the "JSON message
+ * format" section of the README.
+ */
+struct Command {
+	enum class Type : uint8_t {
+		SET_DUTY_CYCLE,
+		SET_POSITION_TARGET,
+		SET_VELOCITY_TARGET,
+		TRAJECTORY,
+		SET_SENSOR_MODE,
+		RESET
+	};
+
+	Type type;
+
+	/**
+	 * Address of the target; only valid if target_name is empty. Otherwise
+	 * the address must be looked up by name.
+	 */
+	socket::Address target;
+	char target_name[N_SOURCE_NAME_CHARS + 1];
+	char device_name[N_DEVICE_NAME_CHARS + 1];
+	char mode[N_SENSOR_MODE_CHARS + 1];
+
+	/**
+	 * Duty cycle, position or velocity, depending on the type.
+	 */
+	int32_t value;
+
+	/**
+	 * Controller gains in thousandths.
+	 */
+	int32_t kp, ki, kd;
+
+	/**
+	 * TRAJECTORY_MODE_* and TRAJECTORY_* options of a trajectory.
+	 */
+	uint8_t trajectory_mode;
+	uint8_t trajectory_options;
+
+	/**
+	 * Range of the trajectory points in the points() array of the parser.
+	 */
+	size_t points_offs;
+	size_t n_points;
+};
+
+/**
+ * The CommandParser class parses a line containing either a single JSON
+ * command object or an array of command objects into a fixed-size array of
+ * Command instances. It only understands the subset of JSON produced by
+ * typical clients: strings must not contain escape sequences and objects must
+ * not contain keys other than those of the command schema. Lines outside this
+ * subset are rejected and must be handled by a generic JSON parser, which
+ * also produces sensible error messages.
+ */
+class CommandParser {
+public:
+	/**
+	 * Maximum number of commands per line.
+	 */
+	static constexpr size_t MAX_COMMANDS = 64;
+
+	/**
+	 * Maximum total number of trajectory points per line.
+	 */
+	static constexpr size_t MAX_POINTS = 1024;
+
+private:
+	Command m_commands[MAX_COMMANDS];
+	TrajectoryPoint m_points[MAX_POINTS];
+	size_t m_n_commands;
+	size_t m_n_points;
+
+	bool parse_command(const char *&src);
+	bool parse_points(const char *&src, Command &cmd);
+
+public:
+	CommandParser();
+
+	/**
+	 * Parses the given zero-terminated line. Returns false if the line cannot
+	 * be handled by this parser.
+	 */
+	bool parse(const char *line);
+
+	size_t size() const { return m_n_commands; }
+
+	const Command &operator[](size_t i) const { return m_commands[i]; }
+
+	const TrajectoryPoint *points(const Command &cmd) const
+	{
+		return m_points + cmd.points_offs;
+	}
+};
+
+}  // namespace ev3_event_broker
@@ -27,11 +27,13 @@
 
 #pragma once
 
+#include <cstdlib>
 #include <cstring>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <ev3_event_broker/error.hpp>
 
@@ -59,4 +61,14 @@ static int open_device_file(const char *device_path, const char *device_file,
 	return err(open(filename, flags, mode));
 }
 
+/**
+ * Reads an integer from the beginning of the given device file.
+ */
+static inline int read_device_int(int fd) {
+	char buf[16];
+	size_t len = err(pread(fd, buf, sizeof(buf) - 1, 0));
+	buf[len] = '\0';
+	return atoi(buf);
+}
+
 }  // namespace ev3_event_broker
@@ -0,0 +1,259 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/conflator.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static uint32_t fnv1a(uint32_t h, const char *str)
+{
+	for (; *str; str++) {
+		h = (h ^ uint8_t(*str)) * 0x01000193U;
+	}
+	return (h ^ 0xFF) * 0x01000193U;  // Separator between fields
+}
+
+static bool same_address(const socket::Address &a, const socket::Address &b)
+{
+	return a.a == b.a && a.b == b.b && a.c == b.c && a.d == b.d &&
+	       a.port == b.port;
+}
+
+/******************************************************************************
+ * Class Conflator                                                            *
+ ******************************************************************************/
+
+Conflator::Conflator(Demarshaller::Listener &next,
+                     socket::Address &source_address)
+    : m_next(next),
+      m_source_address(source_address),
+      m_n_entries(0),
+      m_n_updates(0),
+      m_passthrough(false)
+{
+	memset(m_index, 0, sizeof(m_index));
+}
+
+Conflator::Entry *Conflator::update(const Demarshaller::Header &header,
+                                    Kind kind, const char *device_name,
+                                    uint8_t attribute)
+{
+	if (m_passthrough) {
+		return nullptr;
+	}
+	m_n_updates++;
+
+	uint32_t h = fnv1a(0x811C9DC5U, header.source_name);
+	h = fnv1a(h, header.source_hash);
+	h = fnv1a(h, device_name);
+	h = (h ^ (uint32_t(kind) << 8 | attribute)) * 0x01000193U;
+	h = (h ^ m_source_address.port) * 0x01000193U;
+	h = (h ^ m_source_address.d) * 0x01000193U;
+
+	const size_t n_index = 2 * MAX_ENTRIES;
+	for (size_t i = h % n_index;; i = (i + 1) % n_index) {
+		Entry *e;
+		if (m_index[i] == 0) {
+			if (m_n_entries == MAX_ENTRIES) {
+				return nullptr;
+			}
+			m_index[i] = uint16_t(++m_n_entries);
+			e = &m_entries[m_n_entries - 1];
+			e->kind = kind;
+			e->attribute = attribute;
+			strncpy(e->device_name, device_name, sizeof(e->device_name));
+		}
+		else {
+			e = &m_entries[m_index[i] - 1];
+			if (e->kind != kind || e->attribute != attribute ||
+			    !same_address(e->address, m_source_address) ||
+			    strcmp(e->header.source_name, header.source_name) != 0 ||
+			    strcmp(e->header.source_hash, header.source_hash) != 0 ||
+			    strcmp(e->device_name, device_name) != 0) {
+				continue;
+			}
+		}
+		e->header = header;
+		e->address = m_source_address;
+		e->dirty = true;
+		return e;
+	}
+}
+
+bool Conflator::filter(const Demarshaller::Header &header)
+{
+	return m_next.filter(header);
+}
+
+void Conflator::on_position_sensor(const Demarshaller::Header &header,
+                                   const Demarshaller::PositionSensor &position)
+{
+	Entry *e = update(header, Kind::POSITION, position.device_name);
+	if (e) {
+		e->values[0] = position.position;
+	}
+	else {
+		m_next.on_position_sensor(header, position);
+	}
+}
+
+void Conflator::on_velocity_sensor(const Demarshaller::Header &header,
+                                   const Demarshaller::VelocitySensor &velocity)
+{
+	Entry *e = update(header, Kind::VELOCITY, velocity.device_name);
+	if (e) {
+		e->values[0] = velocity.velocity;
+	}
+	else {
+		m_next.on_velocity_sensor(header, velocity);
+	}
+}
+
+void Conflator::on_telemetry(const Demarshaller::Header &header,
+                             const Demarshaller::Telemetry &telemetry)
+{
+	Entry *e = update(header, Kind::TELEMETRY, telemetry.device_name,
+	                  telemetry.attribute);
+	if (e) {
+		e->values[0] = telemetry.value;
+	}
+	else {
+		m_next.on_telemetry(header, telemetry);
+	}
+}
+
+void Conflator::on_trajectory_underrun(
+    const Demarshaller::Header &header,
+    const Demarshaller::TrajectoryUnderrun &underrun)
+{
+	if (!update(header, Kind::TRAJECTORY_UNDERRUN, underrun.device_name)) {
+		m_next.on_trajectory_underrun(header, underrun);
+	}
+}
+
+void Conflator::on_sensor_values(const Demarshaller::Header &header,
+                                 const Demarshaller::SensorValues &sensor)
+{
+	Entry *e = update(header, Kind::SENSOR, sensor.device_name);
+	if (e) {
+		e->decimals = sensor.decimals;
+		e->n_values = sensor.n_values;
+		memcpy(e->values, sensor.values, sizeof(e->values));
+	}
+	else {
+		m_next.on_sensor_values(header, sensor);
+	}
+}
+
+void Conflator::on_heartbeat(const Demarshaller::Header &header)
+{
+	if (!update(header, Kind::HEARTBEAT, "")) {
+		m_next.on_heartbeat(header);
+	}
+}
+
+void Conflator::on_report_mode(const Demarshaller::Header &header,
+                               const Demarshaller::ReportMode &mode)
+{
+	Entry *e = update(header, Kind::REPORT_MODE, "");
+	if (e) {
+		e->values[0] = mode.deadband;
+		e->values[1] = int32_t(mode.keyframe_period);
+	}
+	else {
+		m_next.on_report_mode(header, mode);
+	}
+}
+
+uint32_t Conflator::emit(uint32_t &n_updates)
+{
+	const socket::Address source_address = m_source_address;
+	uint32_t n_records = 0;
+	for (size_t i = 0; i < m_n_entries; i++) {
+		Entry &e = m_entries[i];
+		if (!e.dirty) {
+			continue;
+		}
+		e.dirty = false;
+		n_records++;
+
+		m_source_address = e.address;
+		switch (e.kind) {
+			case Kind::POSITION: {
+				Demarshaller::PositionSensor msg;
+				memcpy(msg.device_name, e.device_name, sizeof(msg.device_name));
+				msg.position = e.values[0];
+				m_next.on_position_sensor(e.header, msg);
+				break;
+			}
+			case Kind::VELOCITY: {
+				Demarshaller::VelocitySensor msg;
+				memcpy(msg.device_name, e.device_name, sizeof(msg.device_name));
+				msg.velocity = e.values[0];
+				m_next.on_velocity_sensor(e.header, msg);
+				break;
+			}
+			case Kind::TELEMETRY: {
+				Demarshaller::Telemetry msg;
+				memcpy(msg.device_name, e.device_name, sizeof(msg.device_name));
+				msg.attribute = e.attribute;
+				msg.value = e.values[0];
+				m_next.on_telemetry(e.header, msg);
+				break;
+			}
+			case Kind::SENSOR: {
+				Demarshaller::SensorValues msg;
+				memcpy(msg.device_name, e.device_name, sizeof(msg.device_name));
+				msg.decimals = e.decimals;
+				msg.n_values = e.n_values;
+				memcpy(msg.values, e.values, sizeof(msg.values));
+				m_next.on_sensor_values(e.header, msg);
+				break;
+			}
+			case Kind::TRAJECTORY_UNDERRUN: {
+				Demarshaller::TrajectoryUnderrun msg;
+				memcpy(msg.device_name, e.device_name, sizeof(msg.device_name));
+				m_next.on_trajectory_underrun(e.header, msg);
+				break;
+			}
+			case Kind::HEARTBEAT:
+				m_next.on_heartbeat(e.header);
+				break;
+			case Kind::REPORT_MODE: {
+				Demarshaller::ReportMode msg;
+				msg.deadband = e.values[0];
+				msg.keyframe_period = uint32_t(e.values[1]);
+				m_next.on_report_mode(e.header, msg);
+				break;
+			}
+		}
+	}
+	m_source_address = source_address;
+
+	n_updates = m_n_updates;
+	m_n_updates = 0;
+	return n_records;
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,142 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file conflator.hpp
+ *
+ * Coalesces incoming records into a table holding the latest state of each
+ * device, which is emitted at a fixed rate.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The Conflator class is a listener sitting between the demarshaller and the
+ * listener producing the output. Instead of forwarding each record, it only
+ * remembers the latest record per source, device and record type; emit()
+ * forwards the records that changed since the last call. The output volume
+ * per period is thus bounded by the number of devices, no matter how fast the
+ * records arrive.
+ *
+ * The address of the sender is passed to the output listener through the
+ * same variable as for records received from the network; emit() temporarily
+ * overwrites it with the address stored alongside each record.
+ */
+class Conflator : public Demarshaller::Listener {
+public:
+	/**
+	 * Maximum number of table entries. Records that do not fit into the table
+	 * are forwarded immediately.
+	 */
+	static constexpr size_t MAX_ENTRIES = 1024;
+
+private:
+	enum class Kind : uint8_t {
+		POSITION,
+		VELOCITY,
+		TELEMETRY,
+		SENSOR,
+		TRAJECTORY_UNDERRUN,
+		HEARTBEAT,
+		REPORT_MODE
+	};
+
+	struct Entry {
+		Demarshaller::Header header;
+		socket::Address address;
+		Kind kind;
+		bool dirty;
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		uint8_t attribute;
+		uint8_t decimals;
+		uint8_t n_values;
+		int32_t values[SENSOR_MAX_VALUES];
+	};
+
+	Demarshaller::Listener &m_next;
+	socket::Address &m_source_address;
+
+	Entry m_entries[MAX_ENTRIES];
+	uint16_t m_index[2 * MAX_ENTRIES];  // Entry index plus one, zero if empty
+	size_t m_n_entries;
+	uint32_t m_n_updates;
+	bool m_passthrough;
+
+	/**
+	 * Returns the entry for the given key, marked as dirty, or nullptr if the
+	 * table is full or the conflator is in passthrough mode.
+	 */
+	Entry *update(const Demarshaller::Header &header, Kind kind,
+	              const char *device_name, uint8_t attribute = 0);
+
+public:
+	Conflator(Demarshaller::Listener &next, socket::Address &source_address);
+
+	bool filter(const Demarshaller::Header &header) override;
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override;
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override;
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override;
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override;
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override;
+
+	void on_heartbeat(const Demarshaller::Header &header) override;
+
+	void on_report_mode(const Demarshaller::Header &header,
+	                    const Demarshaller::ReportMode &mode) override;
+
+	/**
+	 * Forwards all records that changed since the last call to the output
+	 * listener. Returns the number of records forwarded; n_updates is set to
+	 * the number of records received in the same period.
+	 */
+	uint32_t emit(uint32_t &n_updates);
+
+	/**
+	 * In passthrough mode, all records are forwarded immediately. Records
+	 * stored before entering passthrough mode are kept until the next call
+	 * to emit().
+	 */
+	void set_passthrough(bool passthrough) { m_passthrough = passthrough; }
+
+	bool passthrough() const { return m_passthrough; }
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,186 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <ev3_event_broker/controller.hpp>
+#include <ev3_event_broker/motors.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Maximum time step in seconds. Longer gaps between two updates (e.g. because
+ * the process was not scheduled) are truncated to avoid integrator jumps.
+ */
+static constexpr double MAX_DT = 0.1;
+
+Controller::Controller(Motors &motors, double max_duty_cycle)
+    : m_motors(motors), m_max_duty_cycle(max_duty_cycle), m_last_time(0.0)
+{
+	memset(m_states, 0, sizeof(m_states));
+	disable_all();
+}
+
+Controller::State *Controller::state(DeviceHandle handle)
+{
+	if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+		return nullptr;
+	}
+	return &m_states[handle];
+}
+
+void Controller::set_target(DeviceHandle handle, Mode mode, double target,
+                            double velocity, const Gains &gains)
+{
+	State *s = state(handle);
+	if (!s) {
+		return;
+	}
+
+	// Start from scratch when switching modes, otherwise keep the integrator
+	// and (in velocity mode) the current setpoint to avoid output jumps
+	if (s->mode != mode) {
+		s->mode = mode;
+		s->initialized = false;
+		s->integral = 0.0;
+	}
+	if (mode == Mode::POSITION) {
+		s->target = target;
+	}
+	s->velocity = velocity;
+	s->gains = gains;
+	s->has_gains = true;
+}
+
+void Controller::set_position_target(DeviceHandle handle, double position,
+                                     const Gains &gains)
+{
+	set_target(handle, Mode::POSITION, position, 0.0, gains);
+}
+
+void Controller::set_velocity_target(DeviceHandle handle, double velocity,
+                                     const Gains &gains)
+{
+	set_target(handle, Mode::VELOCITY, 0.0, velocity, gains);
+}
+
+bool Controller::update_position_target(DeviceHandle handle, double position)
+{
+	State *s = state(handle);
+	if (!s || !s->has_gains) {
+		return false;
+	}
+	if (s->mode != Mode::POSITION) {
+		set_target(handle, Mode::POSITION, position, 0.0, s->gains);
+	}
+	s->target = position;
+	return true;
+}
+
+bool Controller::has_gains(DeviceHandle handle) const
+{
+	return handle >= 0 && size_t(handle) < DeviceTable::MAX_DEVICES &&
+	       m_states[handle].has_gains;
+}
+
+void Controller::disable(DeviceHandle handle)
+{
+	State *s = state(handle);
+	if (s) {
+		s->mode = Mode::OFF;
+		s->initialized = false;
+	}
+}
+
+void Controller::disable_all()
+{
+	for (size_t i = 0; i < DeviceTable::MAX_DEVICES; i++) {
+		disable(DeviceHandle(i));
+	}
+}
+
+bool Controller::active() const
+{
+	for (const State &s : m_states) {
+		if (s.mode != Mode::OFF) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Controller::update(double t)
+{
+	const double dt = std::min(t - m_last_time, MAX_DT);
+	m_last_time = t;
+	if (dt <= 0.0) {
+		return;
+	}
+
+	const double u_max = m_max_duty_cycle;
+	for (size_t i = 0; i < DeviceTable::MAX_DEVICES; i++) {
+		State &s = m_states[i];
+		if (s.mode == Mode::OFF) {
+			continue;
+		}
+
+		// Skip motors that are currently not connected; re-initialise once
+		// they are back
+		Motor *motor = m_motors.get(DeviceHandle(i));
+		if (!motor) {
+			s.initialized = false;
+			continue;
+		}
+
+		const double x = motor->get_position();
+		if (!s.initialized) {
+			s.initialized = true;
+			s.last_position = x;
+			if (s.mode == Mode::VELOCITY) {
+				s.target = x;
+			}
+		}
+		s.target += s.velocity * dt;
+
+		// Compute the PID terms. The derivative term acts on the velocity
+		// error, which avoids a derivative kick when the target is changed.
+		const double e = s.target - x;
+		const double de = s.velocity - (x - s.last_position) / dt;
+		s.last_position = x;
+
+		const double integral_prev = s.integral;
+		s.integral = std::max(
+		    -u_max, std::min(u_max, s.integral + s.gains.ki * e * dt));
+		double u = s.gains.kp * e + s.integral + s.gains.kd * de;
+
+		// Anti-windup: do not integrate further into saturation
+		if (std::abs(u) > u_max) {
+			if ((u > 0.0) == (e > 0.0)) {
+				u -= s.integral - integral_prev;
+				s.integral = integral_prev;
+			}
+			u = std::max(-u_max, std::min(u_max, u));
+		}
+
+		motor->set_duty_cycle(int(std::lround(u)));
+	}
+}
+
+}  // namespace ev3_event_broker
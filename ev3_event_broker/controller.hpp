@@ -0,0 +1,139 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file controller.hpp
+ *
+ * Closed-loop position and velocity controller running on the brick itself.
+ * The controller reads the motor positions and writes the motor duty cycles
+ * without any network round-trip.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <ev3_event_broker/device_table.hpp>
+
+namespace ev3_event_broker {
+
+class Motors;
+
+/**
+ * The Controller class implements a PID controller for each motor. In position
+ * mode the controller tracks a fixed target position. In velocity mode the
+ * target position is advanced at the requested velocity in each step, and the
+ * derivative term acts on the velocity error. This is more robust than
+ * differentiating the integer tacho counts at high sample rates.
+ */
+class Controller {
+public:
+	/**
+	 * Controller gains. Units are duty cycle percent per degree (kp), per
+	 * degree-second (ki), and per degree per second (kd).
+	 */
+	struct Gains {
+		double kp, ki, kd;
+	};
+
+private:
+	enum class Mode { OFF, POSITION, VELOCITY };
+
+	struct State {
+		Mode mode;
+		bool initialized;
+		bool has_gains;
+		Gains gains;
+		double target;
+		double velocity;
+		double integral;
+		double last_position;
+	};
+
+	Motors &m_motors;
+	double m_max_duty_cycle;
+	double m_last_time;
+	State m_states[DeviceTable::MAX_DEVICES];
+
+	State *state(DeviceHandle handle);
+	void set_target(DeviceHandle handle, Mode mode, double target,
+	                double velocity, const Gains &gains);
+
+public:
+	/**
+	 * Creates a new controller instance for the given motors. All controllers
+	 * are initially disabled.
+	 *
+	 * @param motors is the motor list the handles refer to.
+	 * @param max_duty_cycle is the maximum absolute duty cycle the controller
+	 * will output.
+	 */
+	explicit Controller(Motors &motors, double max_duty_cycle = 100.0);
+
+	/**
+	 * Enables position control for the given motor.
+	 */
+	void set_position_target(DeviceHandle handle, double position,
+	                         const Gains &gains);
+
+	/**
+	 * Enables velocity control for the given motor. The velocity is given in
+	 * degrees per second.
+	 */
+	void set_velocity_target(DeviceHandle handle, double velocity,
+	                         const Gains &gains);
+
+	/**
+	 * Updates the target position of the given motor. Switches to position
+	 * mode using the gains of the last set_position_target() or
+	 * set_velocity_target() call if the controller is in another mode.
+	 * Returns false if no gains were set for this motor so far.
+	 */
+	bool update_position_target(DeviceHandle handle, double position);
+
+	/**
+	 * Returns true if gains were set for the given motor, i.e.
+	 * update_position_target() can be used.
+	 */
+	bool has_gains(DeviceHandle handle) const;
+
+	/**
+	 * Disables the controller for the given motor, e.g. because the duty cycle
+	 * was set directly. Does not touch the current motor duty cycle.
+	 */
+	void disable(DeviceHandle handle);
+
+	/**
+	 * Disables all controllers.
+	 */
+	void disable_all();
+
+	/**
+	 * Returns true if at least one controller is enabled.
+	 */
+	bool active() const;
+
+	/**
+	 * Executes a single controller step at the given time in seconds. Reads
+	 * the position and writes the duty cycle of all controlled motors. Throws
+	 * a std::system_error if accessing a motor fails.
+	 */
+	void update(double t);
+};
+
+}  // namespace ev3_event_broker
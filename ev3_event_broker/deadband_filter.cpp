@@ -0,0 +1,101 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/deadband_filter.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Struct DeadbandFilter::Config                                              *
+ ******************************************************************************/
+
+bool DeadbandFilter::Config::parse(const char *spec)
+{
+	char *endptr;
+	if (strcmp(spec, "none") == 0) {
+		deadband = -1;
+		return true;
+	}
+	const long value = strtol(spec, &endptr, 10);
+	if (endptr == spec || value < 0 || value > 3600) {
+		return false;
+	}
+	deadband = int32_t(value);
+	if (*endptr == '\0') {
+		return true;
+	}
+	if (*endptr != ':') {
+		return false;
+	}
+	spec = endptr + 1;
+	const long period = strtol(spec, &endptr, 10);
+	if (endptr == spec || *endptr != '\0' || period <= 0 || period > 3600000) {
+		return false;
+	}
+	keyframe_period = uint32_t(period);
+	return true;
+}
+
+/******************************************************************************
+ * Class DeadbandFilter                                                       *
+ ******************************************************************************/
+
+DeadbandFilter::DeadbandFilter(const Config &config)
+    : m_config(config), m_keyframe(true), m_next_keyframe(0.0)
+{
+	memset(m_states, 0, sizeof(m_states));
+}
+
+bool DeadbandFilter::begin(double t)
+{
+	m_keyframe = !enabled() || (t >= m_next_keyframe);
+	if (m_keyframe && enabled()) {
+		// Schedule relative to the current time; sampling is not precise
+		// enough for the keyframes to stay in phase anyway
+		m_next_keyframe = t + 1e-3 * m_config.keyframe_period;
+	}
+	return m_keyframe;
+}
+
+bool DeadbandFilter::update(DeviceHandle handle, int32_t position,
+                            double velocity)
+{
+	if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+		return true;
+	}
+
+	// Report the motor if it moved, or once more when it comes to rest such
+	// that the last velocity seen by the receivers is zero
+	State &s = m_states[handle];
+	const bool moving = std::abs(velocity) >= REST_VELOCITY;
+	const bool report =
+	    m_keyframe || !s.valid ||
+	    std::abs(int64_t(position) - int64_t(s.position)) > m_config.deadband ||
+	    (s.moving && !moving);
+	if (report) {
+		s.valid = true;
+		s.moving = moving;
+		s.position = position;
+	}
+	return report;
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,109 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file deadband_filter.hpp
+ *
+ * Decides which motor positions have to be reported to the clients.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <ev3_event_broker/device_table.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The DeadbandFilter class suppresses position reports of motors that did not
+ * move. A motor is reported if its position changed by more than the deadband
+ * since the last report, or if it just came to rest. In addition, all motors
+ * are reported in keyframes sent at a lower rate, such that receivers can
+ * recover from lost packets.
+ */
+class DeadbandFilter {
+public:
+	/**
+	 * Velocity in degrees per second below which a motor is considered to be
+	 * at rest.
+	 */
+	static constexpr double REST_VELOCITY = 1.0;
+
+	struct Config {
+		/**
+		 * Deadband in degrees, or a negative value if every sample should be
+		 * reported.
+		 */
+		int32_t deadband;
+
+		/**
+		 * Period in which all motors are reported in milliseconds.
+		 */
+		uint32_t keyframe_period;
+
+		Config() : deadband(-1), keyframe_period(1000) {}
+
+		/**
+		 * Parses a specification of the form "none" or
+		 * "DEADBAND[:KEYFRAME_PERIOD]", where the deadband is given in degrees
+		 * and the keyframe period in milliseconds. Returns false if the
+		 * specification is invalid.
+		 */
+		bool parse(const char *spec);
+	};
+
+private:
+	struct State {
+		bool valid;
+		bool moving;
+		int32_t position;
+	};
+
+	Config m_config;
+	State m_states[DeviceTable::MAX_DEVICES];
+	bool m_keyframe;
+	double m_next_keyframe;
+
+public:
+	explicit DeadbandFilter(const Config &config = Config());
+
+	const Config &config() const { return m_config; }
+
+	/**
+	 * Returns true if the deadband is enabled, i.e. not every sample is
+	 * reported.
+	 */
+	bool enabled() const { return m_config.deadband >= 0; }
+
+	/**
+	 * Must be called once before the motor positions sampled at time t in
+	 * seconds are passed to update(). Returns true if the current sample is a
+	 * keyframe.
+	 */
+	bool begin(double t);
+
+	/**
+	 * Returns true if the given motor position and velocity estimate in
+	 * degrees and degrees per second should be reported.
+	 */
+	bool update(DeviceHandle handle, int32_t position, double velocity);
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,95 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/device_table.hpp>
+
+namespace ev3_event_broker {
+
+static_assert((DeviceTable::MAX_DEVICES & (DeviceTable::MAX_DEVICES - 1)) == 0,
+              "MAX_DEVICES must be a power of two");
+
+DeviceTable::DeviceTable() : m_size(0)
+{
+	memset(m_slots, 0, sizeof(m_slots));
+	for (Slot &slot : m_slots) {
+		slot.handle = INVALID_DEVICE_HANDLE;
+	}
+}
+
+void DeviceTable::pad_name(const char *name, char *tar)
+{
+	size_t i = 0;
+	for (; (i < NAME_SIZE) && name[i]; i++) {
+		tar[i] = name[i];
+	}
+	for (; i < NAME_SIZE; i++) {
+		tar[i] = 0;
+	}
+}
+
+uint32_t DeviceTable::hash(const char *name)
+{
+	// 32-bit FNV-1a over the raw name bytes
+	uint32_t h = 2166136261U;
+	for (size_t i = 0; i < NAME_SIZE; i++) {
+		h = (h ^ uint8_t(name[i])) * 16777619U;
+	}
+	return h;
+}
+
+const DeviceTable::Slot *DeviceTable::lookup(const char *padded_name) const
+{
+	// Linear probing; the table is never more than half full, so there always
+	// is an empty slot terminating the probe sequence.
+	size_t idx = hash(padded_name) & (N_SLOTS - 1);
+	while (true) {
+		const Slot &slot = m_slots[idx];
+		if (slot.handle == INVALID_DEVICE_HANDLE ||
+		    memcmp(slot.name, padded_name, NAME_SIZE) == 0) {
+			return &slot;
+		}
+		idx = (idx + 1) & (N_SLOTS - 1);
+	}
+}
+
+DeviceHandle DeviceTable::insert(const char *name)
+{
+	char padded_name[NAME_SIZE];
+	pad_name(name, padded_name);
+
+	Slot *slot = const_cast<Slot *>(lookup(padded_name));
+	if (slot->handle == INVALID_DEVICE_HANDLE) {
+		if (m_size >= MAX_DEVICES) {
+			return INVALID_DEVICE_HANDLE;
+		}
+		memcpy(slot->name, padded_name, NAME_SIZE);
+		slot->handle = DeviceHandle(m_size++);
+	}
+	return slot->handle;
+}
+
+DeviceHandle DeviceTable::find(const char *name) const
+{
+	char padded_name[NAME_SIZE];
+	pad_name(name, padded_name);
+	return lookup(padded_name)->handle;
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,106 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file device_table.hpp
+ *
+ * Maps fixed-size device names to dense integer handles. Handles are resolved
+ * once and can then be used to index plain arrays instead of comparing names
+ * for every incoming message.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ev3_event_broker {
+
+/**
+ * Integer referring to a device. Valid handles are dense and start at zero.
+ */
+using DeviceHandle = int;
+
+/**
+ * Handle returned if a device name could not be resolved.
+ */
+static constexpr DeviceHandle INVALID_DEVICE_HANDLE = -1;
+
+/**
+ * Small open-addressing hash table mapping device names to handles. The table
+ * has a fixed capacity and never allocates memory. Handles are assigned in the
+ * order in which names are inserted and are never reused for another name.
+ */
+class DeviceTable {
+public:
+	/**
+	 * Maximum number of distinct device names that can be stored.
+	 */
+	static constexpr size_t MAX_DEVICES = 32;
+
+	/**
+	 * Number of bytes in a device name. Shorter names are padded with zeros.
+	 */
+	static constexpr size_t NAME_SIZE = 16;
+
+private:
+	/**
+	 * Number of slots in the hash table. Must be a power of two; keeping the
+	 * table at most half full ensures short probe sequences.
+	 */
+	static constexpr size_t N_SLOTS = 2 * MAX_DEVICES;
+
+	struct Slot {
+		char name[NAME_SIZE];
+		DeviceHandle handle;
+	};
+
+	Slot m_slots[N_SLOTS];
+	size_t m_size;
+
+	static void pad_name(const char *name, char *tar);
+	static uint32_t hash(const char *name);
+
+	const Slot *lookup(const char *padded_name) const;
+
+public:
+	DeviceTable();
+
+	/**
+	 * Returns the handle associated with the given zero-terminated name. Adds
+	 * the name to the table if it has not been seen before. Returns
+	 * INVALID_DEVICE_HANDLE if the table is full.
+	 */
+	DeviceHandle insert(const char *name);
+
+	/**
+	 * Returns the handle associated with the given zero-terminated name or
+	 * INVALID_DEVICE_HANDLE if the name is not known.
+	 */
+	DeviceHandle find(const char *name) const;
+
+	/**
+	 * Number of names stored in the table. All handles are smaller than this
+	 * value.
+	 */
+	size_t size() const { return m_size; }
+};
+
+}  // namespace ev3_event_broker
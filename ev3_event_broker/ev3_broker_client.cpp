@@ -0,0 +1,190 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#include <ev3_event_broker/client.hpp>
+#include <ev3_event_broker/ev3_broker_client.h>
+
+using namespace ev3_event_broker;
+
+struct ev3_broker_client {
+	Client client;
+
+	ev3_broker_client(int port, const char *name, size_t queue_size)
+	    : client(port, name, queue_size)
+	{
+	}
+};
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static int32_t to_milli(double value)
+{
+	return int32_t(std::round(value * 1000.0));
+}
+
+/**
+ * Sends the commands written by the given function to the source and
+ * translates the result into the C convention.
+ */
+static int send(ev3_broker_client *client, const char *source,
+                const Client::WriteCallback &write)
+{
+	try {
+		if (!client->client.send(source, write)) {
+			errno = ENOENT;
+			return -1;
+		}
+		return 0;
+	}
+	catch (std::system_error &e) {
+		errno = e.code().value();
+		return -1;
+	}
+	catch (std::bad_alloc &) {
+		errno = ENOMEM;
+		return -1;
+	}
+}
+
+/******************************************************************************
+ * C API                                                                      *
+ ******************************************************************************/
+
+ev3_broker_client *ev3_broker_client_open(int port, const char *name,
+                                          size_t queue_size)
+{
+	try {
+		return new ev3_broker_client(port, name, queue_size);
+	}
+	catch (std::system_error &e) {
+		errno = e.code().value();
+	}
+	catch (std::bad_alloc &) {
+		errno = ENOMEM;
+	}
+	return nullptr;
+}
+
+void ev3_broker_client_close(ev3_broker_client *client) { delete client; }
+
+int ev3_broker_client_fd(const ev3_broker_client *client)
+{
+	return client->client.fd();
+}
+
+size_t ev3_broker_client_drain(ev3_broker_client *client,
+                               ev3_broker_event *events, size_t n_events)
+{
+	try {
+		return client->client.drain(events, n_events);
+	}
+	catch (std::system_error &e) {
+		errno = e.code().value();
+		return 0;
+	}
+}
+
+size_t ev3_broker_client_poll(ev3_broker_client *client,
+                              ev3_broker_callback callback, void *user_data)
+{
+	try {
+		return client->client.poll([&](const ev3_broker_event &event) {
+			callback(&event, user_data);
+		});
+	}
+	catch (std::system_error &e) {
+		errno = e.code().value();
+		return 0;
+	}
+}
+
+uint64_t ev3_broker_client_dropped(const ev3_broker_client *client)
+{
+	return client->client.dropped();
+}
+
+int ev3_broker_client_set_duty_cycle(ev3_broker_client *client,
+                                     const char *source, const char *device,
+                                     int32_t duty_cycle)
+{
+	return send(client, source, [&](Marshaller &marshaller) {
+		marshaller.write_set_duty_cycle(device, duty_cycle);
+	});
+}
+
+int ev3_broker_client_set_position_target(ev3_broker_client *client,
+                                          const char *source,
+                                          const char *device, int32_t position,
+                                          double kp, double ki, double kd)
+{
+	return send(client, source, [&](Marshaller &marshaller) {
+		marshaller.write_set_position_target(device, position, to_milli(kp),
+		                                     to_milli(ki), to_milli(kd));
+	});
+}
+
+int ev3_broker_client_set_velocity_target(ev3_broker_client *client,
+                                          const char *source,
+                                          const char *device, int32_t velocity,
+                                          double kp, double ki, double kd)
+{
+	return send(client, source, [&](Marshaller &marshaller) {
+		marshaller.write_set_velocity_target(device, velocity, to_milli(kp),
+		                                     to_milli(ki), to_milli(kd));
+	});
+}
+
+int ev3_broker_client_trajectory(ev3_broker_client *client,
+                                 const char *source, const char *device,
+                                 uint8_t mode, uint8_t options,
+                                 const uint32_t *times, const int32_t *values,
+                                 size_t n_points)
+{
+	return send(client, source, [&](Marshaller &marshaller) {
+		std::vector<TrajectoryPoint> points(n_points);
+		for (size_t i = 0; i < n_points; i++) {
+			points[i].time = times[i];
+			points[i].value = values[i];
+		}
+		marshaller.write_trajectory_chunked(device, mode, options,
+		                                    points.data(), n_points);
+	});
+}
+
+int ev3_broker_client_set_sensor_mode(ev3_broker_client *client,
+                                      const char *source, const char *device,
+                                      const char *mode)
+{
+	return send(client, source, [&](Marshaller &marshaller) {
+		marshaller.write_set_sensor_mode(device, mode);
+	});
+}
+
+int ev3_broker_client_reset(ev3_broker_client *client, const char *source)
+{
+	return send(client, source,
+	            [&](Marshaller &marshaller) { marshaller.write_reset(); });
+}
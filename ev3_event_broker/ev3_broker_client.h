@@ -0,0 +1,174 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file ev3_broker_client.h
+ *
+ * Plain C interface of libev3_broker_client, which allows controllers to talk
+ * to EV3 Event Broker servers without spawning ev3_broker_client.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opaque handle of a client instance.
+ */
+typedef struct ev3_broker_client ev3_broker_client;
+
+/**
+ * Event types; correspond to the server --> client messages.
+ */
+enum {
+	EV3_BROKER_POSITION = 0x01,
+	EV3_BROKER_VELOCITY = 0x02,
+	EV3_BROKER_TELEMETRY = 0x03,
+	EV3_BROKER_SENSOR = 0x04,
+	EV3_BROKER_TRAJECTORY_UNDERRUN = 0x05,
+	EV3_BROKER_HEARTBEAT = 0x06,
+	EV3_BROKER_REPORT_MODE = 0x07
+};
+
+/**
+ * Trajectory modes and options; see the TRAJECTORY_* constants in
+ * marshaller.hpp.
+ */
+enum {
+	EV3_BROKER_TRAJECTORY_MODE_DUTY_CYCLE = 0x00,
+	EV3_BROKER_TRAJECTORY_MODE_POSITION = 0x01,
+	EV3_BROKER_TRAJECTORY_CUBIC = 0x01,
+	EV3_BROKER_TRAJECTORY_STOP_ON_UNDERRUN = 0x02,
+	EV3_BROKER_TRAJECTORY_START = 0x04,
+	EV3_BROKER_TRAJECTORY_END = 0x08
+};
+
+/**
+ * A single received event. Strings are zero-terminated. The meaning of value
+ * depends on the type: the position in degrees, the velocity in thousandths
+ * of degrees per second, the telemetry value, or the deadband in degrees of a
+ * report mode event. Sensor values are obtained by dividing values[i] by
+ * 10^decimals; the keyframe period of a report mode event in milliseconds is
+ * stored in values[0].
+ */
+typedef struct {
+	uint32_t type;
+	uint32_t seq;
+	int64_t t_ns; /* CLOCK_MONOTONIC receive time */
+	char source_name[17];
+	char source_hash[9];
+	char device[17];
+	uint8_t ip[4];
+	uint16_t port;
+	uint8_t attribute;
+	uint8_t decimals;
+	uint8_t n_values;
+	int32_t value;
+	int32_t values[8];
+} ev3_broker_event;
+
+typedef void (*ev3_broker_callback)(const ev3_broker_event *event,
+                                    void *user_data);
+
+/**
+ * Opens a client listening on the given UDP port and starts the background
+ * thread receiving messages. Received events are queued until they are
+ * fetched using ev3_broker_client_drain() or ev3_broker_client_poll(); at
+ * most queue_size events are kept, older events are dropped. Returns NULL and
+ * sets errno on failure.
+ */
+ev3_broker_client *ev3_broker_client_open(int port, const char *name,
+                                          size_t queue_size);
+
+/**
+ * Stops the background thread and frees all resources.
+ */
+void ev3_broker_client_close(ev3_broker_client *client);
+
+/**
+ * Returns a file descriptor that is readable while events are queued. Can be
+ * used to integrate the client into poll()-based event loops.
+ */
+int ev3_broker_client_fd(const ev3_broker_client *client);
+
+/**
+ * Moves at most n_events queued events into the given buffer and returns the
+ * number of events written. Returns zero and sets errno on failure.
+ */
+size_t ev3_broker_client_drain(ev3_broker_client *client,
+                               ev3_broker_event *events, size_t n_events);
+
+/**
+ * Calls the callback for each queued event in the calling thread and returns
+ * the number of events handled. Returns zero and sets errno on failure.
+ */
+size_t ev3_broker_client_poll(ev3_broker_client *client,
+                              ev3_broker_callback callback, void *user_data);
+
+/**
+ * Returns the number of events dropped because the queue was full.
+ */
+uint64_t ev3_broker_client_dropped(const ev3_broker_client *client);
+
+/**
+ * The following functions send a command to the source with the given name.
+ * Commands can only be sent to sources the client has received a message
+ * from. Return zero on success; return -1 and set errno on failure, in
+ * particular ENOENT if the source is unknown. Controller gains are given in
+ * the same units as in the JSON messages.
+ */
+int ev3_broker_client_set_duty_cycle(ev3_broker_client *client,
+                                     const char *source, const char *device,
+                                     int32_t duty_cycle);
+
+int ev3_broker_client_set_position_target(ev3_broker_client *client,
+                                          const char *source,
+                                          const char *device, int32_t position,
+                                          double kp, double ki, double kd);
+
+int ev3_broker_client_set_velocity_target(ev3_broker_client *client,
+                                          const char *source,
+                                          const char *device, int32_t velocity,
+                                          double kp, double ki, double kd);
+
+/**
+ * Sends a trajectory consisting of n_points (time in milliseconds, value)
+ * pairs. Long trajectories are split into multiple messages.
+ */
+int ev3_broker_client_trajectory(ev3_broker_client *client,
+                                 const char *source, const char *device,
+                                 uint8_t mode, uint8_t options,
+                                 const uint32_t *times, const int32_t *values,
+                                 size_t n_points);
+
+int ev3_broker_client_set_sensor_mode(ev3_broker_client *client,
+                                      const char *source, const char *device,
+                                      const char *mode);
+
+int ev3_broker_client_reset(ev3_broker_client *client, const char *source);
+
+#ifdef __cplusplus
+}
+#endif
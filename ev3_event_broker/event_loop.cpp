@@ -17,7 +17,6 @@
  */
 
 #include <algorithm>
-#include <chrono>
 #include <climits>
 #include <cstdint>
 #include <vector>
@@ -36,11 +35,9 @@ namespace ev3_event_broker {
 
 class EventLoop::Impl {
 private:
-	static int64_t now()
-	{
-		const auto t = std::chrono::steady_clock::now().time_since_epoch();
-		return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
-	}
+	Clock &m_clock;
+
+	int64_t now() const { return m_clock.now_ns() / 1000000; }
 
 	struct Timer {
 		Callback cback;
@@ -54,6 +51,8 @@ private:
 	};
 
 	std::vector<Callback> m_cbacks;
+	std::vector<Callback> m_pending;
+	std::vector<int> m_fds;
 	std::vector<struct pollfd> m_pollfds;
 
 	std::vector<Timer> m_timers;
@@ -69,12 +68,27 @@ private:
 	}
 
 public:
+	explicit Impl(Clock &clock) : m_clock(clock) {}
+
+	Clock &clock() const { return m_clock; }
+
 	void register_event_fd(int fd, const EventLoop::Callback &cback)
 	{
 		m_cbacks.push_back(cback);
+		m_pending.emplace_back();
+		m_fds.push_back(fd);
 		m_pollfds.emplace_back(pollfd{fd, POLLIN, 0});
 	}
 
+	void register_output_fd(int fd, const EventLoop::Callback &pending,
+	                        const EventLoop::Callback &cback)
+	{
+		m_cbacks.push_back(cback);
+		m_pending.push_back(pending);
+		m_fds.push_back(fd);
+		m_pollfds.emplace_back(pollfd{fd, POLLOUT, 0});
+	}
+
 	void register_timer(int interval_ms, const EventLoop::Callback &cback)
 	{
 		m_timers.emplace_back(cback, interval_ms, now() + interval_ms);
@@ -86,10 +100,23 @@ public:
 			// Compute the time until the next timeout event
 			int timeout = compute_timeout();
 
+			// Only poll output file descriptors with pending data; poll()
+			// ignores negative file descriptors
+			for (size_t i = 0; i < m_pollfds.size(); i++) {
+				if (m_pending[i]) {
+					m_pollfds[i].fd = m_pending[i]() ? m_fds[i] : -1;
+				}
+			}
+
+			// Virtual clocks skip to the next deadline instead of waiting;
+			// only handle events that are already pending
+			const bool skip = m_clock.is_virtual() && timeout < INT_MAX;
+
 			// If there is time to wait, wait for incoming events
 			if (timeout > 0) {
 				int res;
-				res = poll(m_pollfds.data(), m_pollfds.size(), timeout);
+				res = poll(m_pollfds.data(), m_pollfds.size(),
+				           skip ? 0 : timeout);
 				if (res >= 0) {
 					for (size_t i = 0; i < m_pollfds.size(); i++) {
 						struct pollfd &fd = m_pollfds[i];
@@ -107,6 +134,9 @@ public:
 				else {
 					throw std::system_error(errno, std::system_category());
 				}
+				if (skip) {
+					m_clock.advance_to((now() + timeout) * 1000000);
+				}
 			}
 
 			// Execute timers
@@ -127,7 +157,7 @@ public:
  * Class EventLoop                                                            *
  ******************************************************************************/
 
-EventLoop::EventLoop() : m_impl(new Impl()) {}
+EventLoop::EventLoop(Clock &clock) : m_impl(new Impl(clock)) {}
 
 EventLoop::~EventLoop()
 {
@@ -140,12 +170,21 @@ EventLoop &EventLoop::register_event_fd(int fd, const Callback &cback)
 	return *this;
 }
 
+EventLoop &EventLoop::register_output_fd(int fd, const Callback &pending,
+                                         const Callback &cback)
+{
+	m_impl->register_output_fd(fd, pending, cback);
+	return *this;
+}
+
 EventLoop &EventLoop::register_timer(int interval_ms, const Callback &cback)
 {
 	m_impl->register_timer(interval_ms, cback);
 	return *this;
 }
 
+Clock &EventLoop::clock() const { return m_impl->clock(); }
+
 void EventLoop::run() { return m_impl->run(); }
 
 }  // namespace ev3_event_broker
@@ -22,6 +22,8 @@
 #include <functional>
 #include <memory>
 
+#include <ev3_event_broker/clock.hpp>
+
 namespace ev3_event_broker {
 
 class EventLoop {
@@ -32,11 +34,26 @@ private:
 public:
 	using Callback = std::function<bool()>;
 
-	EventLoop();
+	/**
+	 * Creates an event loop whose timers are driven by the given clock. If the
+	 * clock is virtual, the loop does not wait for timers but advances the
+	 * clock to the next deadline once all pending events have been handled.
+	 */
+	explicit EventLoop(Clock &clock = Clock::monotonic());
 	~EventLoop();
 
+	Clock &clock() const;
+
 	EventLoop &register_event_fd(int fd, const Callback &cback);
 
+	/**
+	 * Calls the given callback whenever the file descriptor is writable. The
+	 * file descriptor is only polled while the "pending" callback returns
+	 * true, i.e. while there is data waiting to be written.
+	 */
+	EventLoop &register_output_fd(int fd, const Callback &pending,
+	                              const Callback &cback);
+
 	template <typename T>
 	EventLoop &register_event(T &obj, const Callback &cback) {
 		return register_event_fd(obj.fd(), cback);
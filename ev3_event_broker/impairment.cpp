@@ -0,0 +1,318 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/impairment.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Size of the IPv4 and UDP headers in bytes; counted against the link rate.
+ */
+static constexpr size_t IP_UDP_HEADER_SIZE = 28;
+
+/**
+ * Shape parameter of the Pareto jitter distribution.
+ */
+static constexpr double PARETO_SHAPE = 3.0;
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static bool parse_double(const char *value, const char *end, double &tar)
+{
+	char *endptr;
+	tar = strtod(value, &endptr);
+	return (endptr == end) && (endptr != value) && (tar >= 0.0);
+}
+
+static bool parse_percent(const char *value, const char *end, double &tar)
+{
+	return parse_double(value, end, tar) && (tar <= 100.0);
+}
+
+/******************************************************************************
+ * Struct Impairment::Config                                                  *
+ ******************************************************************************/
+
+Impairment::Config::Config()
+    : delay(0.0),
+      jitter(0.0),
+      distribution(Jitter::UNIFORM),
+      loss(0.0),
+      burst_enter(0.0),
+      burst_exit(0.0),
+      duplicate(0.0),
+      reorder(0.0),
+      rate(0.0),
+      limit(64),
+      seed(1)
+{
+}
+
+bool Impairment::Config::enabled() const
+{
+	return (delay > 0.0) || (jitter > 0.0) || (loss > 0.0) ||
+	       (burst_enter > 0.0) || (duplicate > 0.0) || (reorder > 0.0) ||
+	       (rate > 0.0);
+}
+
+bool Impairment::Config::parse(const char *spec)
+{
+	Config res;
+	if (strcmp(spec, "none") == 0) {
+		*this = res;
+		return true;
+	}
+	while (*spec) {
+		const char *end = strchr(spec, ',');
+		if (!end) {
+			end = spec + strlen(spec);
+		}
+		const char *sep = strchr(spec, '=');
+		if (!sep || sep > end) {
+			return false;
+		}
+		const size_t key_len = sep - spec;
+		const char *value = sep + 1;
+		auto is_key = [&](const char *key) {
+			return (strlen(key) == key_len) &&
+			       (strncmp(spec, key, key_len) == 0);
+		};
+
+		bool ok = false;
+		if (is_key("delay")) {
+			ok = parse_double(value, end, res.delay);
+		}
+		else if (is_key("jitter")) {
+			const char *colon = strchr(value, ':');
+			if (!colon || colon > end) {
+				ok = parse_double(value, end, res.jitter);
+			}
+			else if (parse_double(value, colon, res.jitter)) {
+				const size_t len = end - colon - 1;
+				ok = true;
+				if (len == 7 && strncmp(colon + 1, "uniform", len) == 0) {
+					res.distribution = Jitter::UNIFORM;
+				}
+				else if (len == 6 && strncmp(colon + 1, "normal", len) == 0) {
+					res.distribution = Jitter::NORMAL;
+				}
+				else if (len == 6 && strncmp(colon + 1, "pareto", len) == 0) {
+					res.distribution = Jitter::PARETO;
+				}
+				else {
+					ok = false;
+				}
+			}
+		}
+		else if (is_key("loss")) {
+			ok = parse_percent(value, end, res.loss);
+		}
+		else if (is_key("burst")) {
+			const char *colon = strchr(value, ':');
+			ok = colon && (colon < end) &&
+			     parse_percent(value, colon, res.burst_enter) &&
+			     parse_percent(colon + 1, end, res.burst_exit) &&
+			     (res.burst_exit > 0.0);
+		}
+		else if (is_key("dup")) {
+			ok = parse_percent(value, end, res.duplicate);
+		}
+		else if (is_key("reorder")) {
+			ok = parse_percent(value, end, res.reorder);
+		}
+		else if (is_key("rate")) {
+			ok = parse_double(value, end, res.rate);
+		}
+		else if (is_key("limit")) {
+			char *endptr;
+			res.limit = strtoul(value, &endptr, 10);
+			ok = (endptr == end) && (res.limit > 0) && (res.limit <= 4096);
+		}
+		else if (is_key("seed")) {
+			char *endptr;
+			res.seed = strtoull(value, &endptr, 10);
+			ok = (endptr == end) && (endptr != value);
+		}
+		if (!ok) {
+			return false;
+		}
+		spec = (*end == ',') ? (end + 1) : end;
+	}
+	*this = res;
+	return true;
+}
+
+/******************************************************************************
+ * Class Impairment                                                           *
+ ******************************************************************************/
+
+Impairment::Impairment(const Config &config, const Clock &clock,
+                       const Sink &sink)
+    : m_config(config),
+      m_clock(clock),
+      m_sink(sink),
+      m_packets(config.limit),
+      m_rng(splitmix64(config.seed) | 1U),
+      m_seq(0),
+      m_link_free(0),
+      m_bad_state(false)
+{
+	m_free.reserve(config.limit);
+	m_queue.reserve(config.limit);
+	for (size_t i = config.limit; i > 0; i--) {
+		m_free.push_back(i - 1);
+	}
+}
+
+double Impairment::uniform()
+{
+	// xorshift64*
+	m_rng ^= m_rng >> 12;
+	m_rng ^= m_rng << 25;
+	m_rng ^= m_rng >> 27;
+	return double((m_rng * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+bool Impairment::chance(double percent)
+{
+	return (percent > 0.0) && (uniform() * 100.0 < percent);
+}
+
+double Impairment::jitter()
+{
+	const double j = m_config.jitter;
+	if (j <= 0.0) {
+		return 0.0;
+	}
+	switch (m_config.distribution) {
+		case Jitter::NORMAL: {
+			// Box-Muller transform; 1 - uniform() is in (0, 1]
+			const double r = std::sqrt(-2.0 * std::log(1.0 - uniform()));
+			return j * r * std::cos(2.0 * M_PI * uniform());
+		}
+		case Jitter::PARETO: {
+			const double x_min = j * (PARETO_SHAPE - 1.0) / PARETO_SHAPE;
+			return x_min / std::pow(1.0 - uniform(), 1.0 / PARETO_SHAPE);
+		}
+		default:
+			return j * (2.0 * uniform() - 1.0);
+	}
+}
+
+bool Impairment::later(size_t a, size_t b) const
+{
+	// Packets with the same release time leave in the order they arrived
+	const Packet &pa = m_packets[a], &pb = m_packets[b];
+	return (pa.t_release != pb.t_release) ? (pa.t_release > pb.t_release)
+	                                      : (pa.seq > pb.seq);
+}
+
+bool Impairment::lost()
+{
+	if (m_config.burst_enter > 0.0) {
+		m_bad_state = chance(m_bad_state ? (100.0 - m_config.burst_exit)
+		                                 : m_config.burst_enter);
+		if (m_bad_state) {
+			return true;
+		}
+	}
+	return chance(m_config.loss);
+}
+
+bool Impairment::enqueue(const socket::Address &address, const uint8_t *buf,
+                         size_t size, int64_t t_release)
+{
+	if (m_free.empty()) {
+		return false;  // Queue overflow, drop the packet
+	}
+	const size_t idx = m_free.back();
+	m_free.pop_back();
+
+	Packet &packet = m_packets[idx];
+	packet.t_release = t_release;
+	packet.seq = m_seq++;
+	packet.address = address;
+	packet.size = size;
+	memcpy(packet.buf, buf, size);
+
+	m_queue.push_back(idx);
+	std::push_heap(m_queue.begin(), m_queue.end(),
+	               [this](size_t a, size_t b) { return later(a, b); });
+	return true;
+}
+
+void Impairment::push(const socket::Address &address, const uint8_t *buf,
+                      size_t size)
+{
+	if (size > MAX_PACKET_SIZE || lost()) {
+		return;
+	}
+
+	const int64_t now = m_clock.now_ns();
+	const size_t n_copies = chance(m_config.duplicate) ? 2 : 1;
+	for (size_t i = 0; i < n_copies; i++) {
+		// Wait until the link is free, then transmit the packet
+		int64_t t = now;
+		if (m_config.rate > 0.0) {
+			const double t_tx = double((size + IP_UDP_HEADER_SIZE) * 8U) /
+			                    (m_config.rate * 1e3);
+			t = std::max(t, m_link_free) + int64_t(t_tx * 1e9);
+		}
+		const int64_t t_sent = t;
+
+		// Add the propagation delay unless the packet is reordered
+		if (!chance(m_config.reorder)) {
+			const double delay = std::max(0.0, m_config.delay + jitter());
+			t += int64_t(delay * 1e6);
+		}
+
+		// Packets dropped due to a full queue do not occupy the link
+		if (enqueue(address, buf, size, t) && m_config.rate > 0.0) {
+			m_link_free = t_sent;
+		}
+	}
+	flush();
+}
+
+void Impairment::flush()
+{
+	const int64_t now = m_clock.now_ns();
+	while (!m_queue.empty() && m_packets[m_queue.front()].t_release <= now) {
+		std::pop_heap(m_queue.begin(), m_queue.end(),
+		              [this](size_t a, size_t b) { return later(a, b); });
+		const size_t idx = m_queue.back();
+		m_queue.pop_back();
+		const Packet &packet = m_packets[idx];
+		m_sink(packet.address, packet.buf, packet.size);
+		m_free.push_back(idx);
+	}
+}
+
+}  // namespace ev3_event_broker
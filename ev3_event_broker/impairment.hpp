@@ -0,0 +1,187 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file impairment.hpp
+ *
+ * Emulates the latency, jitter, loss and bandwidth limits of a wireless link
+ * for the packets sent and received by a server.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+class Clock;
+
+/**
+ * The Impairment class holds back, drops, duplicates and reorders packets
+ * according to a configurable link model before passing them on to a sink.
+ * All packets are copied into a fixed number of preallocated slots and ordered
+ * by their release time; flush() must be called periodically (e.g. from an
+ * EventLoop timer) to release packets that are due. Random numbers are drawn
+ * from a seeded generator, such that runs on a virtual clock are
+ * reproducible.
+ */
+class Impairment {
+public:
+	/**
+	 * Maximum size of a single packet; larger packets are dropped.
+	 */
+	static constexpr size_t MAX_PACKET_SIZE = MARSHALLER_BUF_SIZE;
+
+	enum class Jitter { UNIFORM, NORMAL, PARETO };
+
+	struct Config {
+		/**
+		 * Mean one-way delay in milliseconds.
+		 */
+		double delay;
+
+		/**
+		 * Delay variation in milliseconds and its distribution. Uniform jitter
+		 * is drawn from [-jitter, jitter], normal jitter has a standard
+		 * deviation of jitter, Pareto jitter is always positive with mean
+		 * jitter.
+		 */
+		double jitter;
+		Jitter distribution;
+
+		/**
+		 * Probability in percent that a packet is lost. If burst_enter is
+		 * non-zero, losses follow a Gilbert-Elliott model: the link moves
+		 * from the good to the bad state with probability burst_enter and
+		 * back with probability burst_exit (both in percent, per packet). All
+		 * packets are lost in the bad state, packets in the good state are
+		 * lost with probability loss.
+		 */
+		double loss;
+		double burst_enter;
+		double burst_exit;
+
+		/**
+		 * Probability in percent that a packet is sent twice.
+		 */
+		double duplicate;
+
+		/**
+		 * Probability in percent that a packet bypasses the delay and thus
+		 * overtakes the packets already queued.
+		 */
+		double reorder;
+
+		/**
+		 * Link capacity in kilobits per second, including IP and UDP headers.
+		 * Zero means unlimited.
+		 */
+		double rate;
+
+		/**
+		 * Maximum number of packets held back at any time; further packets
+		 * are dropped.
+		 */
+		size_t limit;
+
+		/**
+		 * Seed of the random number generator.
+		 */
+		uint64_t seed;
+
+		Config();
+
+		/**
+		 * Returns true if the configuration has any effect on the packets.
+		 */
+		bool enabled() const;
+
+		/**
+		 * Parses a comma-separated list of KEY=VALUE pairs or "none". Valid
+		 * keys are "delay", "jitter" (MS[:uniform|normal|pareto]), "loss",
+		 * "burst" (ENTER:EXIT), "dup", "reorder", "rate", "limit" and
+		 * "seed". Returns false if the specification is invalid.
+		 */
+		bool parse(const char *spec);
+	};
+
+	/**
+	 * Function receiving the packets released by the impairment stage along
+	 * with the peer address they were submitted with.
+	 */
+	using Sink = std::function<void(const socket::Address &address,
+	                                const uint8_t *buf, size_t size)>;
+
+private:
+	struct Packet {
+		int64_t t_release;
+		uint64_t seq;
+		socket::Address address;
+		size_t size;
+		uint8_t buf[MAX_PACKET_SIZE];
+	};
+
+	Config m_config;
+	const Clock &m_clock;
+	Sink m_sink;
+
+	std::vector<Packet> m_packets;
+	std::vector<size_t> m_free;
+	std::vector<size_t> m_queue;
+
+	uint64_t m_rng;
+	uint64_t m_seq;
+	int64_t m_link_free;
+	bool m_bad_state;
+
+	double uniform();
+	bool chance(double percent);
+	double jitter();
+	bool lost();
+	bool later(size_t a, size_t b) const;
+	bool enqueue(const socket::Address &address, const uint8_t *buf,
+	             size_t size, int64_t t_release);
+
+public:
+	/**
+	 * Creates the impairment stage and preallocates config.limit packet
+	 * slots.
+	 */
+	Impairment(const Config &config, const Clock &clock, const Sink &sink);
+
+	/**
+	 * Submits a packet sent to or received from the given address. Packets
+	 * that are not delayed are passed to the sink immediately.
+	 */
+	void push(const socket::Address &address, const uint8_t *buf, size_t size);
+
+	/**
+	 * Passes all packets whose release time has come to the sink.
+	 */
+	void flush();
+};
+
+}  // namespace ev3_event_broker
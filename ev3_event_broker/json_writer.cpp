@@ -0,0 +1,286 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/json_writer.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static const uint64_t POW10[] = {1ULL,
+                                 10ULL,
+                                 100ULL,
+                                 1000ULL,
+                                 10000ULL,
+                                 100000ULL,
+                                 1000000ULL,
+                                 10000000ULL,
+                                 100000000ULL,
+                                 1000000000ULL,
+                                 10000000000ULL,
+                                 100000000000ULL,
+                                 1000000000000ULL,
+                                 10000000000000ULL,
+                                 100000000000000ULL,
+                                 1000000000000000ULL,
+                                 10000000000000000ULL,
+                                 100000000000000000ULL,
+                                 1000000000000000000ULL};
+
+static constexpr unsigned int MAX_DECIMALS =
+    sizeof(POW10) / sizeof(POW10[0]) - 1;
+
+static char *put_raw(char *tar, const char *str)
+{
+	while (*str) {
+		*(tar++) = *(str++);
+	}
+	return tar;
+}
+
+static char *put_uint(char *tar, uint64_t value)
+{
+	char tmp[20];
+	size_t n = 0;
+	do {
+		tmp[n++] = char('0' + value % 10);
+		value /= 10;
+	} while (value);
+	while (n) {
+		*(tar++) = tmp[--n];
+	}
+	return tar;
+}
+
+static char *put_int(char *tar, int64_t value)
+{
+	if (value < 0) {
+		*(tar++) = '-';
+		return put_uint(tar, 0ULL - uint64_t(value));
+	}
+	return put_uint(tar, uint64_t(value));
+}
+
+/**
+ * Writes value * 10^-decimals with as few fractional digits as possible, but
+ * at least one, such that the result is always parsed as a float.
+ */
+static char *put_fixed(char *tar, int64_t value, unsigned int decimals)
+{
+	if (decimals > MAX_DECIMALS) {
+		decimals = MAX_DECIMALS;
+	}
+	uint64_t abs_value = uint64_t(value);
+	if (value < 0) {
+		*(tar++) = '-';
+		abs_value = 0ULL - abs_value;
+	}
+	tar = put_uint(tar, abs_value / POW10[decimals]);
+	*(tar++) = '.';
+
+	uint64_t frac = abs_value % POW10[decimals];
+	if (frac == 0) {
+		*(tar++) = '0';
+		return tar;
+	}
+	while (frac % 10 == 0) {
+		frac /= 10;
+		decimals--;
+	}
+	for (unsigned int i = decimals; i > 0; i--) {
+		*(tar++) = char('0' + (frac / POW10[i - 1]) % 10);
+	}
+	return tar;
+}
+
+/**
+ * Writes a quoted string. Quotes, backslashes and all bytes outside the
+ * printable ASCII range are escaped, such that the output is valid UTF-8
+ * regardless of the input.
+ */
+static char *put_string(char *tar, const char *str)
+{
+	static const char HEX[] = "0123456789abcdef";
+	*(tar++) = '"';
+	for (; *str; str++) {
+		const uint8_t c = uint8_t(*str);
+		if (c == '"' || c == '\\') {
+			*(tar++) = '\\';
+			*(tar++) = char(c);
+		}
+		else if (c < 0x20 || c >= 0x7F) {
+			tar = put_raw(tar, "\\u00");
+			*(tar++) = HEX[c >> 4];
+			*(tar++) = HEX[c & 0x0F];
+		}
+		else {
+			*(tar++) = char(c);
+		}
+	}
+	*(tar++) = '"';
+	return tar;
+}
+
+static char *put_key(char *tar, const char *key)
+{
+	*(tar++) = ',';
+	*(tar++) = '"';
+	tar = put_raw(tar, key);
+	*(tar++) = '"';
+	*(tar++) = ':';
+	return tar;
+}
+
+/******************************************************************************
+ * Class JsonWriter                                                           *
+ ******************************************************************************/
+
+JsonWriter::JsonWriter(OutputBuffer &output) : m_output(output), m_ptr(0)
+{
+	for (Prefix &p : m_prefixes) {
+		p.valid = false;
+	}
+}
+
+const JsonWriter::Prefix &JsonWriter::prefix(
+    const Demarshaller::Header &header, const socket::Address &address)
+{
+	// Look up the sender in a direct-mapped cache
+	uint32_t h = (uint32_t(address.a) << 24) | (uint32_t(address.b) << 16) |
+	             (uint32_t(address.c) << 8) | uint32_t(address.d);
+	h = (h ^ address.port) * 0x9E3779B1U;
+	for (const char *c = header.source_hash; *c; c++) {
+		h = (h ^ uint8_t(*c)) * 0x01000193U;
+	}
+	Prefix &p = m_prefixes[(h >> 16) % N_PREFIX_CACHE];
+	if (p.valid && p.address.a == address.a && p.address.b == address.b &&
+	    p.address.c == address.c && p.address.d == address.d &&
+	    p.address.port == address.port &&
+	    strcmp(p.source_hash, header.source_hash) == 0 &&
+	    strcmp(p.source_name, header.source_name) == 0) {
+		return p;
+	}
+
+	// Format the prefix
+	p.valid = true;
+	strncpy(p.source_name, header.source_name, sizeof(p.source_name));
+	strncpy(p.source_hash, header.source_hash, sizeof(p.source_hash));
+	p.address = address;
+
+	char *tar = p.buf;
+	tar = put_raw(tar, "{\"source_name\":");
+	tar = put_string(tar, header.source_name);
+	tar = put_raw(tar, ",\"source_hash\":");
+	tar = put_string(tar, header.source_hash);
+	tar = put_raw(tar, ",\"ip\":[");
+	tar = put_uint(tar, address.a);
+	*(tar++) = ',';
+	tar = put_uint(tar, address.b);
+	*(tar++) = ',';
+	tar = put_uint(tar, address.c);
+	*(tar++) = ',';
+	tar = put_uint(tar, address.d);
+	tar = put_raw(tar, "],\"port\":");
+	tar = put_uint(tar, address.port);
+	tar = put_raw(tar, ",\"seq\":");
+	p.size = tar - p.buf;
+	return p;
+}
+
+void JsonWriter::begin(const Demarshaller::Header &header,
+                       const socket::Address &address, const char *type)
+{
+	if (m_ptr + MAX_RECORD_SIZE > BUF_SIZE) {
+		flush();
+	}
+	const Prefix &p = prefix(header, address);
+	memcpy(m_buf + m_ptr, p.buf, p.size);
+	char *tar = m_buf + m_ptr + p.size;
+	tar = put_uint(tar, header.sequence);
+	tar = put_key(tar, "type");
+	*(tar++) = '"';
+	tar = put_raw(tar, type);
+	*(tar++) = '"';
+	m_ptr = tar - m_buf;
+}
+
+void JsonWriter::begin(const char *type)
+{
+	if (m_ptr + MAX_RECORD_SIZE > BUF_SIZE) {
+		flush();
+	}
+	char *tar = m_buf + m_ptr;
+	tar = put_raw(tar, "{\"type\":\"");
+	tar = put_raw(tar, type);
+	*(tar++) = '"';
+	m_ptr = tar - m_buf;
+}
+
+void JsonWriter::field(const char *key, const char *value)
+{
+	char *tar = put_key(m_buf + m_ptr, key);
+	m_ptr = put_string(tar, value) - m_buf;
+}
+
+void JsonWriter::field(const char *key, int64_t value)
+{
+	char *tar = put_key(m_buf + m_ptr, key);
+	m_ptr = put_int(tar, value) - m_buf;
+}
+
+void JsonWriter::field_fixed(const char *key, int64_t value,
+                             unsigned int decimals)
+{
+	char *tar = put_key(m_buf + m_ptr, key);
+	m_ptr = put_fixed(tar, value, decimals) - m_buf;
+}
+
+void JsonWriter::field_fixed(const char *key, const int32_t *values, size_t n,
+                             unsigned int decimals)
+{
+	char *tar = put_key(m_buf + m_ptr, key);
+	*(tar++) = '[';
+	for (size_t i = 0; i < n; i++) {
+		if (i > 0) {
+			*(tar++) = ',';
+		}
+		tar = put_fixed(tar, values[i], decimals);
+	}
+	*(tar++) = ']';
+	m_ptr = tar - m_buf;
+}
+
+void JsonWriter::end()
+{
+	m_buf[m_ptr++] = '}';
+	m_buf[m_ptr++] = '\n';
+}
+
+void JsonWriter::flush()
+{
+	if (m_ptr > 0) {
+		m_output.write(reinterpret_cast<const uint8_t *>(m_buf), m_ptr);
+		m_ptr = 0;
+	}
+}
+
+}  // namespace ev3_event_broker
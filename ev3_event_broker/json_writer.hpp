@@ -0,0 +1,131 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file json_writer.hpp
+ *
+ * Serializes incoming messages as JSON lines without intermediate objects.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/output_buffer.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The JsonWriter class formats one JSON object per line directly into an
+ * output buffer. The part of each record that only depends on the sender
+ * (source name, hash, address and port) is formatted once and cached. The
+ * buffer is passed to the OutputBuffer when flush() is called or when it is
+ * full, such that the output is flushed once per datagram rather than once
+ * per record.
+ */
+class JsonWriter {
+public:
+	/**
+	 * Size of the output buffer.
+	 */
+	static constexpr size_t BUF_SIZE = 16384;
+
+	/**
+	 * Maximum size of a single record; records are never split between two
+	 * writes.
+	 */
+	static constexpr size_t MAX_RECORD_SIZE = 1024;
+
+	/**
+	 * Number of senders for which the record prefix is cached.
+	 */
+	static constexpr size_t N_PREFIX_CACHE = 64;
+
+private:
+	struct Prefix {
+		bool valid;
+		char source_name[N_SOURCE_NAME_CHARS + 1];
+		char source_hash[N_SOURCE_HASH_CHARS + 1];
+		socket::Address address;
+		size_t size;
+		char buf[256];
+	};
+
+	OutputBuffer &m_output;
+	size_t m_ptr;
+	char m_buf[BUF_SIZE];
+	Prefix m_prefixes[N_PREFIX_CACHE];
+
+	const Prefix &prefix(const Demarshaller::Header &header,
+	                     const socket::Address &address);
+
+public:
+	explicit JsonWriter(OutputBuffer &output);
+
+	/**
+	 * Starts a new record and writes the source information, the sequence
+	 * number and the message type. The type must not require escaping.
+	 */
+	void begin(const Demarshaller::Header &header,
+	           const socket::Address &address, const char *type);
+
+	/**
+	 * Starts a new record that is not associated with a source, such as
+	 * status reports of the client itself.
+	 */
+	void begin(const char *type);
+
+	/**
+	 * Adds a string field; the key must not require escaping.
+	 */
+	void field(const char *key, const char *value);
+
+	/**
+	 * Adds an integer field.
+	 */
+	void field(const char *key, int64_t value);
+
+	/**
+	 * Adds the number value * 10^-decimals, e.g. a velocity given in
+	 * thousandths.
+	 */
+	void field_fixed(const char *key, int64_t value, unsigned int decimals);
+
+	/**
+	 * Adds an array of numbers value[i] * 10^-decimals.
+	 */
+	void field_fixed(const char *key, const int32_t *values, size_t n,
+	                 unsigned int decimals);
+
+	/**
+	 * Finishes the current record.
+	 */
+	void end();
+
+	/**
+	 * Passes all buffered records to the output buffer.
+	 */
+	void flush();
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,85 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/latency_histogram.hpp>
+
+namespace ev3_event_broker {
+
+size_t LatencyHistogram::bucket(uint32_t value)
+{
+	// Values below SUB_BUCKETS are counted exactly, larger values are
+	// assigned to one of SUB_BUCKETS buckets within their power of two
+	if (value < SUB_BUCKETS) {
+		return value;
+	}
+	const size_t exponent = 31 - __builtin_clz(value);
+	const size_t shift = exponent - 4;
+	return SUB_BUCKETS * (shift + 1) + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint32_t LatencyHistogram::bucket_center(size_t idx)
+{
+	if (idx < SUB_BUCKETS) {
+		return uint32_t(idx);
+	}
+	const size_t shift = idx / SUB_BUCKETS - 1;
+	const uint64_t lower = uint64_t(SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+	return uint32_t(lower + ((uint64_t(1) << shift) >> 1));
+}
+
+void LatencyHistogram::reset()
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_max = 0;
+}
+
+void LatencyHistogram::add(uint32_t value)
+{
+	m_buckets[bucket(value)]++;
+	m_count++;
+	if (value > m_max) {
+		m_max = value;
+	}
+}
+
+uint32_t LatencyHistogram::percentile(double fraction) const
+{
+	if (m_count == 0) {
+		return 0;
+	}
+
+	// Rank of the requested sample, starting at one
+	uint64_t rank = uint64_t(fraction * m_count + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t n = 0;
+	for (size_t i = 0; i < N_BUCKETS; i++) {
+		n += m_buckets[i];
+		if (n >= rank) {
+			const uint32_t center = bucket_center(i);
+			return (center < m_max) ? center : m_max;
+		}
+	}
+	return m_max;
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,72 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file latency_histogram.hpp
+ *
+ * Fixed-size histogram of latencies with bounded relative error.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ev3_event_broker {
+
+/**
+ * The LatencyHistogram class counts latencies given in microseconds in
+ * logarithmically spaced buckets. Each power of two is divided into
+ * SUB_BUCKETS linear buckets, so percentiles are accurate to about 3% over
+ * the entire range without any allocation.
+ */
+class LatencyHistogram {
+public:
+	static constexpr size_t SUB_BUCKETS = 16;
+	static constexpr size_t N_BUCKETS = SUB_BUCKETS * 29;
+
+private:
+	uint32_t m_buckets[N_BUCKETS];
+	uint32_t m_count;
+	uint32_t m_max;
+
+	static size_t bucket(uint32_t value);
+	static uint32_t bucket_center(size_t idx);
+
+public:
+	LatencyHistogram() { reset(); }
+
+	void reset();
+
+	void add(uint32_t value);
+
+	uint32_t count() const { return m_count; }
+
+	uint32_t max() const { return m_max; }
+
+	/**
+	 * Returns the value below which the given fraction of the samples lies.
+	 * The fraction must be between zero and one. Returns zero if the
+	 * histogram is empty.
+	 */
+	uint32_t percentile(double fraction) const;
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,115 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <ev3_event_broker/common.hpp>
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/lego_sensor.hpp>
+
+namespace ev3_event_broker {
+
+LegoSensor::LegoSensor(const char *path)
+    : m_fd_mode(-1),
+      m_fd_num_values(-1),
+      m_fd_decimals(-1),
+      m_n_values(0),
+      m_decimals(0) {
+	for (size_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+		m_fd_values[i] = -1;
+	}
+	m_fd_mode = open_device_file(path, "/mode", O_RDWR);
+	m_fd_num_values = open_device_file(path, "/num_values", O_RDONLY);
+	m_fd_decimals = open_device_file(path, "/decimals", O_RDONLY);
+	for (size_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+		char file[16];
+		snprintf(file, sizeof(file), "/value%d", int(i));
+		m_fd_values[i] = open_device_file(path, file, O_RDONLY);
+	}
+	read_name(path);
+	read_format();
+}
+
+void LegoSensor::read_name(const char *path) {
+	// Read the address, e.g. "ev3-ports:in1"
+	char buf[32];
+	int fd = open_device_file(path, "/address", O_RDONLY);
+	ssize_t len = err(pread(fd, buf, sizeof(buf) - 1, 0));
+	close(fd);
+	while (len > 0 && (buf[len - 1] == '\n')) {
+		len--;
+	}
+	buf[len] = 0;
+
+	// Only keep the port name and combine it with the "sensor_" prefix
+	const char *port = strrchr(buf, ':');
+	port = port ? (port + 1) : buf;
+	snprintf(m_name, sizeof(m_name), "sensor_%.9s", port);
+	m_name[sizeof(m_name) - 1] = 0;  // Force the last byte to zero
+}
+
+void LegoSensor::read_format() {
+	// The number of values and their scale only change with the mode, so
+	// they are not read for each sample
+	const int n_values = read_device_int(m_fd_num_values);
+	m_n_values = (n_values < 0) ? 0 : size_t(n_values);
+	if (m_n_values > SENSOR_MAX_VALUES) {
+		m_n_values = SENSOR_MAX_VALUES;
+	}
+	m_decimals = read_device_int(m_fd_decimals);
+}
+
+LegoSensor::~LegoSensor() {
+	for (size_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+		if (m_fd_values[i] >= 0) {
+			close(m_fd_values[i]);
+		}
+	}
+	if (m_fd_decimals >= 0) {
+		close(m_fd_decimals);
+	}
+	if (m_fd_num_values >= 0) {
+		close(m_fd_num_values);
+	}
+	if (m_fd_mode >= 0) {
+		close(m_fd_mode);
+	}
+}
+
+bool LegoSensor::good() const {
+	char buf[32];
+	return pread(m_fd_mode, buf, sizeof(buf), 0) > 0;
+}
+
+int LegoSensor::get_value(size_t idx) const {
+	if (idx >= m_n_values) {
+		return 0;
+	}
+	return read_device_int(m_fd_values[idx]);
+}
+
+void LegoSensor::set_mode(const char *mode) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%s\n", mode);
+	err(pwrite(m_fd_mode, buf, strnlen(buf, sizeof(buf)), 0));
+	read_format();
+}
+}  // namespace ev3_event_broker
@@ -0,0 +1,48 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/sensor.hpp>
+
+namespace ev3_event_broker {
+class LegoSensor : public Sensor {
+private:
+	int m_fd_mode;
+	int m_fd_num_values;
+	int m_fd_decimals;
+	int m_fd_values[SENSOR_MAX_VALUES];
+	size_t m_n_values;
+	int m_decimals;
+	char m_name[17];
+
+	void read_name(const char *path);
+	void read_format();
+
+public:
+	explicit LegoSensor(const char *path);
+	~LegoSensor() override;
+	bool good() const override;
+	size_t n_values() const override { return m_n_values; }
+	int decimals() const override { return m_decimals; }
+	int get_value(size_t idx) const override;
+	void set_mode(const char *mode) override;
+	const char *name() const override { return m_name; }
+};
+}  // namespace ev3_event_broker
@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cstring>
 #include <type_traits>
 
@@ -23,6 +24,9 @@
 
 namespace ev3_event_broker {
 
+static_assert(N_DEVICE_NAME_CHARS == DeviceTable::NAME_SIZE,
+              "Device name length must match the device table");
+
 /******************************************************************************
  * Helper functions                                                           *
  ******************************************************************************/
@@ -109,6 +113,11 @@ Marshaller &Marshaller::flush() {
 	return *this;
 }
 
+Marshaller &Marshaller::reserve(size_t size) {
+	flush_if_no_space(size);
+	return *this;
+}
+
 uint8_t *Marshaller::initialze_msg(size_t size_required) {
 	flush_if_no_space(size_required);
 	return m_buf + m_buf_ptr;
@@ -129,6 +138,25 @@ Marshaller &Marshaller::write_position_sensor(const char *device_name,
 	return finalize_msg(tar);
 }
 
+Marshaller &Marshaller::write_velocity_sensor(const char *device_name,
+                                              int32_t velocity) {
+	uint8_t *tar = initialze_msg(VELOCITY_SENSOR_SIZE);
+	tar = write_int<uint8_t>(TYPE_VELOCITY_SENSOR, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_int<int32_t>(velocity, tar);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_telemetry(const char *device_name,
+                                        uint8_t attribute, int32_t value) {
+	uint8_t *tar = initialze_msg(TELEMETRY_SIZE);
+	tar = write_int<uint8_t>(TYPE_TELEMETRY, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_int<uint8_t>(attribute, tar);
+	tar = write_int<int32_t>(value, tar);
+	return finalize_msg(tar);
+}
+
 Marshaller &Marshaller::write_set_duty_cycle(const char *device_name,
                                              int32_t duty_cycle) {
 	uint8_t *tar = initialze_msg(SET_DUTY_CYCLE_SIZE);
@@ -138,6 +166,110 @@ Marshaller &Marshaller::write_set_duty_cycle(const char *device_name,
 	return finalize_msg(tar);
 }
 
+Marshaller &Marshaller::write_set_target(uint8_t type,
+                                         const char *device_name,
+                                         int32_t target, int32_t kp,
+                                         int32_t ki, int32_t kd) {
+	uint8_t *tar = initialze_msg(SET_TARGET_SIZE);
+	tar = write_int<uint8_t>(type, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_int<int32_t>(target, tar);
+	tar = write_int<int32_t>(kp, tar);
+	tar = write_int<int32_t>(ki, tar);
+	tar = write_int<int32_t>(kd, tar);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_set_position_target(const char *device_name,
+                                                  int32_t position,
+                                                  int32_t kp, int32_t ki,
+                                                  int32_t kd) {
+	return write_set_target(TYPE_SET_POSITION_TARGET, device_name, position,
+	                        kp, ki, kd);
+}
+
+Marshaller &Marshaller::write_set_velocity_target(const char *device_name,
+                                                  int32_t velocity,
+                                                  int32_t kp, int32_t ki,
+                                                  int32_t kd) {
+	return write_set_target(TYPE_SET_VELOCITY_TARGET, device_name, velocity,
+	                        kp, ki, kd);
+}
+
+Marshaller &Marshaller::write_trajectory(const char *device_name,
+                                         uint8_t mode, uint8_t options,
+                                         const TrajectoryPoint *points,
+                                         size_t n_points) {
+	if (n_points > TRAJECTORY_MAX_POINTS) {
+		n_points = TRAJECTORY_MAX_POINTS;
+	}
+	uint8_t *tar = initialze_msg(TRAJECTORY_HEADER_SIZE +
+	                             n_points * TRAJECTORY_POINT_SIZE);
+	tar = write_int<uint8_t>(TYPE_TRAJECTORY, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_int<uint8_t>(mode, tar);
+	tar = write_int<uint8_t>(options, tar);
+	tar = write_int<uint8_t>(n_points, tar);
+	for (size_t i = 0; i < n_points; i++) {
+		tar = write_int<uint32_t>(points[i].time, tar);
+		tar = write_int<int32_t>(points[i].value, tar);
+	}
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_trajectory_chunked(const char *device_name,
+                                                 uint8_t mode, uint8_t options,
+                                                 const TrajectoryPoint *points,
+                                                 size_t n_points) {
+	const uint8_t end = options & TRAJECTORY_END;
+	options &= ~TRAJECTORY_END;
+	size_t i = 0;
+	do {
+		const size_t n = std::min(n_points - i, TRAJECTORY_MAX_POINTS);
+		write_trajectory(device_name, mode,
+		                 options | ((i + n == n_points) ? end : 0), points + i,
+		                 n);
+		options &= ~TRAJECTORY_START;
+		i += n;
+	} while (i < n_points);
+	return *this;
+}
+
+Marshaller &Marshaller::write_trajectory_underrun(const char *device_name) {
+	uint8_t *tar = initialze_msg(TRAJECTORY_UNDERRUN_SIZE);
+	tar = write_int<uint8_t>(TYPE_TRAJECTORY_UNDERRUN, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_sensor_values(const char *device_name,
+                                            uint8_t decimals,
+                                            const int32_t *values,
+                                            size_t n_values) {
+	if (n_values > SENSOR_MAX_VALUES) {
+		n_values = SENSOR_MAX_VALUES;
+	}
+	uint8_t *tar = initialze_msg(SENSOR_VALUES_HEADER_SIZE +
+	                             n_values * SENSOR_VALUE_SIZE);
+	tar = write_int<uint8_t>(TYPE_SENSOR_VALUES, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_int<uint8_t>(decimals, tar);
+	tar = write_int<uint8_t>(n_values, tar);
+	for (size_t i = 0; i < n_values; i++) {
+		tar = write_int<int32_t>(values[i], tar);
+	}
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_set_sensor_mode(const char *device_name,
+                                              const char *mode) {
+	uint8_t *tar = initialze_msg(SET_SENSOR_MODE_SIZE);
+	tar = write_int<uint8_t>(TYPE_SET_SENSOR_MODE, tar);
+	tar = write_fixed_size_string(device_name, tar, N_DEVICE_NAME_CHARS);
+	tar = write_fixed_size_string(mode, tar, N_SENSOR_MODE_CHARS);
+	return finalize_msg(tar);
+}
+
 Marshaller &Marshaller::write_reset() {
 	uint8_t *tar = initialze_msg(RESET_SIZE);
 	tar = write_int<uint8_t>(TYPE_RESET, tar);
@@ -150,20 +282,118 @@ Marshaller &Marshaller::write_heartbeat() {
 	return finalize_msg(tar);
 }
 
+Marshaller &Marshaller::write_ping(uint32_t nonce, int64_t timestamp) {
+	uint8_t *tar = initialze_msg(PING_SIZE);
+	tar = write_int<uint8_t>(TYPE_PING, tar);
+	tar = write_int<uint32_t>(nonce, tar);
+	tar = write_int<int64_t>(timestamp, tar);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_pong(const char *requester_hash, uint32_t nonce,
+                                   int64_t timestamp, int64_t receive_time,
+                                   int64_t transmit_time) {
+	uint8_t *tar = initialze_msg(PONG_SIZE);
+	tar = write_int<uint8_t>(TYPE_PONG, tar);
+	tar = write_fixed_size_string(requester_hash, tar, N_SOURCE_HASH_CHARS);
+	tar = write_int<uint32_t>(nonce, tar);
+	tar = write_int<int64_t>(timestamp, tar);
+	tar = write_int<int64_t>(receive_time, tar);
+	tar = write_int<int64_t>(transmit_time, tar);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_report_mode(int32_t deadband,
+                                          uint32_t keyframe_period) {
+	uint8_t *tar = initialze_msg(REPORT_MODE_SIZE);
+	tar = write_int<uint8_t>(TYPE_REPORT_MODE, tar);
+	tar = write_int<int32_t>(deadband, tar);
+	tar = write_int<uint32_t>(keyframe_period, tar);
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_subscribe(uint32_t period,
+                                        const char *const *patterns,
+                                        size_t n_patterns) {
+	if (n_patterns > SUBSCRIBE_MAX_PATTERNS) {
+		n_patterns = SUBSCRIBE_MAX_PATTERNS;
+	}
+	uint8_t *tar = initialze_msg(SUBSCRIBE_HEADER_SIZE +
+	                             n_patterns * SUBSCRIBE_PATTERN_SIZE);
+	tar = write_int<uint8_t>(TYPE_SUBSCRIBE, tar);
+	tar = write_int<uint32_t>(period, tar);
+	tar = write_int<uint8_t>(n_patterns, tar);
+	for (size_t i = 0; i < n_patterns; i++) {
+		tar = write_fixed_size_string(patterns[i], tar, SUBSCRIBE_PATTERN_SIZE);
+	}
+	return finalize_msg(tar);
+}
+
+Marshaller &Marshaller::write_stream(const char *requester_hash) {
+	uint8_t *tar = initialze_msg(STREAM_SIZE);
+	tar = write_int<uint8_t>(TYPE_STREAM, tar);
+	tar = write_fixed_size_string(requester_hash, tar, N_SOURCE_HASH_CHARS);
+	return finalize_msg(tar);
+}
+
 /******************************************************************************
  * Class Demarshaller                                                         *
  ******************************************************************************/
 
-Demarshaller::Demarshaller() : m_sync(0), m_type(0) {
+Demarshaller::Demarshaller(const DeviceTable *device_table)
+    : m_sync(0), m_type(0), m_device_table(device_table) {
 	memset(&m_header, 0, sizeof(m_header));
 	memset(&m_position_sensor, 0, sizeof(m_position_sensor));
+	memset(&m_velocity_sensor, 0, sizeof(m_velocity_sensor));
+	memset(&m_telemetry, 0, sizeof(m_telemetry));
+	memset(&m_sensor_values, 0, sizeof(m_sensor_values));
+	memset(&m_set_sensor_mode, 0, sizeof(m_set_sensor_mode));
 	memset(&m_set_duty_cycle, 0, sizeof(m_set_duty_cycle));
+	memset(&m_set_target, 0, sizeof(m_set_target));
+	memset(&m_trajectory, 0, sizeof(m_trajectory));
+	memset(&m_trajectory_underrun, 0, sizeof(m_trajectory_underrun));
+	memset(&m_ping, 0, sizeof(m_ping));
+	memset(&m_pong, 0, sizeof(m_pong));
+	memset(&m_report_mode, 0, sizeof(m_report_mode));
+	memset(&m_subscribe, 0, sizeof(m_subscribe));
+	memset(&m_stream, 0, sizeof(m_stream));
+	memset(m_device_cache, 0, sizeof(m_device_cache));
+	for (DeviceCacheEntry &entry : m_device_cache) {
+		entry.device = INVALID_DEVICE_HANDLE;
+	}
+}
+
+DeviceHandle Demarshaller::resolve_device(size_t idx,
+                                          const char *device_name) {
+	if (!m_device_table) {
+		return INVALID_DEVICE_HANDLE;
+	}
+
+	// Handles are never reassigned, so a cached handle stays valid as long as
+	// the raw name matches
+	DeviceCacheEntry &entry = m_device_cache[idx & (DEVICE_CACHE_SIZE - 1)];
+	if (entry.device != INVALID_DEVICE_HANDLE &&
+	    memcmp(entry.device_name, device_name, N_DEVICE_NAME_CHARS) == 0) {
+		return entry.device;
+	}
+
+	// Do not cache failed lookups; the device might be added later
+	const DeviceHandle device = m_device_table->find(device_name);
+	if (device != INVALID_DEVICE_HANDLE) {
+		memcpy(entry.device_name, device_name, N_DEVICE_NAME_CHARS);
+		entry.device = device;
+	}
+	return device;
 }
 
 void Demarshaller::parse(Listener &listener, const uint8_t *buf,
                          size_t buf_size) {
 	const uint8_t *src_end = buf + buf_size;
 	uint8_t const *src = buf;
+
+	// Each datagram is self-contained; do not carry over the sync state from
+	// a previous datagram that was discarded or truncated
+	m_sync = 0;
 	while (src < src_end) {
 		// Synchhronize with the sync word
 		if (m_sync != SYNC) {
@@ -205,6 +435,25 @@ void Demarshaller::parse(Listener &listener, const uint8_t *buf,
 					listener.on_position_sensor(m_header,
 					                            m_position_sensor);
 					break;
+				case TYPE_VELOCITY_SENSOR:
+					if (src + VELOCITY_SENSOR_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_velocity_sensor.device_name,
+					                             src, N_DEVICE_NAME_CHARS);
+					src = read_int<int32_t>(&m_velocity_sensor.velocity, src);
+					listener.on_velocity_sensor(m_header, m_velocity_sensor);
+					break;
+				case TYPE_TELEMETRY:
+					if (src + TELEMETRY_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_telemetry.device_name, src,
+					                             N_DEVICE_NAME_CHARS);
+					src = read_int<uint8_t>(&m_telemetry.attribute, src);
+					src = read_int<int32_t>(&m_telemetry.value, src);
+					listener.on_telemetry(m_header, m_telemetry);
+					break;
 				case TYPE_SET_DUTY_CYCLE:
 					if (src + SET_DUTY_CYCLE_SIZE - 1 > src_end) {
 						return;
@@ -212,8 +461,92 @@ void Demarshaller::parse(Listener &listener, const uint8_t *buf,
 					src = read_fixed_size_string(m_set_duty_cycle.device_name,
 					                             src, N_DEVICE_NAME_CHARS);
 					src = read_int<int32_t>(&m_set_duty_cycle.duty_cycle, src);
+					m_set_duty_cycle.device =
+					    resolve_device(i, m_set_duty_cycle.device_name);
 					listener.on_set_duty_cycle(m_header, m_set_duty_cycle);
 					break;
+				case TYPE_SET_POSITION_TARGET:
+				case TYPE_SET_VELOCITY_TARGET:
+					if (src + SET_TARGET_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_set_target.device_name, src,
+					                             N_DEVICE_NAME_CHARS);
+					src = read_int<int32_t>(&m_set_target.target, src);
+					src = read_int<int32_t>(&m_set_target.kp, src);
+					src = read_int<int32_t>(&m_set_target.ki, src);
+					src = read_int<int32_t>(&m_set_target.kd, src);
+					m_set_target.device =
+					    resolve_device(i, m_set_target.device_name);
+					if (m_type == TYPE_SET_POSITION_TARGET) {
+						listener.on_set_position_target(m_header, m_set_target);
+					} else {
+						listener.on_set_velocity_target(m_header, m_set_target);
+					}
+					break;
+				case TYPE_TRAJECTORY:
+					if (src + TRAJECTORY_HEADER_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_trajectory.device_name, src,
+					                             N_DEVICE_NAME_CHARS);
+					src = read_int<uint8_t>(&m_trajectory.mode, src);
+					src = read_int<uint8_t>(&m_trajectory.options, src);
+					src = read_int<uint8_t>(&m_trajectory.n_points, src);
+					if (m_trajectory.n_points > TRAJECTORY_MAX_POINTS ||
+					    src + m_trajectory.n_points * TRAJECTORY_POINT_SIZE >
+					        src_end) {
+						return;
+					}
+					for (size_t j = 0; j < m_trajectory.n_points; j++) {
+						src = read_int<uint32_t>(&m_trajectory.points[j].time,
+						                         src);
+						src = read_int<int32_t>(&m_trajectory.points[j].value,
+						                        src);
+					}
+					m_trajectory.device =
+					    resolve_device(i, m_trajectory.device_name);
+					listener.on_trajectory(m_header, m_trajectory);
+					break;
+				case TYPE_TRAJECTORY_UNDERRUN:
+					if (src + TRAJECTORY_UNDERRUN_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(
+					    m_trajectory_underrun.device_name, src,
+					    N_DEVICE_NAME_CHARS);
+					listener.on_trajectory_underrun(m_header,
+					                                m_trajectory_underrun);
+					break;
+				case TYPE_SENSOR_VALUES:
+					if (src + SENSOR_VALUES_HEADER_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_sensor_values.device_name,
+					                             src, N_DEVICE_NAME_CHARS);
+					src = read_int<uint8_t>(&m_sensor_values.decimals, src);
+					src = read_int<uint8_t>(&m_sensor_values.n_values, src);
+					if (m_sensor_values.n_values > SENSOR_MAX_VALUES ||
+					    src + m_sensor_values.n_values * SENSOR_VALUE_SIZE >
+					        src_end) {
+						return;
+					}
+					for (size_t j = 0; j < m_sensor_values.n_values; j++) {
+						src = read_int<int32_t>(&m_sensor_values.values[j],
+						                        src);
+					}
+					listener.on_sensor_values(m_header, m_sensor_values);
+					break;
+				case TYPE_SET_SENSOR_MODE:
+					if (src + SET_SENSOR_MODE_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_set_sensor_mode.device_name,
+					                             src, N_DEVICE_NAME_CHARS);
+					src = read_fixed_size_string(m_set_sensor_mode.mode, src,
+					                             N_SENSOR_MODE_CHARS);
+					listener.on_set_sensor_mode(m_header, m_set_sensor_mode);
+					break;
 				case TYPE_HEARTBEAT:
 					if (src + HEARTBEAT_SIZE - 1 > src_end) {
 						return;
@@ -226,6 +559,62 @@ void Demarshaller::parse(Listener &listener, const uint8_t *buf,
 					}
 					listener.on_reset(m_header);
 					break;
+				case TYPE_PING:
+					if (src + PING_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_int<uint32_t>(&m_ping.nonce, src);
+					src = read_int<int64_t>(&m_ping.timestamp, src);
+					listener.on_ping(m_header, m_ping);
+					break;
+				case TYPE_PONG:
+					if (src + PONG_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_pong.requester_hash, src,
+					                             N_SOURCE_HASH_CHARS);
+					src = read_int<uint32_t>(&m_pong.nonce, src);
+					src = read_int<int64_t>(&m_pong.timestamp, src);
+					src = read_int<int64_t>(&m_pong.receive_time, src);
+					src = read_int<int64_t>(&m_pong.transmit_time, src);
+					listener.on_pong(m_header, m_pong);
+					break;
+				case TYPE_REPORT_MODE:
+					if (src + REPORT_MODE_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_int<int32_t>(&m_report_mode.deadband, src);
+					src = read_int<uint32_t>(&m_report_mode.keyframe_period,
+					                         src);
+					listener.on_report_mode(m_header, m_report_mode);
+					break;
+				case TYPE_SUBSCRIBE: {
+					if (src + SUBSCRIBE_HEADER_SIZE - 1 > src_end) {
+						return;
+					}
+					uint8_t n_patterns;
+					src = read_int<uint32_t>(&m_subscribe.period, src);
+					src = read_int<uint8_t>(&n_patterns, src);
+					if (n_patterns > SUBSCRIBE_MAX_PATTERNS ||
+					    src + n_patterns * SUBSCRIBE_PATTERN_SIZE > src_end) {
+						return;
+					}
+					m_subscribe.n_patterns = n_patterns;
+					for (size_t j = 0; j < n_patterns; j++) {
+						src = read_fixed_size_string(m_subscribe.patterns[j],
+						                             src, N_DEVICE_NAME_CHARS);
+					}
+					listener.on_subscribe(m_header, m_subscribe);
+					break;
+				}
+				case TYPE_STREAM:
+					if (src + STREAM_SIZE - 1 > src_end) {
+						return;
+					}
+					src = read_fixed_size_string(m_stream.requester_hash, src,
+					                             N_SOURCE_HASH_CHARS);
+					listener.on_stream(m_header, m_stream);
+					break;
 				default:
 					return;
 			}
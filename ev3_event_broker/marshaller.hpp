@@ -16,10 +16,14 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 
+#include <ev3_event_broker/device_table.hpp>
+
 namespace ev3_event_broker {
 
 /**
@@ -42,11 +46,145 @@ static constexpr uint8_t TYPE_SET_DUTY_CYCLE = 0x02;
  */
 static constexpr uint8_t TYPE_HEARTBEAT = 0x03;
 
+/**
+ * Message enabling closed-loop position control for a motor.
+ */
+static constexpr uint8_t TYPE_SET_POSITION_TARGET = 0x04;
+
+/**
+ * Message enabling closed-loop velocity control for a motor.
+ */
+static constexpr uint8_t TYPE_SET_VELOCITY_TARGET = 0x05;
+
+/**
+ * Message containing a chunk of a timestamped trajectory for a motor.
+ */
+static constexpr uint8_t TYPE_TRAJECTORY = 0x06;
+
+/**
+ * Message indicating that the trajectory buffer of a motor ran empty.
+ */
+static constexpr uint8_t TYPE_TRAJECTORY_UNDERRUN = 0x07;
+
+/**
+ * Message containing the velocity estimate of a motor.
+ */
+static constexpr uint8_t TYPE_VELOCITY_SENSOR = 0x08;
+
+/**
+ * Message containing a generic motor attribute sample.
+ */
+static constexpr uint8_t TYPE_TELEMETRY = 0x09;
+
+/**
+ * Message containing the current values of a lego-sensor.
+ */
+static constexpr uint8_t TYPE_SENSOR_VALUES = 0x0A;
+
+/**
+ * Message selecting the mode of a lego-sensor.
+ */
+static constexpr uint8_t TYPE_SET_SENSOR_MODE = 0x0B;
+
+/**
+ * Message requesting an immediate TYPE_PONG reply, used to measure the round
+ * trip time.
+ */
+static constexpr uint8_t TYPE_PING = 0x0C;
+
+/**
+ * Reply to a TYPE_PING message. Contains the time the ping was received and
+ * the time the reply was sent according to the clock of the server, such that
+ * the client can estimate the offset between both clocks.
+ */
+static constexpr uint8_t TYPE_PONG = 0x0D;
+
+/**
+ * Message describing which motor positions are reported by the sender. Sent
+ * along with every heartbeat, such that receivers can tell whether a motor
+ * that is not reported did not move or whether its messages were lost.
+ */
+static constexpr uint8_t TYPE_REPORT_MODE = 0x0E;
+
+/**
+ * Message requesting the motor positions, velocities and sensor values of a
+ * subset of devices at a given period. The sender receives its own stream of
+ * these records in addition to the broadcast. Subscriptions expire unless
+ * they are renewed regularly.
+ */
+static constexpr uint8_t TYPE_SUBSCRIBE = 0x0F;
+
+/**
+ * Message marking all following messages in the same packet as part of the
+ * stream requested by the given subscriber.
+ */
+static constexpr uint8_t TYPE_STREAM = 0x10;
+
 /**
  * Message demanding the reset of all devices.
  */
 static constexpr uint8_t TYPE_RESET = 0xFF;
 
+/**
+ * Trajectory values are motor duty cycles.
+ */
+static constexpr uint8_t TRAJECTORY_MODE_DUTY_CYCLE = 0x00;
+
+/**
+ * Trajectory values are position targets for the on-brick controller.
+ */
+static constexpr uint8_t TRAJECTORY_MODE_POSITION = 0x01;
+
+/**
+ * Trajectory option: use cubic instead of linear interpolation.
+ */
+static constexpr uint8_t TRAJECTORY_CUBIC = 0x01;
+
+/**
+ * Trajectory option: stop the motor on underrun instead of holding the last
+ * value.
+ */
+static constexpr uint8_t TRAJECTORY_STOP_ON_UNDERRUN = 0x02;
+
+/**
+ * Trajectory option: discard all buffered points and start a new trajectory.
+ */
+static constexpr uint8_t TRAJECTORY_START = 0x04;
+
+/**
+ * Trajectory option: the trajectory ends with the last point in this message;
+ * running out of points is not an underrun.
+ */
+static constexpr uint8_t TRAJECTORY_END = 0x08;
+
+/**
+ * Maximum number of points in a single trajectory message.
+ */
+static constexpr size_t TRAJECTORY_MAX_POINTS = 32;
+
+/**
+ * Device attributes that can be sampled. Except for positions, which are
+ * transmitted using TYPE_POSITION_SENSOR messages, and sensor values, which are
+ * transmitted using TYPE_SENSOR_VALUES messages, attributes are transmitted in
+ * telemetry messages.
+ */
+static constexpr uint8_t TELEMETRY_POSITION = 0x00;
+static constexpr uint8_t TELEMETRY_SPEED = 0x01;
+static constexpr uint8_t TELEMETRY_STATE = 0x02;
+static constexpr uint8_t TELEMETRY_DUTY_CYCLE = 0x03;
+static constexpr uint8_t TELEMETRY_SENSOR = 0x04;
+static constexpr size_t N_TELEMETRY_ATTRIBUTES = 5;
+
+/**
+ * Maximum number of device patterns in a single subscription.
+ */
+static constexpr size_t SUBSCRIBE_MAX_PATTERNS = 4;
+
+/**
+ * Maximum number of values reported by a single sensor.
+ */
+static constexpr size_t SENSOR_MAX_VALUES = 8;
+
 /**
  * Maximum buffer size used by the marshaller. This should be approximately
  * equivalent to the MTU (preferrably smaller).
@@ -68,12 +206,42 @@ static constexpr size_t N_SOURCE_HASH_CHARS = 8;
  */
 static constexpr size_t N_DEVICE_NAME_CHARS = 16;
 
+/**
+ * Number of characters used to identify sensor modes.
+ */
+static constexpr size_t N_SENSOR_MODE_CHARS = 16;
+
 static constexpr size_t HEADER_SIZE =
     N_SOURCE_NAME_CHARS + N_SOURCE_HASH_CHARS + 4;
 static constexpr size_t POSITION_SENSOR_SIZE = 1 + N_DEVICE_NAME_CHARS + 4;
+static constexpr size_t VELOCITY_SENSOR_SIZE = 1 + N_DEVICE_NAME_CHARS + 4;
+static constexpr size_t TELEMETRY_SIZE = 1 + N_DEVICE_NAME_CHARS + 1 + 4;
 static constexpr size_t SET_DUTY_CYCLE_SIZE = 1 + N_DEVICE_NAME_CHARS + 4;
+static constexpr size_t SET_TARGET_SIZE = 1 + N_DEVICE_NAME_CHARS + 4 * 4;
+static constexpr size_t TRAJECTORY_HEADER_SIZE = 1 + N_DEVICE_NAME_CHARS + 3;
+static constexpr size_t TRAJECTORY_POINT_SIZE = 4 + 4;
+static constexpr size_t TRAJECTORY_UNDERRUN_SIZE = 1 + N_DEVICE_NAME_CHARS;
+static constexpr size_t SENSOR_VALUES_HEADER_SIZE = 1 + N_DEVICE_NAME_CHARS + 2;
+static constexpr size_t SENSOR_VALUE_SIZE = 4;
+static constexpr size_t SET_SENSOR_MODE_SIZE =
+    1 + N_DEVICE_NAME_CHARS + N_SENSOR_MODE_CHARS;
 static constexpr size_t RESET_SIZE = 1;
 static constexpr size_t HEARTBEAT_SIZE = 1;
+static constexpr size_t PING_SIZE = 1 + 4 + 8;
+static constexpr size_t PONG_SIZE = 1 + N_SOURCE_HASH_CHARS + 4 + 3 * 8;
+static constexpr size_t REPORT_MODE_SIZE = 1 + 4 + 4;
+static constexpr size_t SUBSCRIBE_HEADER_SIZE = 1 + 4 + 1;
+static constexpr size_t SUBSCRIBE_PATTERN_SIZE = N_DEVICE_NAME_CHARS;
+static constexpr size_t STREAM_SIZE = 1 + N_SOURCE_HASH_CHARS;
+
+/**
+ * A single point of a trajectory. The time is given in milliseconds relative
+ * to the start of the trajectory.
+ */
+struct TrajectoryPoint {
+	uint32_t time;
+	int32_t value;
+};
 
 class Marshaller {
 public:
@@ -94,6 +262,10 @@ private:
 	uint8_t *initialze_msg(size_t size_required);
 	Marshaller &finalize_msg(uint8_t *tar);
 
+	Marshaller &write_set_target(uint8_t type, const char *device_name,
+	                             int32_t target, int32_t kp, int32_t ki,
+	                             int32_t kd);
+
 public:
 	Marshaller(const Callback &cback, const char *source_name,
 	           const char *source_hash);
@@ -102,12 +274,119 @@ public:
 
 	Marshaller &flush();
 
+	/**
+	 * Returns true if no message was written since the last flush, i.e. the
+	 * next message starts a new packet.
+	 */
+	bool empty() const { return m_message_count == 0; }
+
+	/**
+	 * Flushes the current packet if fewer than size bytes are left, such that
+	 * messages totalling at most size bytes are sent in the same packet.
+	 */
+	Marshaller &reserve(size_t size);
+
 	Marshaller &write_position_sensor(const char *device_name,
 	                                  int32_t position);
+	/**
+	 * Writes a velocity estimate in units of 1/1000 degree per second.
+	 */
+	Marshaller &write_velocity_sensor(const char *device_name,
+	                                  int32_t velocity);
+	/**
+	 * Writes a sample of one of the TELEMETRY_* motor attributes.
+	 */
+	Marshaller &write_telemetry(const char *device_name, uint8_t attribute,
+	                            int32_t value);
 	Marshaller &write_set_duty_cycle(const char *device_name,
 	                                 int32_t duty_cycle);
+
+	/**
+	 * Writes a position target in degrees. Gains are given in units of 1/1000
+	 * duty cycle percent per degree (kp), degree-second (ki), and degree per
+	 * second (kd).
+	 */
+	Marshaller &write_set_position_target(const char *device_name,
+	                                      int32_t position, int32_t kp,
+	                                      int32_t ki, int32_t kd);
+
+	/**
+	 * Writes a velocity target in degrees per second. Gains are given in the
+	 * same units as in write_set_position_target().
+	 */
+	Marshaller &write_set_velocity_target(const char *device_name,
+	                                      int32_t velocity, int32_t kp,
+	                                      int32_t ki, int32_t kd);
+	/**
+	 * Writes a chunk of a trajectory. At most TRAJECTORY_MAX_POINTS points are
+	 * written; the remaining points are ignored.
+	 *
+	 * @param mode is either TRAJECTORY_MODE_DUTY_CYCLE or
+	 * TRAJECTORY_MODE_POSITION.
+	 * @param options is a combination of the TRAJECTORY_* option flags.
+	 */
+	Marshaller &write_trajectory(const char *device_name, uint8_t mode,
+	                             uint8_t options, const TrajectoryPoint *points,
+	                             size_t n_points);
+
+	/**
+	 * Writes a trajectory of arbitrary length, split into chunks of at most
+	 * TRAJECTORY_MAX_POINTS points. Only the first chunk carries the
+	 * TRAJECTORY_START and only the last chunk the TRAJECTORY_END flag.
+	 */
+	Marshaller &write_trajectory_chunked(const char *device_name, uint8_t mode,
+	                                     uint8_t options,
+	                                     const TrajectoryPoint *points,
+	                                     size_t n_points);
+	Marshaller &write_trajectory_underrun(const char *device_name);
+
+	/**
+	 * Writes the raw values of a sensor. The actual values are obtained by
+	 * dividing by 10^decimals. At most SENSOR_MAX_VALUES values are written.
+	 */
+	Marshaller &write_sensor_values(const char *device_name, uint8_t decimals,
+	                                const int32_t *values, size_t n_values);
+	Marshaller &write_set_sensor_mode(const char *device_name,
+	                                  const char *mode);
 	Marshaller &write_heartbeat();
 	Marshaller &write_reset();
+
+	/**
+	 * Writes a ping. The nonce and the timestamp are opaque to the receiver
+	 * and returned unchanged in the pong.
+	 */
+	Marshaller &write_ping(uint32_t nonce, int64_t timestamp);
+
+	/**
+	 * Writes the reply to a ping received from the source with the given
+	 * hash. The receive and transmit times are given in nanoseconds.
+	 */
+	Marshaller &write_pong(const char *requester_hash, uint32_t nonce,
+	                       int64_t timestamp, int64_t receive_time,
+	                       int64_t transmit_time);
+
+	/**
+	 * Writes the report mode of the sender. A negative deadband indicates that
+	 * every sample is reported. Otherwise, motor positions are only reported
+	 * if they changed by more than the deadband in degrees, and in keyframes
+	 * sent every keyframe_period milliseconds.
+	 */
+	Marshaller &write_report_mode(int32_t deadband, uint32_t keyframe_period);
+
+	/**
+	 * Writes a subscription with the given period in milliseconds, or a
+	 * cancellation if the period is zero. Devices are selected by up to
+	 * SUBSCRIBE_MAX_PATTERNS patterns that may contain the wildcards "*" and
+	 * "?"; no patterns select all devices.
+	 */
+	Marshaller &write_subscribe(uint32_t period, const char *const *patterns,
+	                            size_t n_patterns);
+
+	/**
+	 * Marks the following messages in the current packet as part of the
+	 * stream of the subscriber with the given hash.
+	 */
+	Marshaller &write_stream(const char *requester_hash);
 };
 
 class Demarshaller {
@@ -124,11 +403,83 @@ public:
 		int32_t position;
 	};
 
+	struct VelocitySensor {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		int32_t velocity;
+	};
+
+	struct Telemetry {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		uint8_t attribute;
+		int32_t value;
+	};
+
 	struct SetDutyCycle {
 		char device_name[N_DEVICE_NAME_CHARS + 1];
+		DeviceHandle device;
 		int32_t duty_cycle;
 	};
 
+	struct SetTarget {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		DeviceHandle device;
+		int32_t target;
+		int32_t kp, ki, kd;
+	};
+
+	struct Trajectory {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		DeviceHandle device;
+		uint8_t mode;
+		uint8_t options;
+		uint8_t n_points;
+		TrajectoryPoint points[TRAJECTORY_MAX_POINTS];
+	};
+
+	struct TrajectoryUnderrun {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+	};
+
+	struct SensorValues {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		uint8_t decimals;
+		uint8_t n_values;
+		int32_t values[SENSOR_MAX_VALUES];
+	};
+
+	struct SetSensorMode {
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		char mode[N_SENSOR_MODE_CHARS + 1];
+	};
+
+	struct Ping {
+		uint32_t nonce;
+		int64_t timestamp;
+	};
+
+	struct Pong {
+		char requester_hash[N_SOURCE_HASH_CHARS + 1];
+		uint32_t nonce;
+		int64_t timestamp;
+		int64_t receive_time;
+		int64_t transmit_time;
+	};
+
+	struct ReportMode {
+		int32_t deadband;
+		uint32_t keyframe_period;
+	};
+
+	struct Subscribe {
+		uint32_t period;
+		uint8_t n_patterns;
+		char patterns[SUBSCRIBE_MAX_PATTERNS][N_DEVICE_NAME_CHARS + 1];
+	};
+
+	struct Stream {
+		char requester_hash[N_SOURCE_HASH_CHARS + 1];
+	};
+
 	struct Listener {
 		Listener(){};
 
@@ -139,22 +490,204 @@ public:
 		virtual void on_position_sensor(const Header &,
 		                                const PositionSensor &){};
 
+		virtual void on_velocity_sensor(const Header &,
+		                                const VelocitySensor &){};
+
+		virtual void on_telemetry(const Header &, const Telemetry &){};
+
 		virtual void on_set_duty_cycle(const Header &, const SetDutyCycle &){};
 
+		virtual void on_set_position_target(const Header &,
+		                                    const SetTarget &){};
+
+		virtual void on_set_velocity_target(const Header &,
+		                                    const SetTarget &){};
+
+		virtual void on_trajectory(const Header &, const Trajectory &){};
+
+		virtual void on_trajectory_underrun(const Header &,
+		                                    const TrajectoryUnderrun &){};
+
+		virtual void on_sensor_values(const Header &, const SensorValues &){};
+
+		virtual void on_set_sensor_mode(const Header &,
+		                                const SetSensorMode &){};
+
 		virtual void on_heartbeat(const Header &) {};
 
 		virtual void on_reset(const Header &){};
+
+		virtual void on_ping(const Header &, const Ping &){};
+
+		virtual void on_pong(const Header &, const Pong &){};
+
+		virtual void on_report_mode(const Header &, const ReportMode &){};
+
+		virtual void on_subscribe(const Header &, const Subscribe &){};
+
+		virtual void on_stream(const Header &, const Stream &){};
+	};
+
+	/**
+	 * Listener passing all messages on to another listener. Decorators derive
+	 * from this class and only override the callbacks they act upon.
+	 */
+	class ForwardingListener : public Listener {
+	protected:
+		Listener &m_next;
+
+	public:
+		explicit ForwardingListener(Listener &next) : m_next(next) {}
+
+		bool filter(const Header &header) override
+		{
+			return m_next.filter(header);
+		}
+
+		void on_position_sensor(const Header &header,
+		                        const PositionSensor &position) override
+		{
+			m_next.on_position_sensor(header, position);
+		}
+
+		void on_velocity_sensor(const Header &header,
+		                        const VelocitySensor &velocity) override
+		{
+			m_next.on_velocity_sensor(header, velocity);
+		}
+
+		void on_telemetry(const Header &header,
+		                  const Telemetry &telemetry) override
+		{
+			m_next.on_telemetry(header, telemetry);
+		}
+
+		void on_set_duty_cycle(const Header &header,
+		                       const SetDutyCycle &set_duty_cycle) override
+		{
+			m_next.on_set_duty_cycle(header, set_duty_cycle);
+		}
+
+		void on_set_position_target(const Header &header,
+		                            const SetTarget &set_target) override
+		{
+			m_next.on_set_position_target(header, set_target);
+		}
+
+		void on_set_velocity_target(const Header &header,
+		                            const SetTarget &set_target) override
+		{
+			m_next.on_set_velocity_target(header, set_target);
+		}
+
+		void on_trajectory(const Header &header,
+		                   const Trajectory &trajectory) override
+		{
+			m_next.on_trajectory(header, trajectory);
+		}
+
+		void on_trajectory_underrun(
+		    const Header &header, const TrajectoryUnderrun &underrun) override
+		{
+			m_next.on_trajectory_underrun(header, underrun);
+		}
+
+		void on_sensor_values(const Header &header,
+		                      const SensorValues &sensor) override
+		{
+			m_next.on_sensor_values(header, sensor);
+		}
+
+		void on_set_sensor_mode(const Header &header,
+		                        const SetSensorMode &set_sensor_mode) override
+		{
+			m_next.on_set_sensor_mode(header, set_sensor_mode);
+		}
+
+		void on_heartbeat(const Header &header) override
+		{
+			m_next.on_heartbeat(header);
+		}
+
+		void on_reset(const Header &header) override
+		{
+			m_next.on_reset(header);
+		}
+
+		void on_ping(const Header &header, const Ping &ping) override
+		{
+			m_next.on_ping(header, ping);
+		}
+
+		void on_pong(const Header &header, const Pong &pong) override
+		{
+			m_next.on_pong(header, pong);
+		}
+
+		void on_report_mode(const Header &header,
+		                    const ReportMode &mode) override
+		{
+			m_next.on_report_mode(header, mode);
+		}
+
+		void on_subscribe(const Header &header,
+		                  const Subscribe &subscribe) override
+		{
+			m_next.on_subscribe(header, subscribe);
+		}
+
+		void on_stream(const Header &header, const Stream &stream) override
+		{
+			m_next.on_stream(header, stream);
+		}
 	};
 
 private:
+	/**
+	 * Number of entries in the device handle cache. Must be a power of two.
+	 */
+	static constexpr size_t DEVICE_CACHE_SIZE = 8;
+
+	/**
+	 * Remembers the raw device name and the corresponding handle for a record
+	 * position within a message. Senders usually address the same devices in
+	 * the same order, so most lookups are answered without hashing the name.
+	 */
+	struct DeviceCacheEntry {
+		char device_name[N_DEVICE_NAME_CHARS];
+		DeviceHandle device;
+	};
+
 	uint32_t m_sync;
 	Header m_header;
 	uint8_t m_type;
 	PositionSensor m_position_sensor;
+	VelocitySensor m_velocity_sensor;
+	Telemetry m_telemetry;
 	SetDutyCycle m_set_duty_cycle;
+	SetTarget m_set_target;
+	Trajectory m_trajectory;
+	TrajectoryUnderrun m_trajectory_underrun;
+	SensorValues m_sensor_values;
+	SetSensorMode m_set_sensor_mode;
+	Ping m_ping;
+	Pong m_pong;
+	ReportMode m_report_mode;
+	Subscribe m_subscribe;
+	Stream m_stream;
+
+	const DeviceTable *m_device_table;
+	DeviceCacheEntry m_device_cache[DEVICE_CACHE_SIZE];
+
+	DeviceHandle resolve_device(size_t idx, const char *device_name);
 
 public:
-	Demarshaller();
+	/**
+	 * Creates a new Demarshaller instance. If a device table is given, device
+	 * names in incoming commands are resolved to handles using that table.
+	 * Otherwise all handles are set to INVALID_DEVICE_HANDLE.
+	 */
+	explicit Demarshaller(const DeviceTable *device_table = nullptr);
 
 	void parse(Listener &listener, const uint8_t *buf, size_t buf_size);
 };
@@ -20,12 +20,25 @@
 
 namespace ev3_event_broker {
 
+/**
+ * Flags returned by Motor::get_state(). Correspond to the words that may
+ * appear in the ev3dev "state" attribute.
+ */
+static constexpr int MOTOR_STATE_RUNNING = 0x01;
+static constexpr int MOTOR_STATE_RAMPING = 0x02;
+static constexpr int MOTOR_STATE_HOLDING = 0x04;
+static constexpr int MOTOR_STATE_OVERLOADED = 0x08;
+static constexpr int MOTOR_STATE_STALLED = 0x10;
+
 class Motor {
 public:
 	virtual ~Motor() {}
 	virtual void reset() = 0;
 	virtual bool good() const = 0;
 	virtual int get_position() const = 0;
+	virtual int get_speed() const = 0;
+	virtual int get_duty_cycle() const = 0;
+	virtual int get_state() const = 0;
 	virtual void set_duty_cycle(int duty_cycle) = 0;
 	virtual const char *name() const = 0;
 };
@@ -18,50 +18,75 @@
 
 #include <algorithm>
 #include <cstring>
+#include <iterator>
 
 #include <dirent.h>
 
 #include <ev3_event_broker/error.hpp>
 #include <ev3_event_broker/motors.hpp>
 
-#ifndef VIRTUAL_MOTORS
 #include <ev3_event_broker/tacho_motor.hpp>
-#else
-#include <ev3_event_broker/virtual_motor.hpp>
-#endif
 
 namespace ev3_event_broker {
-Motors::Motors() { rescan(); }
 
-Motor *Motors::find(const char *name)
+static const char DEFAULT_ROOT_DIR[] = "/sys/class/tacho-motor";
+
+Motors::Motors() : Motors(DEFAULT_ROOT_DIR) {}
+
+Motors::Motors(const char *root_dir) : m_root_dir(root_dir)
 {
-	for (auto &motor : m_motors) {
-		if (strcmp(motor->name(), name) == 0) {
-			return motor.get();
-		}
+	std::fill(std::begin(m_motors_by_handle), std::end(m_motors_by_handle),
+	          nullptr);
+	rescan();
+}
+
+Motor *Motors::add(std::unique_ptr<Motor> motor)
+{
+	if (find(motor->name())) {
+		return nullptr;
+	}
+	DeviceHandle handle = m_device_table.insert(motor->name());
+	if (handle == INVALID_DEVICE_HANDLE) {
+		return nullptr;  // Too many distinct motor names
 	}
-	return nullptr;
+	motor->reset();
+	m_motors_by_handle[handle] = motor.get();
+	m_motors.emplace_back(std::move(motor));
+	return m_motors.back().get();
+}
+
+Motor *Motors::find(const char *name)
+{
+	return get(m_device_table.find(name));
 }
 
 void Motors::rescan()
 {
-#ifndef VIRTUAL_MOTORS
-	const char motor_root_dir[] = "/sys/class/tacho-motor";
-#else
-	const char motor_root_dir[] = "./motors";
-#endif
-	const size_t motor_root_dir_len = sizeof(motor_root_dir) - 1;
-	char buf[1024];
-	strncpy(buf, motor_root_dir, sizeof(buf));
 
 	// Remove all motors from the list that no longer can be probed (are no
 	// longer good)
 	m_motors.erase(std::remove_if(m_motors.begin(), m_motors.end(),
-	                              [](const std::unique_ptr<Motor> &motor) {
-		                              return !motor->good();
+	                              [this](const std::unique_ptr<Motor> &motor) {
+		                              if (motor->good()) {
+			                              return false;
+		                              }
+		                              DeviceHandle handle =
+		                                  m_device_table.find(motor->name());
+		                              m_motors_by_handle[handle] = nullptr;
+		                              return true;
 	                              }),
 	               m_motors.end());
 
+	// Nothing to scan if motors are added manually
+	if (!m_root_dir) {
+		return;
+	}
+	const char *motor_root_dir = m_root_dir;
+	const size_t motor_root_dir_len = strlen(motor_root_dir);
+	char buf[1024];
+	strncpy(buf, motor_root_dir, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+
 	// Iterate over the motor root directory
 	DIR *d;
 	struct dirent *dir;
@@ -75,16 +100,8 @@ void Motors::rescan()
 				snprintf(buf + motor_root_dir_len,
 				         sizeof(buf) - motor_root_dir_len, "/%s", dir->d_name);
 
-// Create the motor instance
-#ifndef VIRTUAL_MOTORS
-				std::unique_ptr<TachoMotor> motor(new TachoMotor(buf));
-#else
-				std::unique_ptr<VirtualMotor> motor(new VirtualMotor(buf));
-#endif
-				if (!find(motor->name())) {
-					motor->reset();
-					m_motors.emplace_back(std::move(motor));
-				}
+				// Create the motor instance
+				add(std::unique_ptr<Motor>(new TachoMotor(buf)));
 			}
 			catch (std::system_error &) {
 				// Ignore failures at this point
@@ -19,23 +19,66 @@
 #pragma once
 
 #include <vector>
-#include <string>
 #include <memory>
 
+#include <ev3_event_broker/device_table.hpp>
 #include <ev3_event_broker/motor.hpp>
 
 namespace ev3_event_broker {
 class Motors {
 private:
+	const char *m_root_dir;
 	std::vector<std::unique_ptr<Motor>> m_motors;
+	DeviceTable m_device_table;
+	Motor *m_motors_by_handle[DeviceTable::MAX_DEVICES];
+
 public:
+	/**
+	 * Creates a motor list populated from /sys/class/tacho-motor.
+	 */
 	Motors();
 
+	/**
+	 * Creates a motor list populated from the given directory. If root_dir is
+	 * nullptr, no directory is scanned and motors must be added using add().
+	 * The string must remain valid for the lifetime of the Motors instance.
+	 */
+	explicit Motors(const char *root_dir);
+
+	/**
+	 * Removes motors that are no longer good and adds new motors found in the
+	 * root directory.
+	 */
 	void rescan();
 
+	/**
+	 * Adds the given motor to the list. Returns a pointer at the motor or
+	 * nullptr if a motor with the same name already exists or there are too
+	 * many motors.
+	 */
+	Motor *add(std::unique_ptr<Motor> motor);
+
 	const std::vector<std::unique_ptr<Motor>> &motors() const { return m_motors; }
 	std::vector<std::unique_ptr<Motor>> &motors() { return m_motors; }
 
+	/**
+	 * Table mapping motor names to handles. Handles stay valid when a motor is
+	 * unplugged and plugged back in.
+	 */
+	const DeviceTable &device_table() const { return m_device_table; }
+
 	Motor *find(const char *name);
+
+	/**
+	 * Returns the motor with the given handle or nullptr if the handle is
+	 * invalid or the motor is currently not connected.
+	 */
+	Motor *get(DeviceHandle handle)
+	{
+		if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+			return nullptr;
+		}
+		return m_motors_by_handle[handle];
+	}
 };
 }
@@ -0,0 +1,190 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/output_buffer.hpp>
+
+namespace ev3_event_broker {
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity, Policy policy)
+    : m_fd(fd),
+      m_fd_flags(err(fcntl(fd, F_GETFL, 0))),
+      m_policy(policy),
+      m_buf(std::max(capacity, MIN_CAPACITY)),
+      m_read_pos(0),
+      m_write_pos(0),
+      m_chunk_remaining(0),
+      m_n_chunks(0),
+      m_n_bytes(0),
+      m_dropped_bytes(0),
+      m_dropped_chunks(0)
+{
+	err(fcntl(fd, F_SETFL, m_fd_flags | O_NONBLOCK));
+}
+
+OutputBuffer::~OutputBuffer() { fcntl(m_fd, F_SETFL, m_fd_flags); }
+
+bool OutputBuffer::parse_policy(const char *name, Policy &policy)
+{
+	if (strcmp(name, "drop") == 0) {
+		policy = Policy::DROP;
+	}
+	else if (strcmp(name, "conflate") == 0) {
+		policy = Policy::CONFLATE;
+	}
+	else if (strcmp(name, "block") == 0) {
+		policy = Policy::BLOCK;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+void OutputBuffer::copy_in(const void *src, size_t n)
+{
+	const size_t offs = m_write_pos % m_buf.size();
+	const size_t n0 = std::min(n, m_buf.size() - offs);
+	memcpy(&m_buf[offs], src, n0);
+	memcpy(&m_buf[0], static_cast<const uint8_t *>(src) + n0, n - n0);
+	m_write_pos += n;
+}
+
+void OutputBuffer::copy_out(void *tar, size_t n)
+{
+	const size_t offs = m_read_pos % m_buf.size();
+	const size_t n0 = std::min(n, m_buf.size() - offs);
+	memcpy(tar, &m_buf[offs], n0);
+	memcpy(static_cast<uint8_t *>(tar) + n0, &m_buf[0], n - n0);
+	m_read_pos += n;
+}
+
+void OutputBuffer::drop(size_t n)
+{
+	m_dropped_bytes += n;
+	m_dropped_chunks++;
+}
+
+bool OutputBuffer::write(const uint8_t *buf, size_t n)
+{
+	if (n == 0) {
+		return true;
+	}
+
+	// Try to write the chunk directly if nothing is queued; a partially
+	// written chunk becomes the current chunk
+	if (!pending()) {
+		ssize_t res;
+		do {
+			res = ::write(m_fd, buf, n);
+		} while (res < 0 && errno == EINTR);
+		if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			err(res);
+		}
+		res = std::max<ssize_t>(res, 0);
+		if (size_t(res) < n) {
+			m_chunk_remaining = n - res;
+			m_n_bytes = m_chunk_remaining;
+			copy_in(buf + res, m_chunk_remaining);
+		}
+		return true;
+	}
+
+	// Make space for the chunk and its size
+	const uint32_t size = uint32_t(n);
+	if (space() < sizeof(size) + n) {
+		switch (m_policy) {
+			case Policy::DROP:
+				m_dropped_bytes += m_n_bytes - m_chunk_remaining;
+				m_dropped_chunks += m_n_chunks;
+				m_write_pos = m_read_pos + m_chunk_remaining;
+				m_n_bytes = m_chunk_remaining;
+				m_n_chunks = 0;
+				drop(n);
+				return false;
+			case Policy::CONFLATE:
+				drop(n);
+				return false;
+			case Policy::BLOCK:
+				while (space() < sizeof(size) + n) {
+					struct pollfd pfd = {m_fd, POLLOUT, 0};
+					if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+						err(-1);
+					}
+					drain();
+				}
+				break;
+		}
+	}
+	copy_in(&size, sizeof(size));
+	copy_in(buf, n);
+	m_n_chunks++;
+	m_n_bytes += n;
+	return true;
+}
+
+void OutputBuffer::drain()
+{
+	while (pending()) {
+		// Start the next chunk
+		if (m_chunk_remaining == 0) {
+			uint32_t size;
+			copy_out(&size, sizeof(size));
+			m_chunk_remaining = size;
+			m_n_chunks--;
+		}
+
+		// Write the contiguous part of the current chunk
+		const size_t offs = m_read_pos % m_buf.size();
+		const size_t n = std::min(m_chunk_remaining, m_buf.size() - offs);
+		const ssize_t res = ::write(m_fd, &m_buf[offs], n);
+		if (res < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			err(res);
+		}
+		m_read_pos += res;
+		m_chunk_remaining -= res;
+		m_n_bytes -= res;
+	}
+}
+
+void OutputBuffer::drain_blocking()
+{
+	drain();
+	while (pending()) {
+		struct pollfd pfd = {m_fd, POLLOUT, 0};
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			err(-1);
+		}
+		drain();
+	}
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,149 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file output_buffer.hpp
+ *
+ * Bounded, non-blocking output stage for the client.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ev3_event_broker {
+
+/**
+ * The OutputBuffer class writes chunks of data to a non-blocking file
+ * descriptor. Data that cannot be written immediately is queued in a ring
+ * buffer of fixed capacity, which is drained by calling drain() whenever the
+ * file descriptor becomes writable. Chunks are never split: if the buffer
+ * overflows, whole chunks are discarded according to the overflow policy.
+ * Writers should thus pass complete records to write().
+ */
+class OutputBuffer {
+public:
+	enum class Policy {
+		/**
+		 * Discard the queued chunks that were not started yet, as well as the
+		 * chunk that did not fit.
+		 */
+		DROP,
+
+		/**
+		 * Discard the chunk that did not fit. The caller is expected to
+		 * conflate its output while congested() returns true.
+		 */
+		CONFLATE,
+
+		/**
+		 * Wait until there is enough space in the buffer.
+		 */
+		BLOCK
+	};
+
+	/**
+	 * Default and minimum capacity of the ring buffer. Chunks passed to
+	 * write() must be smaller than MIN_CAPACITY / 2.
+	 */
+	static constexpr size_t DEFAULT_CAPACITY = 4 << 20;
+	static constexpr size_t MIN_CAPACITY = 64 << 10;
+
+private:
+	int m_fd;
+	int m_fd_flags;
+	Policy m_policy;
+	std::vector<uint8_t> m_buf;
+
+	/**
+	 * Positions in the ring buffer, counted from the start. Each queued chunk
+	 * is preceded by its size; the size of the chunk currently being written
+	 * has already been consumed.
+	 */
+	uint64_t m_read_pos;
+	uint64_t m_write_pos;
+
+	size_t m_chunk_remaining;
+	size_t m_n_chunks;
+	size_t m_n_bytes;
+	uint64_t m_dropped_bytes;
+	uint64_t m_dropped_chunks;
+
+	void copy_in(const void *src, size_t n);
+	void copy_out(void *tar, size_t n);
+	size_t space() const { return m_buf.size() - (m_write_pos - m_read_pos); }
+	void drop(size_t n);
+
+public:
+	/**
+	 * Puts the given file descriptor into non-blocking mode; the original
+	 * mode is restored by the destructor.
+	 */
+	OutputBuffer(int fd, size_t capacity = DEFAULT_CAPACITY,
+	             Policy policy = Policy::DROP);
+	~OutputBuffer();
+
+	/**
+	 * Parses the name of an overflow policy, i.e. "drop", "conflate" or
+	 * "block". Returns false if the name is invalid.
+	 */
+	static bool parse_policy(const char *name, Policy &policy);
+
+	int fd() const { return m_fd; }
+
+	Policy policy() const { return m_policy; }
+
+	/**
+	 * Writes the given chunk or appends it to the buffer. Returns false if
+	 * data was discarded.
+	 */
+	bool write(const uint8_t *buf, size_t n);
+
+	/**
+	 * Writes as much of the buffered data as possible without blocking.
+	 */
+	void drain();
+
+	/**
+	 * Writes all buffered data, waiting for the file descriptor to become
+	 * writable if necessary.
+	 */
+	void drain_blocking();
+
+	/**
+	 * Returns true if there is data waiting to be written.
+	 */
+	bool pending() const { return m_chunk_remaining > 0 || m_n_chunks > 0; }
+
+	/**
+	 * Returns true if the buffer is more than half full.
+	 */
+	bool congested() const { return space() < m_buf.size() / 2; }
+
+	/**
+	 * Number of bytes and chunks discarded so far.
+	 */
+	uint64_t dropped_bytes() const { return m_dropped_bytes; }
+	uint64_t dropped_chunks() const { return m_dropped_chunks; }
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,268 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file output_listener.hpp
+ *
+ * Demarshaller listeners writing the received records in the JSON or binary
+ * client output format.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cmath>
+
+#include <ev3_event_broker/binary_writer.hpp>
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/json_writer.hpp>
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/predictor.hpp>
+#include <ev3_event_broker/sampling_plan.hpp>
+#include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/source_id.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Returns the position of the given device predicted for the current time of
+ * the given clock in thousandths of degrees, or false if there is no
+ * prediction.
+ */
+static inline bool predict_position(const Predictor *predictor,
+                                    const Clock &clock,
+                                    const Demarshaller::Header &header,
+                                    const char *device, int32_t &position)
+{
+	double predicted;
+	if (!predictor || !predictor->enabled() ||
+	    !predictor->predict(header.source_name, device, clock.now_ns(),
+	                        predicted)) {
+		return false;
+	}
+	position = int32_t(std::lround(predicted * 1e3));
+	return true;
+}
+
+/**
+ * Writes all records not originating from the given source as JSON objects.
+ * The address of the sender is read from the given variable. If a predictor
+ * is given, position records additionally contain the position predicted
+ * for the current time of the given clock.
+ */
+class JsonListener : public Demarshaller::Listener {
+private:
+	SourceId &m_source_id;
+	socket::Address &m_source_address;
+	JsonWriter &m_writer;
+	const Predictor *m_predictor;
+	const Clock &m_clock;
+
+public:
+	JsonListener(SourceId &source_id, socket::Address &source_address,
+	             JsonWriter &writer, const Predictor *predictor = nullptr,
+	             const Clock &clock = Clock::monotonic())
+	    : m_source_id(source_id),
+	      m_source_address(source_address),
+	      m_writer(writer),
+	      m_predictor(predictor),
+	      m_clock(clock)
+	{
+	}
+
+	/**
+	 * Implementation of the filter() function. Discards messages originating
+	 * from this device.
+	 */
+	bool filter(const Demarshaller::Header &header) override
+	{
+		return !m_source_id.matches(header.source_name, header.source_hash);
+	}
+
+	/**
+	 * Dump incoming position events as JSON.
+	 */
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		int32_t predicted;
+		m_writer.begin(header, m_source_address, "position");
+		m_writer.field("device", position.device_name);
+		m_writer.field("position", position.position);
+		if (predict_position(m_predictor, m_clock, header,
+		                     position.device_name, predicted)) {
+			m_writer.field_fixed("predicted", predicted, 3);
+		}
+		m_writer.end();
+	}
+
+	/**
+	 * Dump incoming velocity estimates as JSON.
+	 */
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		m_writer.begin(header, m_source_address, "velocity");
+		m_writer.field("device", velocity.device_name);
+		m_writer.field_fixed("velocity", velocity.velocity, 3);
+		m_writer.end();
+	}
+
+	/**
+	 * Dump incoming telemetry as JSON. The type of the message is
+	 * the name of the attribute.
+	 */
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		const char *attr = SamplingPlan::attribute_name(telemetry.attribute);
+		m_writer.begin(header, m_source_address, attr);
+		m_writer.field("device", telemetry.device_name);
+		m_writer.field(attr, telemetry.value);
+		m_writer.end();
+	}
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override
+	{
+		m_writer.begin(header, m_source_address, "trajectory_underrun");
+		m_writer.field("device", underrun.device_name);
+		m_writer.end();
+	}
+
+	/**
+	 * Dump incoming sensor values as JSON. Values are scaled
+	 * according to the number of decimals reported by the sensor.
+	 */
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		m_writer.begin(header, m_source_address, "sensor");
+		m_writer.field("device", sensor.device_name);
+		m_writer.field_fixed("values", sensor.values, sensor.n_values,
+		                     sensor.decimals);
+		m_writer.end();
+	}
+
+	void on_heartbeat(const Demarshaller::Header &header) override
+	{
+		m_writer.begin(header, m_source_address, "heartbeat");
+		m_writer.end();
+	}
+
+	void on_report_mode(const Demarshaller::Header &header,
+	                    const Demarshaller::ReportMode &mode) override
+	{
+		m_writer.begin(header, m_source_address, "report_mode");
+		m_writer.field("deadband", int64_t(mode.deadband));
+		m_writer.field("keyframe_period", int64_t(mode.keyframe_period));
+		m_writer.end();
+	}
+};
+
+/**
+ * Counterpart of the JsonListener writing fixed-layout binary records, see
+ * binary_writer.hpp for a description of the format.
+ */
+class BinaryListener : public Demarshaller::Listener {
+private:
+	SourceId &m_source_id;
+	socket::Address &m_source_address;
+	BinaryWriter &m_writer;
+	const Predictor *m_predictor;
+	const Clock &m_clock;
+
+public:
+	BinaryListener(SourceId &source_id, socket::Address &source_address,
+	               BinaryWriter &writer, const Predictor *predictor = nullptr,
+	               const Clock &clock = Clock::monotonic())
+	    : m_source_id(source_id),
+	      m_source_address(source_address),
+	      m_writer(writer),
+	      m_predictor(predictor),
+	      m_clock(clock)
+	{
+	}
+
+	bool filter(const Demarshaller::Header &header) override
+	{
+		return !m_source_id.matches(header.source_name, header.source_hash);
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		int32_t predicted;
+		m_writer.position(header, m_source_address, position.device_name,
+		                  position.position);
+		if (predict_position(m_predictor, m_clock, header,
+		                     position.device_name, predicted)) {
+			m_writer.prediction(header, m_source_address,
+			                    position.device_name, predicted);
+		}
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		m_writer.velocity(header, m_source_address, velocity.device_name,
+		                  velocity.velocity);
+	}
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		m_writer.telemetry(header, m_source_address, telemetry.device_name,
+		                   telemetry.attribute, telemetry.value);
+	}
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override
+	{
+		m_writer.trajectory_underrun(header, m_source_address,
+		                             underrun.device_name);
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		m_writer.sensor(header, m_source_address, sensor.device_name,
+		                sensor.decimals, sensor.values, sensor.n_values);
+	}
+
+	void on_heartbeat(const Demarshaller::Header &header) override
+	{
+		m_writer.heartbeat(header, m_source_address);
+	}
+
+	void on_report_mode(const Demarshaller::Header &header,
+	                    const Demarshaller::ReportMode &mode) override
+	{
+		m_writer.report_mode(header, m_source_address, mode.deadband,
+		                     mode.keyframe_period);
+	}
+};
+
+}  // namespace ev3_event_broker
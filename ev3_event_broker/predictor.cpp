@@ -0,0 +1,200 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/predictor.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static uint32_t fnv1a(uint32_t h, const char *str)
+{
+	for (; *str; str++) {
+		h = (h ^ uint8_t(*str)) * 0x01000193U;
+	}
+	return (h ^ 0xFF) * 0x01000193U;  // Separator between fields
+}
+
+/******************************************************************************
+ * Struct Predictor::Config                                                   *
+ ******************************************************************************/
+
+bool Predictor::Config::parse(const char *spec)
+{
+	char *endptr;
+	if (strcmp(spec, "none") == 0) {
+		model = Model::NONE;
+		return true;
+	}
+	if (strcmp(spec, "velocity") == 0) {
+		model = Model::CONSTANT_VELOCITY;
+		return true;
+	}
+	if (strncmp(spec, "motor", 5) == 0) {
+		model = Model::MOTOR;
+		spec += 5;
+		if (*spec == '\0') {
+			return true;
+		}
+		if (*spec != ':') {
+			return false;
+		}
+		tau = strtod(spec + 1, &endptr) * 1e-3;
+		if (*endptr != ',') {
+			return false;
+		}
+		max_speed = strtod(endptr + 1, &endptr);
+		return (*endptr == '\0') && (tau > 0.0) && (max_speed > 0.0);
+	}
+	return false;
+}
+
+/******************************************************************************
+ * Class Predictor                                                            *
+ ******************************************************************************/
+
+Predictor::Predictor(const Config &config) : m_config(config), m_n_entries(0)
+{
+	memset(m_index, 0, sizeof(m_index));
+}
+
+const Predictor::Entry *Predictor::find(const char *source_name,
+                                        const char *device_name) const
+{
+	const size_t n_index = 2 * MAX_DEVICES;
+	const uint32_t h = fnv1a(fnv1a(0x811C9DC5U, source_name), device_name);
+	for (size_t i = h % n_index; m_index[i] != 0; i = (i + 1) % n_index) {
+		const Entry &entry = m_entries[m_index[i] - 1];
+		if (strcmp(entry.source_name, source_name) == 0 &&
+		    strcmp(entry.device_name, device_name) == 0) {
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+Predictor::Entry *Predictor::insert(const char *source_name,
+                                    const char *device_name)
+{
+	const size_t n_index = 2 * MAX_DEVICES;
+	const uint32_t h = fnv1a(fnv1a(0x811C9DC5U, source_name), device_name);
+	size_t i = h % n_index;
+	for (; m_index[i] != 0; i = (i + 1) % n_index) {
+		Entry &entry = m_entries[m_index[i] - 1];
+		if (strcmp(entry.source_name, source_name) == 0 &&
+		    strcmp(entry.device_name, device_name) == 0) {
+			return &entry;
+		}
+	}
+	if (m_n_entries == MAX_DEVICES) {
+		return nullptr;
+	}
+
+	Entry &entry = m_entries[m_n_entries];
+	memset(&entry, 0, sizeof(entry));
+	strncpy(entry.source_name, source_name, N_SOURCE_NAME_CHARS);
+	strncpy(entry.device_name, device_name, N_DEVICE_NAME_CHARS);
+	m_index[i] = uint16_t(++m_n_entries);
+	return &entry;
+}
+
+void Predictor::position(const char *source_name, const char *device_name,
+                         int32_t position, int64_t t_ns)
+{
+	Entry *entry = insert(source_name, device_name);
+	if (!entry) {
+		return;
+	}
+	entry->prev_t_ns = entry->t_ns;
+	entry->prev_position = entry->position;
+	entry->t_ns = t_ns;
+	entry->position = position;
+	entry->n_samples++;
+
+	// Differentiate the position unless the source sends velocity estimates
+	if (!entry->has_velocity && entry->n_samples > 1 &&
+	    entry->t_ns > entry->prev_t_ns) {
+		entry->velocity = (entry->position - entry->prev_position) /
+		                  (double(entry->t_ns - entry->prev_t_ns) * 1e-9);
+	}
+}
+
+void Predictor::velocity(const char *source_name, const char *device_name,
+                         int32_t velocity)
+{
+	Entry *entry = insert(source_name, device_name);
+	if (entry) {
+		entry->velocity = velocity * 1e-3;
+		entry->has_velocity = true;
+	}
+}
+
+void Predictor::duty_cycle(const char *source_name, const char *device_name,
+                           int32_t duty_cycle)
+{
+	Entry *entry = insert(source_name, device_name);
+	if (entry) {
+		entry->duty_cycle = duty_cycle;
+		entry->has_duty_cycle = true;
+	}
+}
+
+void Predictor::clear_duty_cycle(const char *source_name,
+                                 const char *device_name)
+{
+	for (size_t i = 0; i < m_n_entries; i++) {
+		Entry &entry = m_entries[i];
+		if (strcmp(entry.source_name, source_name) == 0 &&
+		    (!device_name || strcmp(entry.device_name, device_name) == 0)) {
+			entry.has_duty_cycle = false;
+		}
+	}
+}
+
+bool Predictor::predict(const char *source_name, const char *device_name,
+                        int64_t t_ns, double &position) const
+{
+	const Entry *entry = find(source_name, device_name);
+	if (!entry || entry->n_samples == 0) {
+		return false;
+	}
+
+	double dt = double(t_ns - entry->t_ns) * 1e-9 + m_config.lead;
+	dt = std::min(std::max(dt, 0.0), MAX_HORIZON);
+	if (m_config.model == Model::MOTOR && entry->has_duty_cycle) {
+		// Exact solution of the first-order system, see VirtualMotorBank
+		const double tau = m_config.tau;
+		const double vt = entry->duty_cycle * 1e-2 * m_config.max_speed;
+		const double dv = entry->velocity - vt;
+		position = entry->position + vt * dt +
+		           dv * tau * (1.0 - std::exp(-dt / tau));
+	}
+	else {
+		position = entry->position + entry->velocity * dt;
+	}
+	return true;
+}
+
+}  // namespace ev3_event_broker
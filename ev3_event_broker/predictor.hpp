@@ -0,0 +1,158 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file predictor.hpp
+ *
+ * Extrapolates the motor positions received from remote sources to the
+ * current time.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The Predictor class compensates for the age of the motor positions received
+ * by the client. For each (source, device) pair it keeps the latest position,
+ * velocity and duty cycle and extrapolates the position to a given time,
+ * either assuming a constant velocity or using the same first-order motor
+ * model as the VirtualMotorBank.
+ */
+class Predictor {
+public:
+	/**
+	 * Maximum number of devices. Devices that do not fit into the table are
+	 * not predicted.
+	 */
+	static constexpr size_t MAX_DEVICES = 1024;
+
+	/**
+	 * Maximum time in seconds the positions are extrapolated into the future;
+	 * the predictions of devices that stopped reporting do not diverge.
+	 */
+	static constexpr double MAX_HORIZON = 0.25;
+
+	enum class Model { NONE, CONSTANT_VELOCITY, MOTOR };
+
+	struct Config {
+		Model model;
+
+		/**
+		 * Time constant of the motor in seconds and its speed at 100% duty
+		 * cycle in degrees per second; only used by the motor model.
+		 */
+		double tau;
+		double max_speed;
+
+		/**
+		 * Time in seconds added to the prediction time, e.g. to account for
+		 * the network latency.
+		 */
+		double lead;
+
+		Config()
+		    : model(Model::NONE), tau(100.0e-3), max_speed(1440.0), lead(0.0)
+		{
+		}
+
+		/**
+		 * Parses a model specification of the form "none", "velocity" or
+		 * "motor:TAU,MAX_SPEED", where TAU is given in milliseconds. The
+		 * motor parameters may be omitted, in which case the defaults are
+		 * used. Returns false if the specification is invalid.
+		 */
+		bool parse(const char *spec);
+	};
+
+private:
+	struct Entry {
+		char source_name[N_SOURCE_NAME_CHARS + 1];
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+		int64_t t_ns;
+		int64_t prev_t_ns;
+		double position;
+		double prev_position;
+		double velocity;
+		double duty_cycle;
+		uint32_t n_samples;
+		bool has_velocity;
+		bool has_duty_cycle;
+	};
+
+	Config m_config;
+	Entry m_entries[MAX_DEVICES];
+	uint16_t m_index[2 * MAX_DEVICES];  // Entry index plus one, zero if empty
+	size_t m_n_entries;
+
+	const Entry *find(const char *source_name, const char *device_name) const;
+	Entry *insert(const char *source_name, const char *device_name);
+
+public:
+	explicit Predictor(const Config &config = Config());
+
+	const Config &config() const { return m_config; }
+
+	bool enabled() const { return m_config.model != Model::NONE; }
+
+	/**
+	 * Records a position sample in degrees received at time t_ns.
+	 */
+	void position(const char *source_name, const char *device_name,
+	              int32_t position, int64_t t_ns);
+
+	/**
+	 * Records a velocity estimate in thousandths of degrees per second sent by
+	 * the source. If no estimates are received, the velocity is computed from
+	 * the last two position samples.
+	 */
+	void velocity(const char *source_name, const char *device_name,
+	              int32_t velocity);
+
+	/**
+	 * Records the duty cycle of a motor in percent, as commanded by this
+	 * client or reported by the source.
+	 */
+	void duty_cycle(const char *source_name, const char *device_name,
+	                int32_t duty_cycle);
+
+	/**
+	 * Marks the duty cycle of a motor as unknown, e.g. because the motor is
+	 * controlled by the on-brick controller. Positions are then extrapolated
+	 * with a constant velocity. If no device name is given, the duty cycles of
+	 * all motors of the source are marked as unknown.
+	 */
+	void clear_duty_cycle(const char *source_name, const char *device_name);
+
+	/**
+	 * Writes the position in degrees the given device is predicted to be at
+	 * at time t_ns plus the configured lead to the given variable. Returns
+	 * false if no position of the device is known.
+	 */
+	bool predict(const char *source_name, const char *device_name,
+	             int64_t t_ns, double &position) const;
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,251 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/recording.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+struct RecordingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t index_offset;
+};
+
+static_assert(sizeof(RecordHeader) == 24, "Unexpected record header size");
+static_assert(sizeof(RecordIndex) == 16, "Unexpected index record size");
+static_assert(sizeof(RecordingHeader) <= RECORDING_HEADER_SIZE,
+              "Recording header too large");
+
+static size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+
+/******************************************************************************
+ * Class Recorder                                                             *
+ ******************************************************************************/
+
+Recorder::Recorder(const char *path)
+    : m_fd(-1),
+      m_offset(RECORDING_HEADER_SIZE),
+      m_index_offset(0),
+      m_index_t_ns(0),
+      m_n_datagrams(0),
+      m_ptr(0)
+{
+	m_fd = err(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+
+	uint8_t header[RECORDING_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	const RecordingHeader h = {RECORDING_MAGIC, RECORDING_VERSION, 0};
+	memcpy(header, &h, sizeof(h));
+	if (pwrite(m_fd, header, sizeof(header), 0) != sizeof(header)) {
+		close(m_fd);
+		throw std::system_error(errno, std::system_category());
+	}
+}
+
+Recorder::~Recorder()
+{
+	try {
+		flush();
+	}
+	catch (...) {
+		// Do not throw from the destructor
+	}
+	close(m_fd);
+}
+
+void Recorder::append(uint16_t type, int64_t t_ns,
+                      const socket::Address &address, const void *payload,
+                      size_t size)
+{
+	const size_t n = sizeof(RecordHeader) + padded(size);
+	if (m_ptr + n > BUF_SIZE) {
+		flush();
+	}
+
+	RecordHeader h;
+	memset(&h, 0, sizeof(h));
+	h.size = uint32_t(size);
+	h.type = type;
+	h.port = address.port;
+	h.ip[0] = address.a;
+	h.ip[1] = address.b;
+	h.ip[2] = address.c;
+	h.ip[3] = address.d;
+	h.t_ns = t_ns;
+	memcpy(m_buf + m_ptr, &h, sizeof(h));
+	memcpy(m_buf + m_ptr + sizeof(h), payload, size);
+	memset(m_buf + m_ptr + sizeof(h) + size, 0, padded(size) - size);
+	m_ptr += n;
+}
+
+void Recorder::record(int64_t t_ns, const socket::Address &address,
+                      const uint8_t *buf, size_t size)
+{
+	// Write an index record and publish it once it is on disk
+	if (m_n_datagrams == 0 ||
+	    t_ns - m_index_t_ns >= RECORDING_INDEX_INTERVAL_NS) {
+		const RecordIndex index = {m_index_offset, m_n_datagrams};
+		flush();
+		m_index_offset = m_offset;
+		m_index_t_ns = t_ns;
+		append(RECORD_INDEX, t_ns, socket::Address(), &index, sizeof(index));
+		flush();
+		const RecordingHeader h = {RECORDING_MAGIC, RECORDING_VERSION,
+		                           m_index_offset};
+		err(pwrite(m_fd, &h, sizeof(h), 0));
+	}
+
+	append(RECORD_DATAGRAM, t_ns, address, buf, size);
+	m_n_datagrams++;
+}
+
+void Recorder::flush()
+{
+	size_t ptr = 0;
+	while (ptr < m_ptr) {
+		ssize_t res = pwrite(m_fd, m_buf + ptr, m_ptr - ptr, m_offset);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		err(res);
+		ptr += res;
+		m_offset += res;
+	}
+	m_ptr = 0;
+}
+
+/******************************************************************************
+ * Class RecordingReader                                                      *
+ ******************************************************************************/
+
+RecordingReader::RecordingReader(const char *path)
+    : m_fd(-1), m_data(nullptr), m_size(0), m_offset(RECORDING_HEADER_SIZE)
+{
+	m_fd = err(open(path, O_RDONLY | O_CLOEXEC));
+	try {
+		struct stat st;
+		err(fstat(m_fd, &st));
+		m_size = st.st_size;
+		if (m_size < RECORDING_HEADER_SIZE) {
+			throw std::system_error(EINVAL, std::system_category(),
+			                        "Invalid recording");
+		}
+		void *mem = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if (mem == MAP_FAILED) {
+			throw std::system_error(errno, std::system_category());
+		}
+		m_data = static_cast<const uint8_t *>(mem);
+	}
+	catch (...) {
+		close(m_fd);
+		throw;
+	}
+
+	RecordingHeader h;
+	memcpy(&h, m_data, sizeof(h));
+	if (h.magic != RECORDING_MAGIC || h.version != RECORDING_VERSION) {
+		munmap(const_cast<uint8_t *>(m_data), m_size);
+		close(m_fd);
+		throw std::system_error(EINVAL, std::system_category(),
+		                        "Invalid recording");
+	}
+}
+
+RecordingReader::~RecordingReader()
+{
+	munmap(const_cast<uint8_t *>(m_data), m_size);
+	close(m_fd);
+}
+
+const RecordHeader *RecordingReader::record(size_t offset) const
+{
+	// Ignore records cut short at the end of the file
+	if (offset + sizeof(RecordHeader) > m_size) {
+		return nullptr;
+	}
+	const RecordHeader *h =
+	    reinterpret_cast<const RecordHeader *>(m_data + offset);
+	if (offset + sizeof(RecordHeader) + padded(h->size) > m_size) {
+		return nullptr;
+	}
+	return h;
+}
+
+bool RecordingReader::next(Datagram &datagram)
+{
+	while (const RecordHeader *h = record(m_offset)) {
+		m_offset += sizeof(RecordHeader) + padded(h->size);
+		if (h->type == RECORD_DATAGRAM) {
+			datagram.t_ns = h->t_ns;
+			datagram.address = socket::Address(h->ip[0], h->ip[1], h->ip[2],
+			                                   h->ip[3], h->port);
+			datagram.buf = reinterpret_cast<const uint8_t *>(h + 1);
+			datagram.size = h->size;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RecordingReader::seek(int64_t t_ns)
+{
+	// Follow the chain of index records back to the last one before t_ns
+	RecordingHeader header;
+	memcpy(&header, m_data, sizeof(header));
+	size_t offset = header.index_offset;
+	m_offset = RECORDING_HEADER_SIZE;
+	while (offset >= RECORDING_HEADER_SIZE) {
+		const RecordHeader *h = record(offset);
+		if (!h || h->type != RECORD_INDEX) {
+			break;  // Invalid index; scan the entire file
+		}
+		if (h->t_ns <= t_ns) {
+			m_offset = offset;
+			break;
+		}
+		RecordIndex index;
+		memcpy(&index, h + 1, sizeof(index));
+		if (index.prev_offset >= offset) {
+			break;
+		}
+		offset = index.prev_offset;
+	}
+
+	// Scan forward to the first datagram at or after t_ns
+	while (const RecordHeader *h = record(m_offset)) {
+		if (h->type == RECORD_DATAGRAM && h->t_ns >= t_ns) {
+			break;
+		}
+		m_offset += sizeof(RecordHeader) + padded(h->size);
+	}
+}
+
+}  // namespace ev3_event_broker
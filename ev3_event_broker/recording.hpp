@@ -0,0 +1,173 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file recording.hpp
+ *
+ * Records the raw datagrams received by a client into a file and reads them
+ * back for replay.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Recordings are append-only log files that can be read with mmap(). All
+ * integers are stored in host byte order. The file starts with a 64 byte
+ * header, followed by records starting at multiples of eight bytes:
+ *
+ *   offset  size  header field
+ *        0     4  magic, "EV3R" (0x52335645)
+ *        4     4  version, currently 1
+ *        8     8  offset of the most recent index record, zero if none
+ *
+ *   offset  size  record field
+ *        0     4  payload size in bytes
+ *        4     2  record type, RECORD_DATAGRAM or RECORD_INDEX
+ *        6     2  sender port
+ *        8     4  sender IPv4 address A.B.C.D
+ *       12     4  reserved
+ *       16     8  receive time in ns since the Unix epoch
+ *       24     n  payload, padded to a multiple of eight bytes
+ *
+ * The payload of a datagram record is the datagram as received. An index
+ * record is written before the first datagram received at least
+ * RECORDING_INDEX_INTERVAL_NS after the previous index record and carries the
+ * receive time of that datagram. Index records form a chain that allows a
+ * reader to seek to a point in time without scanning the entire file:
+ *
+ *   offset  size  index record payload
+ *        0     8  offset of the previous index record, zero if none
+ *        8     8  number of datagrams recorded before this record
+ *
+ * The header field pointing at the most recent index record is only updated
+ * once the index record has been written, so a recording cut short by a crash
+ * remains readable up to the last complete record.
+ */
+static constexpr uint32_t RECORDING_MAGIC = 0x52335645;
+static constexpr uint32_t RECORDING_VERSION = 1;
+static constexpr size_t RECORDING_HEADER_SIZE = 64;
+static constexpr int64_t RECORDING_INDEX_INTERVAL_NS = 1000000000;
+
+static constexpr uint16_t RECORD_DATAGRAM = 1;
+static constexpr uint16_t RECORD_INDEX = 2;
+
+struct RecordHeader {
+	uint32_t size;
+	uint16_t type;
+	uint16_t port;
+	uint8_t ip[4];
+	uint32_t reserved;
+	int64_t t_ns;
+};
+
+struct RecordIndex {
+	uint64_t prev_offset;
+	uint64_t n_datagrams;
+};
+
+/**
+ * The Recorder class appends datagrams to a recording. Records are buffered
+ * and written once the buffer is full or an index record is due.
+ */
+class Recorder {
+private:
+	static constexpr size_t BUF_SIZE = 65536;
+
+	int m_fd;
+	uint64_t m_offset;
+	uint64_t m_index_offset;
+	int64_t m_index_t_ns;
+	uint64_t m_n_datagrams;
+	size_t m_ptr;
+	uint8_t m_buf[BUF_SIZE];
+
+	void append(uint16_t type, int64_t t_ns, const socket::Address &address,
+	            const void *payload, size_t size);
+
+public:
+	/**
+	 * Creates a new recording at the given path; an existing file is
+	 * overwritten.
+	 */
+	explicit Recorder(const char *path);
+	~Recorder();
+
+	/**
+	 * Appends a datagram received from the given address at the given time.
+	 */
+	void record(int64_t t_ns, const socket::Address &address,
+	            const uint8_t *buf, size_t size);
+
+	/**
+	 * Writes all buffered records to the file.
+	 */
+	void flush();
+};
+
+/**
+ * The RecordingReader class maps a recording into memory and iterates over
+ * the datagrams it contains.
+ */
+class RecordingReader {
+public:
+	struct Datagram {
+		int64_t t_ns;
+		socket::Address address;
+		const uint8_t *buf;
+		size_t size;
+	};
+
+private:
+	int m_fd;
+	const uint8_t *m_data;
+	size_t m_size;
+	size_t m_offset;
+
+	const RecordHeader *record(size_t offset) const;
+
+public:
+	/**
+	 * Opens the recording at the given path. Throws an exception if the file
+	 * is not a recording.
+	 */
+	explicit RecordingReader(const char *path);
+	~RecordingReader();
+
+	/**
+	 * Reads the next datagram. Returns false at the end of the recording.
+	 */
+	bool next(Datagram &datagram);
+
+	/**
+	 * Positions the reader such that the next datagram is the first one
+	 * received at or after the given time. Uses the index records to skip
+	 * most of the file.
+	 */
+	void seek(int64_t t_ns);
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,128 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/rtt_monitor.hpp>
+
+namespace ev3_event_broker {
+
+RttMonitor::RttMonitor(const SourceDirectory &directory,
+                       const SourceId &source_id)
+    : m_directory(directory), m_source_id(source_id)
+{
+	for (Source &source : m_sources) {
+		source.valid = false;
+	}
+}
+
+RttMonitor::Source *RttMonitor::lookup(const Demarshaller::Header &header)
+{
+	const SourceDirectory::Entry *entry =
+	    m_directory.find(header.source_name);
+	if (!entry) {
+		return nullptr;
+	}
+
+	// Directory entries never move, but may be replaced by a different source
+	// or a restarted instance of the same source; start over in that case
+	Source &source = m_sources[entry - &m_directory[0]];
+	if (!source.valid ||
+	    memcmp(source.header.source_name, entry->name, sizeof(entry->name)) !=
+	        0 ||
+	    memcmp(source.header.source_hash, entry->hash, sizeof(entry->hash)) !=
+	        0) {
+		source.header = header;
+		source.n_sent = 0;
+		source.n_received = 0;
+		source.histogram.reset();
+		source.clock.reset();
+		source.valid = true;
+		source.pingable = false;
+		source.next_nonce = 1;
+		source.last_nonce = 0;
+	}
+	source.address = entry->address;
+	return &source;
+}
+
+void RttMonitor::on_heartbeat(const Demarshaller::Header &header)
+{
+	Source *source = lookup(header);
+	if (source) {
+		source->pingable = true;
+	}
+}
+
+void RttMonitor::reset_pingable()
+{
+	for (Source &source : m_sources) {
+		source.pingable = false;
+	}
+}
+
+bool RttMonitor::on_pong(const Demarshaller::Header &header,
+                         const Demarshaller::Pong &pong, int64_t t_ns)
+{
+	if (memcmp(pong.requester_hash, m_source_id.hash(),
+	           N_SOURCE_HASH_CHARS) != 0) {
+		return false;  // Answer to a ping sent by somebody else
+	}
+	Source *source = lookup(header);
+	if (!source || pong.nonce <= source->last_nonce ||
+	    pong.nonce >= source->next_nonce || t_ns < pong.timestamp) {
+		return false;
+	}
+	const int64_t rtt_us = (t_ns - pong.timestamp) / 1000;
+	source->header = header;
+	source->last_nonce = pong.nonce;
+	source->n_received++;
+	source->histogram.add(uint32_t((rtt_us < UINT32_MAX) ? rtt_us
+	                                                     : UINT32_MAX));
+	source->clock.update(pong.timestamp, pong.receive_time,
+	                     pong.transmit_time, t_ns);
+	return true;
+}
+
+void RttMonitor::ping(
+    const std::function<void(const socket::Address &, uint32_t)> &send)
+{
+	for (size_t i = 0; i < m_directory.size(); i++) {
+		Source &source = m_sources[i];
+		if (source.valid && source.pingable) {
+			source.n_sent++;
+			send(source.address, source.next_nonce++);
+		}
+	}
+}
+
+void RttMonitor::report(const std::function<void(const Source &)> &cback)
+{
+	for (size_t i = 0; i < m_directory.size(); i++) {
+		Source &source = m_sources[i];
+		if (!source.valid || (source.n_sent == 0 && source.n_received == 0)) {
+			continue;
+		}
+		cback(source);
+		source.n_sent = 0;
+		source.n_received = 0;
+		source.histogram.reset();
+	}
+}
+
+}  // namespace ev3_event_broker
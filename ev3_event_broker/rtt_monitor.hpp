@@ -0,0 +1,126 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file rtt_monitor.hpp
+ *
+ * Measures the round trip time to each source using ping messages.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <ev3_event_broker/clock_estimator.hpp>
+#include <ev3_event_broker/latency_histogram.hpp>
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/source_directory.hpp>
+#include <ev3_event_broker/source_id.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The RttMonitor class keeps a histogram of the round trip times of each
+ * source in a SourceDirectory and estimates the offset of the clock of each
+ * source from the timestamps in the pongs. Only sources that sent a
+ * heartbeat, i.e. servers, are pinged. Round trip time statistics are
+ * collected over a reporting window and reset once they have been reported.
+ */
+class RttMonitor {
+public:
+	struct Source {
+		/**
+		 * Header of the most recent pong and address of the source.
+		 */
+		Demarshaller::Header header;
+		socket::Address address;
+
+		/**
+		 * Number of pings sent and pongs received in the current window.
+		 */
+		uint32_t n_sent;
+		uint32_t n_received;
+
+		/**
+		 * Round trip times in microseconds.
+		 */
+		LatencyHistogram histogram;
+
+		/**
+		 * Offset and skew of the source clock relative to the local clock.
+		 */
+		ClockEstimator clock;
+
+		// Internal state
+		bool valid;
+		bool pingable;
+		uint32_t next_nonce;
+		uint32_t last_nonce;
+	};
+
+private:
+	const SourceDirectory &m_directory;
+	const SourceId &m_source_id;
+	Source m_sources[SourceDirectory::MAX_SOURCES];
+
+	Source *lookup(const Demarshaller::Header &header);
+
+public:
+	RttMonitor(const SourceDirectory &directory, const SourceId &source_id);
+
+	/**
+	 * Marks the sender of the heartbeat as a source that answers pings.
+	 */
+	void on_heartbeat(const Demarshaller::Header &header);
+
+	/**
+	 * Stops pinging all sources until their next heartbeat is received, e.g.
+	 * because heartbeats of some sources are no longer passed to this
+	 * instance.
+	 */
+	void reset_pingable();
+
+	/**
+	 * Records the round trip time of the given pong if it answers a ping sent
+	 * by this client. Duplicated and reordered pongs are ignored. Returns true
+	 * if the pong was accepted.
+	 */
+	bool on_pong(const Demarshaller::Header &header,
+	             const Demarshaller::Pong &pong, int64_t t_ns);
+
+	/**
+	 * Calls the given function with the address and a new nonce for each
+	 * source that should be pinged. The timestamp of the ping must be the
+	 * current time of the clock on_pong() is called with.
+	 */
+	void ping(const std::function<void(const socket::Address &, uint32_t)>
+	              &send);
+
+	/**
+	 * Calls the given function for each source that was pinged or answered
+	 * a ping in the current window, then starts a new window.
+	 */
+	void report(const std::function<void(const Source &)> &cback);
+};
+
+}  // namespace ev3_event_broker
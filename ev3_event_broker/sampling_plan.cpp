@@ -0,0 +1,124 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/sampling_plan.hpp>
+
+namespace ev3_event_broker {
+
+static const char *ATTRIBUTE_NAMES[N_TELEMETRY_ATTRIBUTES] = {
+    "position", "speed", "state", "duty_cycle", "sensor"};
+
+SamplingPlan::SamplingPlan() : m_tick(0), m_counter(0)
+{
+	for (size_t i = 0; i < N_TELEMETRY_ATTRIBUTES; i++) {
+		m_periods[i] = 0;
+	}
+	m_periods[TELEMETRY_POSITION] = 10;
+	m_periods[TELEMETRY_SENSOR] = 10;
+	update_schedule();
+}
+
+void SamplingPlan::update_schedule()
+{
+	// The timer interval is the largest interval all periods are a multiple of
+	m_tick = 0;
+	for (size_t i = 0; i < N_TELEMETRY_ATTRIBUTES; i++) {
+		if (m_periods[i] > 0) {
+			m_tick = gcd(m_tick, m_periods[i]);
+		}
+	}
+	for (size_t i = 0; i < N_TELEMETRY_ATTRIBUTES; i++) {
+		m_divisors[i] = (m_periods[i] > 0) ? (m_periods[i] / m_tick) : 0;
+	}
+	if (m_tick == 0) {
+		m_tick = 1000;  // Nothing to sample; keep the timer mostly idle
+	}
+	m_counter = 0;
+}
+
+bool SamplingPlan::parse(const char *spec)
+{
+	int periods[N_TELEMETRY_ATTRIBUTES] = {0};
+	while (*spec) {
+		// Find the attribute name
+		const char *sep = strchr(spec, ':');
+		if (!sep) {
+			return false;
+		}
+		size_t attr = 0;
+		for (; attr < N_TELEMETRY_ATTRIBUTES; attr++) {
+			const size_t len = strlen(ATTRIBUTE_NAMES[attr]);
+			if (size_t(sep - spec) == len &&
+			    strncmp(spec, ATTRIBUTE_NAMES[attr], len) == 0) {
+				break;
+			}
+		}
+		if (attr == N_TELEMETRY_ATTRIBUTES) {
+			return false;
+		}
+
+		// Parse the period
+		char *endptr;
+		const long period = strtol(sep + 1, &endptr, 10);
+		if (endptr == sep + 1 || period <= 0 || period > 3600000 ||
+		    (*endptr != ',' && *endptr != '\0')) {
+			return false;
+		}
+		periods[attr] = int(period);
+		spec = (*endptr == ',') ? (endptr + 1) : endptr;
+	}
+
+	for (size_t i = 0; i < N_TELEMETRY_ATTRIBUTES; i++) {
+		m_periods[i] = periods[i];
+	}
+	update_schedule();
+	return true;
+}
+
+unsigned int SamplingPlan::next()
+{
+	unsigned int mask = 0;
+	for (size_t i = 0; i < N_TELEMETRY_ATTRIBUTES; i++) {
+		if (m_divisors[i] > 0 && (m_counter % m_divisors[i]) == 0) {
+			mask |= (1U << i);
+		}
+	}
+	m_counter++;
+	return mask;
+}
+
+const char *SamplingPlan::attribute_name(uint8_t attribute)
+{
+	return (attribute < N_TELEMETRY_ATTRIBUTES) ? ATTRIBUTE_NAMES[attribute]
+	                                            : "unknown";
+}
+
+int SamplingPlan::gcd(int a, int b)
+{
+	while (b != 0) {
+		const int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+}  // namespace ev3_event_broker
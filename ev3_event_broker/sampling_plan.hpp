@@ -0,0 +1,96 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sampling_plan.hpp
+ *
+ * Describes which device attributes are sampled at which rate.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The SamplingPlan class assigns an independent sampling period to each of the
+ * TELEMETRY_* device attributes. All attributes are scheduled from a single
+ * timer running at the greatest common divisor of the individual periods.
+ */
+class SamplingPlan {
+private:
+	int m_periods[N_TELEMETRY_ATTRIBUTES];
+	int m_divisors[N_TELEMETRY_ATTRIBUTES];
+	int m_tick;
+	uint64_t m_counter;
+
+	void update_schedule();
+
+public:
+	/**
+	 * Creates a sampling plan in which the motor positions and the sensor
+	 * values are sampled every 10ms.
+	 */
+	SamplingPlan();
+
+	/**
+	 * Parses a comma-separated list of ATTRIBUTE:PERIOD pairs, where PERIOD is
+	 * given in milliseconds, e.g. "position:5,state:500". Attributes not
+	 * listed are not sampled. Returns false if the specification is invalid.
+	 */
+	bool parse(const char *spec);
+
+	/**
+	 * Returns the interval of the sampling timer in milliseconds.
+	 */
+	int tick() const { return m_tick; }
+
+	/**
+	 * Returns the sampling period of the given attribute in milliseconds or
+	 * zero if the attribute is not sampled.
+	 */
+	int period(uint8_t attribute) const
+	{
+		return (attribute < N_TELEMETRY_ATTRIBUTES) ? m_periods[attribute] : 0;
+	}
+
+	/**
+	 * Must be called once per timer tick. Returns a bit mask in which bit i
+	 * is set if the attribute i should be sampled in this tick.
+	 */
+	unsigned int next();
+
+	/**
+	 * Returns the name of the given attribute as used in parse().
+	 */
+	static const char *attribute_name(uint8_t attribute);
+
+	/**
+	 * Returns the greatest common divisor of a and b, e.g. to align further
+	 * timers with the sampling timer.
+	 */
+	static int gcd(int a, int b);
+};
+
+}  // namespace ev3_event_broker
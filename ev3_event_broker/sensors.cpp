@@ -0,0 +1,126 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#include <dirent.h>
+
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/sensors.hpp>
+
+#ifndef VIRTUAL_MOTORS
+#include <ev3_event_broker/lego_sensor.hpp>
+#else
+#include <ev3_event_broker/virtual_sensor.hpp>
+#endif
+
+namespace ev3_event_broker {
+
+#ifndef VIRTUAL_MOTORS
+static const char DEFAULT_ROOT_DIR[] = "/sys/class/lego-sensor";
+#else
+static const char DEFAULT_ROOT_DIR[] = "./sensors";
+#endif
+
+Sensors::Sensors(const Clock &clock) : Sensors(DEFAULT_ROOT_DIR, clock) {}
+
+Sensors::Sensors(const char *root_dir, const Clock &clock)
+    : m_root_dir(root_dir), m_clock(clock)
+{
+	std::fill(std::begin(m_sensors_by_handle), std::end(m_sensors_by_handle),
+	          nullptr);
+	rescan();
+}
+
+Sensor *Sensors::add(std::unique_ptr<Sensor> sensor)
+{
+	if (find(sensor->name())) {
+		return nullptr;
+	}
+	DeviceHandle handle = m_device_table.insert(sensor->name());
+	if (handle == INVALID_DEVICE_HANDLE) {
+		return nullptr;  // Too many distinct sensor names
+	}
+	m_sensors_by_handle[handle] = sensor.get();
+	m_sensors.emplace_back(std::move(sensor));
+	return m_sensors.back().get();
+}
+
+Sensor *Sensors::find(const char *name)
+{
+	return get(m_device_table.find(name));
+}
+
+void Sensors::rescan()
+{
+
+	// Remove all sensors from the list that are no longer good
+	m_sensors.erase(
+	    std::remove_if(m_sensors.begin(), m_sensors.end(),
+	                   [this](const std::unique_ptr<Sensor> &sensor) {
+		                   if (sensor->good()) {
+			                   return false;
+		                   }
+		                   DeviceHandle handle =
+		                       m_device_table.find(sensor->name());
+		                   m_sensors_by_handle[handle] = nullptr;
+		                   return true;
+	                   }),
+	    m_sensors.end());
+
+	// Nothing to scan if sensors are added manually
+	if (!m_root_dir) {
+		return;
+	}
+	const char *sensor_root_dir = m_root_dir;
+	const size_t sensor_root_dir_len = strlen(sensor_root_dir);
+	char buf[1024];
+	strncpy(buf, sensor_root_dir, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+
+	// Iterate over the sensor root directory
+	DIR *d;
+	struct dirent *dir;
+	d = opendir(sensor_root_dir);
+	if (d) {
+		while ((dir = readdir(d)) != nullptr) {
+			// For each file, try to create a sensor instance. If this
+			// succeeds, get the sensor name and add it to the list of sensors
+			try {
+				// Create the absolute sensor path
+				snprintf(buf + sensor_root_dir_len,
+				         sizeof(buf) - sensor_root_dir_len, "/%s", dir->d_name);
+
+// Create the sensor instance
+#ifndef VIRTUAL_MOTORS
+				add(std::unique_ptr<Sensor>(new LegoSensor(buf)));
+#else
+				add(std::unique_ptr<Sensor>(new VirtualSensor(buf, m_clock)));
+#endif
+			}
+			catch (std::system_error &) {
+				// Ignore failures at this point
+			}
+		}
+		closedir(d);
+	}
+}
+}  // namespace ev3_event_broker
@@ -0,0 +1,92 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/device_table.hpp>
+#include <ev3_event_broker/sensor.hpp>
+
+namespace ev3_event_broker {
+class Sensors {
+private:
+	const char *m_root_dir;
+	const Clock &m_clock;
+	std::vector<std::unique_ptr<Sensor>> m_sensors;
+	DeviceTable m_device_table;
+	Sensor *m_sensors_by_handle[DeviceTable::MAX_DEVICES];
+
+public:
+	/**
+	 * Creates a sensor list populated from the default sensor directory, i.e.
+	 * /sys/class/lego-sensor or ./sensors if VIRTUAL_MOTORS is defined. Virtual
+	 * sensors read the given clock.
+	 */
+	explicit Sensors(const Clock &clock = Clock::monotonic());
+
+	/**
+	 * Creates a sensor list populated from the given directory. If root_dir
+	 * is nullptr, no directory is scanned and sensors must be added using
+	 * add(). The string must remain valid for the lifetime of the instance.
+	 */
+	explicit Sensors(const char *root_dir,
+	                 const Clock &clock = Clock::monotonic());
+
+	/**
+	 * Removes sensors that are no longer good and adds new sensors found in
+	 * the root directory.
+	 */
+	void rescan();
+
+	/**
+	 * Adds the given sensor to the list. Returns a pointer at the sensor or
+	 * nullptr if a sensor with the same name already exists or there are too
+	 * many sensors.
+	 */
+	Sensor *add(std::unique_ptr<Sensor> sensor);
+
+	const std::vector<std::unique_ptr<Sensor>> &sensors() const
+	{
+		return m_sensors;
+	}
+	std::vector<std::unique_ptr<Sensor>> &sensors() { return m_sensors; }
+
+	/**
+	 * Table mapping sensor names to handles. Handles stay valid when a sensor
+	 * is unplugged and plugged back in.
+	 */
+	const DeviceTable &device_table() const { return m_device_table; }
+
+	Sensor *find(const char *name);
+
+	/**
+	 * Returns the sensor with the given handle or nullptr if the handle is
+	 * invalid or the sensor is currently not connected.
+	 */
+	Sensor *get(DeviceHandle handle)
+	{
+		if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+			return nullptr;
+		}
+		return m_sensors_by_handle[handle];
+	}
+};
+}
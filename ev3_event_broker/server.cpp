@@ -0,0 +1,787 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+
+#include <ev3_event_broker/argparse.hpp>
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/controller.hpp>
+#include <ev3_event_broker/event_loop.hpp>
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/motors.hpp>
+#include <ev3_event_broker/sensors.hpp>
+#include <ev3_event_broker/server.hpp>
+#include <ev3_event_broker/source_id.hpp>
+#include <ev3_event_broker/subscriber_table.hpp>
+#include <ev3_event_broker/trajectory.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static Controller::Gains gains_from_message(
+    const Demarshaller::SetTarget &set_target)
+{
+	return Controller::Gains{set_target.kp * 1e-3, set_target.ki * 1e-3,
+	                         set_target.kd * 1e-3};
+}
+
+/******************************************************************************
+ * Class Listener                                                             *
+ ******************************************************************************/
+
+namespace {
+class Listener : public Demarshaller::Listener {
+private:
+	bool &m_conflict;
+	const Clock &m_clock;
+	SourceId &m_source_id;
+	Marshaller &m_marshaller;
+	Motors &m_motors;
+	Sensors &m_sensors;
+	Controller &m_controller;
+	Trajectories &m_trajectories;
+	VelocityEstimator &m_velocity_estimator;
+	SubscriberTable &m_subscribers;
+	const socket::Address &m_source_address;
+	socket::Address &m_destination;
+
+public:
+	Listener(bool &conflict, const Clock &clock, SourceId &source_id,
+	         Marshaller &marshaller, Motors &motors, Sensors &sensors,
+	         Controller &controller, Trajectories &trajectories,
+	         VelocityEstimator &velocity_estimator,
+	         SubscriberTable &subscribers,
+	         const socket::Address &source_address,
+	         socket::Address &destination)
+	    : m_conflict(conflict),
+	      m_clock(clock),
+	      m_source_id(source_id),
+	      m_marshaller(marshaller),
+	      m_motors(motors),
+	      m_sensors(sensors),
+	      m_controller(controller),
+	      m_trajectories(trajectories),
+	      m_velocity_estimator(velocity_estimator),
+	      m_subscribers(subscribers),
+	      m_source_address(source_address),
+	      m_destination(destination)
+	{
+	}
+
+	/**
+	 * Implementation of the filter() function. Discards messages originating
+	 * from this device.
+	 */
+	bool filter(const Demarshaller::Header &header) override
+	{
+		return !m_source_id.matches(header.source_name, header.source_hash);
+	}
+	void on_set_duty_cycle(
+	    const Demarshaller::Header &,
+	    const Demarshaller::SetDutyCycle &set_duty_cycle) override
+	{
+		// Setting the duty cycle directly overrides the on-brick controller
+		m_trajectories.cancel(set_duty_cycle.device);
+		m_controller.disable(set_duty_cycle.device);
+		try {
+			Motor *motor = m_motors.get(set_duty_cycle.device);
+			if (motor) {
+				motor->set_duty_cycle(set_duty_cycle.duty_cycle);
+			}
+		}
+		catch (std::system_error &) {
+			m_motors.rescan();
+		}
+	}
+
+	void on_set_position_target(
+	    const Demarshaller::Header &,
+	    const Demarshaller::SetTarget &set_target) override
+	{
+		m_trajectories.cancel(set_target.device);
+		m_controller.set_position_target(set_target.device, set_target.target,
+		                                 gains_from_message(set_target));
+	}
+
+	void on_set_velocity_target(
+	    const Demarshaller::Header &,
+	    const Demarshaller::SetTarget &set_target) override
+	{
+		m_trajectories.cancel(set_target.device);
+		m_controller.set_velocity_target(set_target.device, set_target.target,
+		                                 gains_from_message(set_target));
+	}
+
+	void on_trajectory(const Demarshaller::Header &,
+	                   const Demarshaller::Trajectory &trajectory) override
+	{
+		m_trajectories.add(trajectory.device, trajectory.mode,
+		                   trajectory.options, trajectory.points,
+		                   trajectory.n_points, m_clock.now());
+	}
+
+	void on_set_sensor_mode(
+	    const Demarshaller::Header &,
+	    const Demarshaller::SetSensorMode &set_sensor_mode) override
+	{
+		try {
+			Sensor *sensor = m_sensors.find(set_sensor_mode.device_name);
+			if (sensor) {
+				sensor->set_mode(set_sensor_mode.mode);
+			}
+		}
+		catch (std::system_error &) {
+			m_sensors.rescan();
+		}
+	}
+
+	void on_reset(const Demarshaller::Header &) override
+	{
+		m_trajectories.cancel_all();
+		m_controller.disable_all();
+		m_velocity_estimator.reset_all();
+		for (auto &motor : m_motors.motors()) {
+			try {
+				motor->reset();
+			}
+			catch (std::system_error &) {
+				// Do nothing here, just continue resetting
+			}
+		}
+	}
+
+	void on_heartbeat(const Demarshaller::Header &header) override
+	{
+		m_conflict |= m_source_id.matches_name(header.source_name);
+	}
+
+	/**
+	 * Answers pings right away instead of waiting for the next timer tick.
+	 * All timers flush the marshaller, so the pong is sent on its own and
+	 * only to the client that sent the ping.
+	 */
+	void on_ping(const Demarshaller::Header &header,
+	             const Demarshaller::Ping &ping) override
+	{
+		const int64_t receive_time = m_clock.now_ns();
+		const socket::Address destination = m_destination;
+		m_destination = m_source_address;
+		m_marshaller
+		    .write_pong(header.source_hash, ping.nonce, ping.timestamp,
+		                receive_time, m_clock.now_ns())
+		    .flush();
+		m_destination = destination;
+	}
+
+	/**
+	 * Streams are sent to the address the subscription was received from.
+	 */
+	void on_subscribe(const Demarshaller::Header &header,
+	                  const Demarshaller::Subscribe &subscribe) override
+	{
+		m_subscribers.subscribe(m_source_address, header.source_hash,
+		                        subscribe);
+	}
+};
+}  // namespace
+
+/******************************************************************************
+ * Class Server::Config                                                       *
+ ******************************************************************************/
+
+Server::Config::Config()
+    : listen_address(0, 0, 0, 0, 4721),
+      broadcast_address(255, 255, 255, 255, 4721),
+      name("EV3"),
+      controller_period(2),
+      trajectory_period(5),
+      min_stream_period(10)
+{
+}
+
+Argparse &Server::Config::add_args(Argparse &argparse)
+{
+	return argparse
+	    .add_arg("controller-period",
+	             "Update interval of the on-brick motor controller in "
+	             "milliseconds",
+	             "2",
+	             [this](const char *value) -> bool {
+		             char *endptr;
+		             controller_period = strtol(value, &endptr, 10);
+		             return (*endptr == '\0') && (controller_period > 0);
+	             })
+	    .add_arg("trajectory-period",
+	             "Interval in which buffered trajectories are interpolated in "
+	             "milliseconds",
+	             "5",
+	             [this](const char *value) -> bool {
+		             char *endptr;
+		             trajectory_period = strtol(value, &endptr, 10);
+		             return (*endptr == '\0') && (trajectory_period > 0);
+	             })
+	    .add_arg("sample",
+	             "Comma-separated list of device attributes to sample and "
+	             "their sampling period in milliseconds; available "
+	             "attributes are \"position\", \"speed\", \"state\", "
+	             "\"duty_cycle\", and \"sensor\" (all sensor values)",
+	             "position:10,sensor:10",
+	             [this](const char *value) -> bool {
+		             return sampling_plan.parse(value);
+	             })
+	    .add_arg("velocity-filter",
+	             "Filter used to estimate the motor velocities; either "
+	             "\"none\", \"lsq:WINDOW\" (least-squares slope over WINDOW "
+	             "samples), or \"alpha-beta:ALPHA,BETA\"",
+	             "lsq:8",
+	             [this](const char *value) -> bool {
+		             return velocity_config.parse(value);
+	             })
+	    .add_arg("deadband",
+	             "Only report motors that moved by more than DEADBAND "
+	             "degrees since their last report; all motors are reported "
+	             "every KEYFRAME milliseconds. Either \"none\" or "
+	             "\"DEADBAND[:KEYFRAME]\"",
+	             "none",
+	             [this](const char *value) -> bool {
+		             return deadband_config.parse(value);
+	             })
+	    .add_arg("min-stream-period",
+	             "Shortest period in milliseconds at which clients may "
+	             "request their own stream of motor positions and sensor "
+	             "values; the sampling timer runs at least this often",
+	             "10",
+	             [this](const char *value) -> bool {
+		             char *endptr;
+		             min_stream_period = strtol(value, &endptr, 10);
+		             return (*endptr == '\0') && (min_stream_period > 0) &&
+		                    (min_stream_period <= 1000);
+	             })
+	    .add_arg("impair",
+	             "Emulates a lossy link; comma-separated list of "
+	             "\"delay=MS\", \"jitter=MS[:uniform|normal|pareto]\", "
+	             "\"loss=PERCENT\", \"burst=ENTER:EXIT\" (Gilbert-Elliott "
+	             "loss bursts, in percent), \"dup=PERCENT\", "
+	             "\"reorder=PERCENT\", \"rate=KBIT\", \"limit=PACKETS\" "
+	             "and \"seed=N\", or \"none\"",
+	             "none",
+	             [this](const char *value) -> bool {
+		             return impairment.parse(value);
+	             });
+}
+
+/******************************************************************************
+ * Class Server::Impl                                                         *
+ ******************************************************************************/
+
+class Server::Impl {
+private:
+	/**
+	 * Most recent sample of a motor; shared by the broadcast and all streams.
+	 */
+	struct MotorSample {
+		bool valid;
+		int32_t position;
+		double velocity;
+	};
+
+	/**
+	 * Most recent sample of a sensor.
+	 */
+	struct SensorSample {
+		bool valid;
+		uint8_t decimals;
+		uint8_t n_values;
+		int32_t values[SENSOR_MAX_VALUES];
+	};
+
+	Config m_config;
+	const Clock &m_clock;
+	Motors &m_motors;
+	Sensors &m_sensors;
+	socket::UDP m_sock;
+	SourceId m_source_id;
+	Controller m_controller;
+	Trajectories m_trajectories;
+	VelocityEstimator m_velocity_estimator;
+	DeadbandFilter m_deadband_filter;
+	int m_tick;
+	int m_plan_divisor;
+	uint64_t m_n_ticks;
+	SubscriberTable m_subscribers;
+	MotorSample m_motor_samples[DeviceTable::MAX_DEVICES];
+	SensorSample m_sensor_samples[DeviceTable::MAX_DEVICES];
+	socket::Address m_destination;
+	socket::Address m_source_address;
+	Marshaller m_marshaller;
+	Demarshaller m_demarshaller;
+	bool m_conflict;
+	bool m_failed;
+	Listener m_listener;
+	bool m_sensor_broadcast_enabled;
+	int m_n_heartbeat;
+	std::unique_ptr<Impairment> m_tx_impairment;
+	std::unique_ptr<Impairment> m_rx_impairment;
+
+	void send(const socket::Address &address, const uint8_t *buf,
+	          size_t buf_size)
+	{
+		socket::Message msg(buf, buf_size);
+		m_sock.send(address, msg);
+	}
+
+public:
+	Impl(const Config &config, Motors &motors, Sensors &sensors,
+	     const Clock &clock)
+	    : m_config(config),
+	      m_clock(clock),
+	      m_motors(motors),
+	      m_sensors(sensors),
+	      m_sock(config.listen_address),
+	      m_source_id(config.name.c_str()),
+	      m_controller(motors),
+	      m_trajectories(motors, m_controller),
+	      m_velocity_estimator(config.velocity_config),
+	      m_deadband_filter(config.deadband_config),
+	      m_tick(SamplingPlan::gcd(config.sampling_plan.tick(),
+	                               config.min_stream_period)),
+	      m_plan_divisor(config.sampling_plan.tick() / m_tick),
+	      m_n_ticks(0),
+	      m_subscribers(m_tick, config.min_stream_period),
+	      m_destination(config.broadcast_address),
+	      m_marshaller(
+	          [this](const uint8_t *buf, size_t buf_size) -> bool {
+		          if (m_tx_impairment) {
+			          m_tx_impairment->push(m_destination, buf, buf_size);
+		          }
+		          else {
+			          send(m_destination, buf, buf_size);
+		          }
+		          return true;
+	          },
+	          m_source_id.name(), m_source_id.hash()),
+	      m_demarshaller(&motors.device_table()),
+	      m_conflict(false),
+	      m_failed(false),
+	      m_listener(m_conflict, clock, m_source_id, m_marshaller, motors,
+	                 sensors, m_controller, m_trajectories,
+	                 m_velocity_estimator, m_subscribers, m_source_address,
+	                 m_destination),
+	      m_sensor_broadcast_enabled(false),
+	      m_n_heartbeat(0)
+	{
+		memset(m_motor_samples, 0, sizeof(m_motor_samples));
+		memset(m_sensor_samples, 0, sizeof(m_sensor_samples));
+
+		// Route all packets through the impairment stage if requested; use
+		// a different random sequence for each direction
+		if (config.impairment.enabled()) {
+			Impairment::Config rx_config = config.impairment;
+			rx_config.seed = ~rx_config.seed;
+			m_tx_impairment.reset(new Impairment(
+			    config.impairment, clock,
+			    [this](const socket::Address &address, const uint8_t *buf,
+			           size_t buf_size) { send(address, buf, buf_size); }));
+			m_rx_impairment.reset(new Impairment(
+			    rx_config, clock,
+			    [this](const socket::Address &address, const uint8_t *buf,
+			           size_t buf_size) {
+				    m_source_address = address;
+				    m_demarshaller.parse(m_listener, buf, buf_size);
+			    }));
+		}
+	}
+
+	const SourceId &source_id() const { return m_source_id; }
+
+	bool failed() const { return m_failed; }
+
+	/**
+	 * Reads the positions of all motors into the sample buffer and updates
+	 * the velocity estimates.
+	 */
+	void sample_motors()
+	{
+		const size_t n_handles = m_motors.device_table().size();
+		for (size_t i = 0; i < n_handles; i++) {
+			m_motor_samples[i].valid = false;
+		}
+		for (size_t i = 0; i < n_handles; i++) {
+			const DeviceHandle handle = DeviceHandle(i);
+			Motor *motor = m_motors.get(handle);
+			if (!motor) {
+				continue;
+			}
+
+			// Timestamp the sample with the middle of the sysfs read
+			MotorSample &s = m_motor_samples[i];
+			const double t0 = m_clock.now();
+			s.position = motor->get_position();
+			const double t1 = m_clock.now();
+			s.velocity = 0.0;
+			if (m_velocity_estimator.enabled()) {
+				s.velocity = m_velocity_estimator.update(
+				    handle, 0.5 * (t0 + t1), s.position);
+			}
+			s.valid = true;
+		}
+	}
+
+	/**
+	 * Reads the values of all sensors into the sample buffer.
+	 */
+	void sample_sensors()
+	{
+		const size_t n_handles = m_sensors.device_table().size();
+		for (size_t i = 0; i < n_handles; i++) {
+			m_sensor_samples[i].valid = false;
+		}
+		for (size_t i = 0; i < n_handles; i++) {
+			Sensor *sensor = m_sensors.get(DeviceHandle(i));
+			if (!sensor) {
+				continue;
+			}
+			SensorSample &s = m_sensor_samples[i];
+			s.decimals = sensor->decimals();
+			s.n_values = sensor->n_values();
+			for (size_t j = 0; j < s.n_values; j++) {
+				s.values[j] = sensor->get_value(j);
+			}
+			s.valid = true;
+		}
+	}
+
+	void write_motor_sample(const char *name, const MotorSample &s)
+	{
+		m_marshaller.write_position_sensor(name, s.position);
+		if (m_velocity_estimator.enabled()) {
+			m_marshaller.write_velocity_sensor(
+			    name, int32_t(std::lround(s.velocity * 1e3)));
+		}
+	}
+
+	void write_sensor_sample(const char *name, const SensorSample &s)
+	{
+		m_marshaller.write_sensor_values(name, s.decimals, s.values,
+		                                 s.n_values);
+	}
+
+	/**
+	 * Broadcasts the attributes selected by the sampling plan. Positions and
+	 * sensor values are taken from the sample buffer.
+	 */
+	void broadcast(unsigned int mask)
+	{
+		if (mask & (1U << TELEMETRY_POSITION)) {
+			m_deadband_filter.begin(m_clock.now());
+		}
+		try {
+			const size_t n_handles = m_motors.device_table().size();
+			for (size_t i = 0; i < n_handles; i++) {
+				const DeviceHandle handle = DeviceHandle(i);
+				Motor *motor = m_motors.get(handle);
+				if (!motor) {
+					continue;
+				}
+
+				const MotorSample &s = m_motor_samples[i];
+				if ((mask & (1U << TELEMETRY_POSITION)) && s.valid &&
+				    m_deadband_filter.update(handle, s.position,
+				                             s.velocity)) {
+					write_motor_sample(motor->name(), s);
+				}
+				if (mask & (1U << TELEMETRY_SPEED)) {
+					m_marshaller.write_telemetry(
+					    motor->name(), TELEMETRY_SPEED, motor->get_speed());
+				}
+				if (mask & (1U << TELEMETRY_STATE)) {
+					m_marshaller.write_telemetry(
+					    motor->name(), TELEMETRY_STATE, motor->get_state());
+				}
+				if (mask & (1U << TELEMETRY_DUTY_CYCLE)) {
+					m_marshaller.write_telemetry(motor->name(),
+					                             TELEMETRY_DUTY_CYCLE,
+					                             motor->get_duty_cycle());
+				}
+			}
+		}
+		catch (std::system_error &e) {
+			m_motors.rescan();
+		}
+
+		if (mask & (1U << TELEMETRY_SENSOR)) {
+			const size_t n_handles = m_sensors.device_table().size();
+			for (size_t i = 0; i < n_handles; i++) {
+				Sensor *sensor = m_sensors.get(DeviceHandle(i));
+				if (sensor && m_sensor_samples[i].valid) {
+					write_sensor_sample(sensor->name(), m_sensor_samples[i]);
+				}
+			}
+		}
+		m_marshaller.flush();
+	}
+
+	/**
+	 * Makes sure the next message of size bytes is sent in a packet starting
+	 * with the stream marker of the given subscriber.
+	 */
+	void begin_stream_message(const SubscriberTable::Subscriber &subscriber,
+	                          size_t size)
+	{
+		m_marshaller.reserve(STREAM_SIZE + size);
+		if (m_marshaller.empty()) {
+			m_marshaller.write_stream(subscriber.hash);
+		}
+	}
+
+	/**
+	 * Sends the requested motor positions, velocities and sensor values from
+	 * the sample buffer to the given subscriber.
+	 */
+	void send_stream(const SubscriberTable::Subscriber &subscriber)
+	{
+		m_destination = subscriber.address;
+		const size_t n_motors = m_motors.device_table().size();
+		for (size_t i = 0; i < n_motors; i++) {
+			Motor *motor = m_motors.get(DeviceHandle(i));
+			if (motor && m_motor_samples[i].valid &&
+			    subscriber.matches(motor->name())) {
+				begin_stream_message(
+				    subscriber, POSITION_SENSOR_SIZE + VELOCITY_SENSOR_SIZE);
+				write_motor_sample(motor->name(), m_motor_samples[i]);
+			}
+		}
+		const size_t n_sensors = m_sensors.device_table().size();
+		for (size_t i = 0; i < n_sensors; i++) {
+			Sensor *sensor = m_sensors.get(DeviceHandle(i));
+			const SensorSample &s = m_sensor_samples[i];
+			if (sensor && s.valid && subscriber.matches(sensor->name())) {
+				begin_stream_message(subscriber,
+				                     SENSOR_VALUES_HEADER_SIZE +
+				                         s.n_values * SENSOR_VALUE_SIZE);
+				write_sensor_sample(sensor->name(), s);
+			}
+		}
+		m_marshaller.flush();
+		m_destination = m_config.broadcast_address;
+	}
+
+	/**
+	 * Samples the motors and sensors and sends them to the broadcast address
+	 * and to all subscribers that are due. Each device is read at most once
+	 * per tick, no matter how many streams it is sent in.
+	 */
+	bool handle_sensor_timer()
+	{
+		if (!m_sensor_broadcast_enabled) {
+			return true;
+		}
+
+		// The sampling plan may run at a multiple of the timer interval
+		unsigned int mask = 0;
+		if (m_n_ticks++ % m_plan_divisor == 0) {
+			mask = m_config.sampling_plan.next();
+		}
+		const bool has_streams = m_subscribers.next();
+		if (!mask && !has_streams) {
+			return true;
+		}
+
+		if (has_streams || (mask & (1U << TELEMETRY_POSITION))) {
+			try {
+				sample_motors();
+			}
+			catch (std::system_error &e) {
+				m_motors.rescan();
+			}
+		}
+		if (has_streams || (mask & (1U << TELEMETRY_SENSOR))) {
+			try {
+				sample_sensors();
+			}
+			catch (std::system_error &e) {
+				m_sensors.rescan();
+			}
+		}
+
+		broadcast(mask);
+		for (size_t i = 0; i < m_subscribers.size(); i++) {
+			if (m_subscribers[i].due) {
+				send_stream(m_subscribers[i]);
+			}
+		}
+		return bool(m_marshaller);
+	}
+
+	/**
+	 * Runs the on-brick closed-loop controller.
+	 */
+	bool handle_controller_timer()
+	{
+		try {
+			m_controller.update(m_clock.now());
+		}
+		catch (std::system_error &e) {
+			m_motors.rescan();
+		}
+		return true;
+	}
+
+	/**
+	 * Plays back buffered trajectories, reports underruns to the clients.
+	 */
+	bool handle_trajectory_timer()
+	{
+		bool has_underrun = false;
+		try {
+			m_trajectories.update(m_clock.now(), [&](DeviceHandle handle) {
+				Motor *motor = m_motors.get(handle);
+				if (motor) {
+					m_marshaller.write_trajectory_underrun(motor->name());
+					has_underrun = true;
+				}
+			});
+		}
+		catch (std::system_error &e) {
+			m_motors.rescan();
+		}
+		if (has_underrun) {
+			m_marshaller.flush();
+		}
+		return bool(m_marshaller);
+	}
+
+	/**
+	 * Rescans available motors and sensors from time to time.
+	 */
+	bool handle_rescan_timer()
+	{
+		m_motors.rescan();
+		m_sensors.rescan();
+		return true;
+	}
+
+	/**
+	 * Sends a regular heartbeat. Stops the event loop if another device with
+	 * the same name was found before the broadcast started.
+	 */
+	bool handle_heartbeat_timer()
+	{
+		m_n_heartbeat++;
+		if (!m_sensor_broadcast_enabled && m_conflict) {
+			fprintf(stderr,
+			        "ERROR: Another device is already active with name "
+			        "\"%s\". Aborting.\n",
+			        m_source_id.name());
+			m_failed = true;
+			return false;
+		}
+		else if (m_n_heartbeat > 4 && !m_conflict) {
+			m_sensor_broadcast_enabled = true;
+		}
+		m_marshaller.write_heartbeat();
+		if (m_config.sampling_plan.period(TELEMETRY_POSITION) > 0) {
+			const DeadbandFilter::Config &config = m_deadband_filter.config();
+			m_marshaller.write_report_mode(config.deadband,
+			                               config.keyframe_period);
+		}
+		m_marshaller.flush();
+		return true;
+	}
+
+	/**
+	 * Handles incoming commands.
+	 */
+	bool handle_sock()
+	{
+		socket::Address addr;
+		socket::Message msg;
+		if (!m_sock.recv(addr, msg)) {
+			return false;  // Socket was closed
+		}
+		if (m_rx_impairment) {
+			m_rx_impairment->push(addr, msg.buf(), msg.size());
+		}
+		else {
+			m_source_address = addr;
+			m_demarshaller.parse(m_listener, msg.buf(), msg.size());
+		}
+		return true;
+	}
+
+	/**
+	 * Releases packets held back by the impairment stage.
+	 */
+	bool handle_impairment_timer()
+	{
+		m_tx_impairment->flush();
+		m_rx_impairment->flush();
+		return true;
+	}
+
+	void register_with(EventLoop &event_loop)
+	{
+		event_loop
+		    .register_timer(m_tick, [this]() { return handle_sensor_timer(); })
+		    .register_timer(m_config.controller_period,
+		                    [this]() { return handle_controller_timer(); })
+		    .register_timer(m_config.trajectory_period,
+		                    [this]() { return handle_trajectory_timer(); })
+		    .register_timer(1000, [this]() { return handle_rescan_timer(); })
+		    .register_timer(250, [this]() { return handle_heartbeat_timer(); })
+		    .register_event(m_sock, [this]() { return handle_sock(); });
+		if (m_tx_impairment) {
+			event_loop.register_timer(
+			    1, [this]() { return handle_impairment_timer(); });
+		}
+	}
+};
+
+/******************************************************************************
+ * Class Server                                                               *
+ ******************************************************************************/
+
+Server::Server(const Config &config, Motors &motors, Sensors &sensors,
+               const Clock &clock)
+    : m_impl(new Impl(config, motors, sensors, clock))
+{
+}
+
+Server::~Server()
+{
+	// Do nothing here, implicitly delete the object
+}
+
+Server &Server::register_with(EventLoop &event_loop)
+{
+	m_impl->register_with(event_loop);
+	return *this;
+}
+
+const SourceId &Server::source_id() const { return m_impl->source_id(); }
+
+bool Server::failed() const { return m_impl->failed(); }
+
+}  // namespace ev3_event_broker
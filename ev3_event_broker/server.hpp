@@ -0,0 +1,127 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file server.hpp
+ *
+ * Contains the Server class implementing the logic of ev3_broker_server.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/deadband_filter.hpp>
+#include <ev3_event_broker/impairment.hpp>
+#include <ev3_event_broker/sampling_plan.hpp>
+#include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/velocity_estimator.hpp>
+
+namespace ev3_event_broker {
+
+class Argparse;
+class EventLoop;
+class Motors;
+class Sensors;
+class SourceId;
+
+/**
+ * The Server class broadcasts the state of a set of motors and sensors,
+ * runs the on-brick controllers and executes incoming commands. All work is
+ * performed in callbacks registered with an EventLoop; multiple servers (e.g.
+ * simulated bricks) may share the same EventLoop.
+ */
+class Server {
+public:
+	struct Config {
+		/**
+		 * Address the server socket is bound to.
+		 */
+		socket::Address listen_address;
+
+		/**
+		 * Address all outgoing messages are sent to.
+		 */
+		socket::Address broadcast_address;
+
+		/**
+		 * Name of this device.
+		 */
+		std::string name;
+
+		int controller_period;
+		int trajectory_period;
+
+		/**
+		 * Shortest period in milliseconds a subscriber may request.
+		 */
+		int min_stream_period;
+
+		VelocityEstimator::Config velocity_config;
+		SamplingPlan sampling_plan;
+		DeadbandFilter::Config deadband_config;
+
+		/**
+		 * Link model applied to all outgoing and incoming packets.
+		 */
+		Impairment::Config impairment;
+
+		Config();
+
+		/**
+		 * Registers the command line arguments controlling the controller,
+		 * trajectory, sampling and impairment settings with the given
+		 * argument parser.
+		 */
+		Argparse &add_args(Argparse &argparse);
+	};
+
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Creates the server socket and all per-device state. The motors, sensors
+	 * and the clock must outlive the server. The clock should be the clock
+	 * of the event loop the server is registered with.
+	 */
+	Server(const Config &config, Motors &motors, Sensors &sensors,
+	       const Clock &clock = Clock::monotonic());
+
+	~Server();
+
+	/**
+	 * Registers the timers and the server socket with the given event loop.
+	 */
+	Server &register_with(EventLoop &event_loop);
+
+	const SourceId &source_id() const;
+
+	/**
+	 * Returns true if the server stopped the event loop because another
+	 * device with the same name is active on the network.
+	 */
+	bool failed() const;
+};
+
+}  // namespace ev3_event_broker
@@ -26,6 +26,7 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <ev3_event_broker/error.hpp>
@@ -88,14 +89,33 @@ UDP::UDP(Address addr) : m_addr(addr), m_sockfd(-1)
 	         sizeof(serveraddr)));
 }
 
-bool UDP::recv(Address &addr, Message &msg)
+void UDP::enable_timestamps()
+{
+	int optval = 1;
+	err(setsockopt(m_sockfd, SOL_SOCKET, SO_TIMESTAMPNS,
+	               static_cast<const void *>(&optval), sizeof(optval)));
+}
+
+bool UDP::receive(Address &addr, Message &msg, int64_t *t_ns)
 {
 	while (true) {
 		struct sockaddr_in clientaddr;
-		socklen_t addrlen = sizeof(clientaddr);
-		ssize_t count = recvfrom(
-		    m_sockfd, &m_buf, BUF_SIZE, 0,
-		    reinterpret_cast<struct sockaddr *>(&clientaddr), &addrlen);
+		struct iovec iov = {m_buf, BUF_SIZE};
+		union {
+			struct cmsghdr align;
+			uint8_t buf[CMSG_SPACE(sizeof(struct timespec))];
+		} control;
+		struct msghdr hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &clientaddr;
+		hdr.msg_namelen = sizeof(clientaddr);
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		if (t_ns) {
+			hdr.msg_control = control.buf;
+			hdr.msg_controllen = sizeof(control.buf);
+		}
+		ssize_t count = recvmsg(m_sockfd, &hdr, 0);
 		if (count == 0) {
 			return false;  // Socket has been shut down
 		}
@@ -108,11 +128,34 @@ bool UDP::recv(Address &addr, Message &msg)
 		else {
 			msg = Message(m_buf, count);
 			addr = addr_from_sockaddr(&clientaddr);
+			if (t_ns) {
+				// Use the kernel timestamp if there is one
+				struct timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+				     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+					if (cmsg->cmsg_level == SOL_SOCKET &&
+					    cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+						memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+					}
+				}
+				*t_ns = int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+			}
 			return true;
 		}
 	}
 }
 
+bool UDP::recv(Address &addr, Message &msg)
+{
+	return receive(addr, msg, nullptr);
+}
+
+bool UDP::recv(Address &addr, Message &msg, int64_t &t_ns)
+{
+	return receive(addr, msg, &t_ns);
+}
+
 bool UDP::send(const Address &addr, const Message &msg)
 {
 	while (true) {
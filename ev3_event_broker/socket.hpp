@@ -52,6 +52,13 @@ struct Address {
 	    : a(a), b(b), c(c), d(d), port(port)
 	{
 	}
+
+	bool operator==(const Address &o) const
+	{
+		return a == o.a && b == o.b && c == o.c && d == o.d && port == o.port;
+	}
+
+	bool operator!=(const Address &o) const { return !(*this == o); }
 };
 
 class UDP {
@@ -62,12 +69,26 @@ private:
 	int m_sockfd;
 	uint8_t m_buf[BUF_SIZE];
 
+	bool receive(Address &addr, Message &msg, int64_t *t_ns);
+
 public:
 	UDP(Address addr);
 	~UDP();
 
 	bool recv(Address &addr, Message &msg);
 
+	/**
+	 * Like recv(), but also returns the time at which the datagram was
+	 * received in nanoseconds since the Unix epoch. This is the kernel receive
+	 * timestamp if enable_timestamps() was called, the current time otherwise.
+	 */
+	bool recv(Address &addr, Message &msg, int64_t &t_ns);
+
+	/**
+	 * Instructs the kernel to timestamp all incoming datagrams.
+	 */
+	void enable_timestamps();
+
 	bool send(const Address &addr, const Message &msg);
 
 	int fd() const { return m_sockfd; }
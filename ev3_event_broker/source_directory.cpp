@@ -0,0 +1,81 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/source_directory.hpp>
+
+namespace ev3_event_broker {
+
+SourceDirectory::SourceDirectory() : m_n_entries(0) {}
+
+bool SourceDirectory::update(const Demarshaller::Header &header,
+                             const socket::Address &address, int64_t t_ns)
+{
+	// Search for the source; remember the least recently seen entry in case
+	// the directory is full
+	size_t i = 0, oldest = 0;
+	for (; i < m_n_entries; i++) {
+		if (memcmp(m_entries[i].name, header.source_name,
+		           sizeof(m_entries[i].name)) == 0) {
+			break;
+		}
+		if (m_entries[i].last_seen_ns < m_entries[oldest].last_seen_ns) {
+			oldest = i;
+		}
+	}
+
+	Entry &entry = m_entries[(i < MAX_SOURCES) ? i : oldest];
+	bool changed = true;
+	if (i < m_n_entries) {
+		changed = memcmp(entry.hash, header.source_hash,
+		                 sizeof(entry.hash)) != 0 ||
+		          entry.address != address;
+	}
+	else if (i < MAX_SOURCES) {
+		m_n_entries++;
+	}
+	memcpy(entry.name, header.source_name, sizeof(entry.name));
+	memcpy(entry.hash, header.source_hash, sizeof(entry.hash));
+	entry.address = address;
+	entry.last_seen_ns = t_ns;
+	return changed;
+}
+
+const SourceDirectory::Entry *SourceDirectory::find(const char *name) const
+{
+	for (size_t i = 0; i < m_n_entries; i++) {
+		if (strncmp(m_entries[i].name, name, N_SOURCE_NAME_CHARS) == 0) {
+			return &m_entries[i];
+		}
+	}
+	return nullptr;
+}
+
+const SourceDirectory::Entry *SourceDirectory::find(
+    const socket::Address &address) const
+{
+	for (size_t i = 0; i < m_n_entries; i++) {
+		if (m_entries[i].address == address) {
+			return &m_entries[i];
+		}
+	}
+	return nullptr;
+}
+
+}  // namespace ev3_event_broker
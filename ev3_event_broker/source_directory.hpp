@@ -0,0 +1,91 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file source_directory.hpp
+ *
+ * Keeps track of the network address of all sources seen by a client.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The SourceDirectory class maps source names to the address, hash and
+ * last-seen time of the corresponding source. It is updated from the header of
+ * every received datagram, so a source that restarts with a new hash or
+ * address is re-learned automatically. This allows commands to address a
+ * source by name only.
+ */
+class SourceDirectory {
+public:
+	/**
+	 * Maximum number of sources. If the directory is full, the source that
+	 * has not been seen for the longest time is replaced.
+	 */
+	static constexpr size_t MAX_SOURCES = 64;
+
+	struct Entry {
+		char name[N_SOURCE_NAME_CHARS + 1];
+		char hash[N_SOURCE_HASH_CHARS + 1];
+		socket::Address address;
+		int64_t last_seen_ns;
+	};
+
+private:
+	Entry m_entries[MAX_SOURCES];
+	size_t m_n_entries;
+
+public:
+	SourceDirectory();
+
+	/**
+	 * Records that a datagram with the given header was received from the
+	 * given address at time t_ns. Returns true if the source is new or if its
+	 * hash or address changed.
+	 */
+	bool update(const Demarshaller::Header &header,
+	            const socket::Address &address, int64_t t_ns);
+
+	/**
+	 * Returns the entry of the source with the given name or nullptr if the
+	 * source is unknown. Names longer than N_SOURCE_NAME_CHARS are truncated.
+	 */
+	const Entry *find(const char *name) const;
+
+	/**
+	 * Returns the entry of the source with the given address or nullptr if
+	 * no source with this address is known.
+	 */
+	const Entry *find(const socket::Address &address) const;
+
+	size_t size() const { return m_n_entries; }
+
+	const Entry &operator[](size_t i) const { return m_entries[i]; }
+};
+
+}  // namespace ev3_event_broker
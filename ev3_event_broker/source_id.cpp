@@ -17,6 +17,7 @@
  */
 
 #include <cstddef>
+#include <cstring>
 #include <random>
 
 #include <ev3_event_broker/source_id.hpp>
@@ -37,7 +38,11 @@ static void generate_random_string(char *tar, size_t n) {
 	tar[n] = 0;
 }
 
-SourceId::SourceId(const char *name) : m_name(name) {
+SourceId::SourceId(const char *name) {
+	// Store the name zero-padded, so it can be compared to received message
+	// headers without scanning for the terminating zero
+	memset(m_name, 0, sizeof(m_name));
+	strncpy(m_name, name, sizeof(m_name) - 1);
 	generate_random_string(m_hash, sizeof(m_hash) - 1);
 }
 
@@ -18,11 +18,13 @@
 
 #pragma once
 
+#include <cstring>
+
 namespace ev3_event_broker {
 
 class SourceId {
 private:
-	const char *m_name;
+	char m_name[17];
 	char m_hash[9];
 
 public:
@@ -30,6 +32,26 @@ public:
 
 	const char *name() const { return m_name; }
 	const char *hash() const { return m_hash; }
+
+	/**
+	 * Returns true if the given name refers to this source. The name must be
+	 * stored in a zero-padded buffer of at least 17 bytes, such as the
+	 * source_name field in Demarshaller::Header.
+	 */
+	bool matches_name(const char *name) const
+	{
+		return memcmp(m_name, name, sizeof(m_name)) == 0;
+	}
+
+	/**
+	 * Returns true if the given name and hash refer to this source. Both must
+	 * be stored in zero-padded buffers of at least 17 and 9 bytes,
+	 * respectively.
+	 */
+	bool matches(const char *name, const char *hash) const
+	{
+		return matches_name(name) && memcmp(m_hash, hash, sizeof(m_hash)) == 0;
+	}
 };
 
 }
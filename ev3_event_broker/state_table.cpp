@@ -0,0 +1,184 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ev3_event_broker/error.hpp>
+#include <ev3_event_broker/state_table.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+static void copy_chars(char *tar, const char *str, size_t n)
+{
+	// Fixed-width field, zero-padded but not necessarily zero-terminated
+	const size_t len = strnlen(str, n);
+	memcpy(tar, str, len);
+	memset(tar + len, 0, n - len);
+}
+
+static uint32_t fnv1a(uint32_t h, const char *str, size_t n)
+{
+	for (size_t i = 0; i < n && str[i]; i++) {
+		h = (h ^ uint8_t(str[i])) * 0x01000193U;
+	}
+	return (h ^ 0xFF) * 0x01000193U;  // Separator between fields
+}
+
+/******************************************************************************
+ * Class StateTable                                                           *
+ ******************************************************************************/
+
+StateTable::StateTable(const char *path, size_t n_slots)
+    : m_fd(-1),
+      m_size(HEADER_SIZE + n_slots * SLOT_SIZE),
+      m_header(nullptr),
+      m_slots(nullptr),
+      m_n_slots(n_slots),
+      m_index(2 * n_slots, 0)
+{
+	m_fd = err(open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+	try {
+		err(ftruncate(m_fd, m_size));
+		void *mem =
+		    mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (mem == MAP_FAILED) {
+			throw std::system_error(errno, std::system_category());
+		}
+		m_header = static_cast<Header *>(mem);
+		m_slots = reinterpret_cast<Slot *>(static_cast<uint8_t *>(mem) +
+		                                   HEADER_SIZE);
+	}
+	catch (...) {
+		close(m_fd);
+		throw;
+	}
+
+	// The file is zero-filled by ftruncate(); publish the magic number last
+	m_header->version = VERSION;
+	m_header->n_slots = m_n_slots;
+	m_header->slot_size = SLOT_SIZE;
+	__atomic_store_n(&m_header->magic, MAGIC, __ATOMIC_RELEASE);
+}
+
+StateTable::~StateTable()
+{
+	munmap(m_header, m_size);
+	close(m_fd);
+}
+
+StateTable::Slot *StateTable::slot(const Demarshaller::Header &header,
+                                   const char *device_name)
+{
+	uint32_t h = fnv1a(0x811C9DC5U, header.source_name, N_SOURCE_NAME_CHARS);
+	h = fnv1a(h, header.source_hash, N_SOURCE_HASH_CHARS);
+	h = fnv1a(h, device_name, N_DEVICE_NAME_CHARS);
+
+	const size_t n_index = m_index.size();
+	for (size_t i = h % n_index;; i = (i + 1) % n_index) {
+		if (m_index[i] == 0) {
+			const uint32_t n_used = m_header->n_used;
+			if (n_used == m_n_slots) {
+				return nullptr;
+			}
+
+			// Initialise the new slot before making it visible to readers
+			Slot &s = m_slots[n_used];
+			copy_chars(s.source_name, header.source_name, N_SOURCE_NAME_CHARS);
+			copy_chars(s.source_hash, header.source_hash, N_SOURCE_HASH_CHARS);
+			copy_chars(s.device_name, device_name, N_DEVICE_NAME_CHARS);
+			__atomic_store_n(&m_header->n_used, n_used + 1, __ATOMIC_RELEASE);
+			m_index[i] = n_used + 1;
+			return &s;
+		}
+
+		Slot &s = m_slots[m_index[i] - 1];
+		if (strncmp(s.source_name, header.source_name, N_SOURCE_NAME_CHARS) ==
+		        0 &&
+		    strncmp(s.source_hash, header.source_hash, N_SOURCE_HASH_CHARS) ==
+		        0 &&
+		    strncmp(s.device_name, device_name, N_DEVICE_NAME_CHARS) == 0) {
+			return &s;
+		}
+	}
+}
+
+void StateTable::begin_write(Slot &slot)
+{
+	// Make the counter odd before any of the data is modified
+	__atomic_store_n(&slot.lock, slot.lock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void StateTable::end_write(Slot &slot, const Demarshaller::Header &header,
+                           int64_t t_ns)
+{
+	slot.sequence = header.sequence;
+	slot.t_ns = t_ns;
+	__atomic_store_n(&slot.lock, slot.lock + 1, __ATOMIC_RELEASE);
+}
+
+void StateTable::position(const Demarshaller::Header &header,
+                          const char *device_name, int32_t position,
+                          int64_t t_ns)
+{
+	Slot *s = slot(header, device_name);
+	if (s) {
+		begin_write(*s);
+		s->position = position;
+		end_write(*s, header, t_ns);
+	}
+}
+
+void StateTable::velocity(const Demarshaller::Header &header,
+                          const char *device_name, int32_t velocity,
+                          int64_t t_ns)
+{
+	Slot *s = slot(header, device_name);
+	if (s) {
+		begin_write(*s);
+		s->velocity = velocity;
+		end_write(*s, header, t_ns);
+	}
+}
+
+void StateTable::sensor(const Demarshaller::Header &header,
+                        const char *device_name, uint8_t decimals,
+                        const int32_t *values, size_t n_values, int64_t t_ns)
+{
+	Slot *s = slot(header, device_name);
+	if (s) {
+		begin_write(*s);
+		s->decimals = decimals;
+		s->n_values = uint8_t(n_values);
+		for (size_t i = 0; i < SENSOR_MAX_VALUES; i++) {
+			s->values[i] = (i < n_values) ? values[i] : 0;
+		}
+		end_write(*s, header, t_ns);
+	}
+}
+
+}  // namespace ev3_event_broker
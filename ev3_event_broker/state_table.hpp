@@ -0,0 +1,157 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file state_table.hpp
+ *
+ * Publishes the latest state of each remote device in a memory-mapped file
+ * that other processes can read without any IPC round trip.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The StateTable class maintains a fixed-layout table mapping (source, device)
+ * pairs onto the most recently received position, velocity and sensor values.
+ * The table lives in a file mapped with MAP_SHARED; placing the file in
+ * /dev/shm makes it a POSIX shared memory segment.
+ *
+ * All integers are stored in host byte order. The file starts with a 64 byte
+ * header, followed by the slots:
+ *
+ *   offset  size  header field
+ *        0     4  magic, "EV3S" (0x53335645)
+ *        4     4  version, currently 1
+ *        8     4  number of slots
+ *       12     4  size of a slot in bytes
+ *       16     4  number of slots in use
+ *
+ *   offset  size  slot field
+ *        0     4  seqlock counter; odd while the slot is being written
+ *        4     4  sequence number of the last update
+ *        8     8  CLOCK_MONOTONIC receive time of the last update in ns
+ *       16    16  source name
+ *       32     8  source hash
+ *       40    16  device name
+ *       56     4  position in degrees
+ *       60     4  velocity in thousandths of degrees per second
+ *       64     1  number of decimals of the sensor values
+ *       65     1  number of sensor values
+ *       68    32  sensor values
+ *
+ * Slots are never reused or moved. A slot is completely initialised before
+ * the number of slots in use is incremented, so readers may treat this number
+ * as an index of the valid slots. To read a consistent snapshot of a slot,
+ * readers load the seqlock counter, copy the slot and load the counter
+ * again; the copy is valid if both counter values are equal and even.
+ */
+class StateTable {
+public:
+	static constexpr uint32_t MAGIC = 0x53335645;
+	static constexpr uint32_t VERSION = 1;
+	static constexpr size_t HEADER_SIZE = 64;
+	static constexpr size_t SLOT_SIZE = 128;
+
+	/**
+	 * Number of slots used by ev3_broker_client.
+	 */
+	static constexpr size_t DEFAULT_N_SLOTS = 256;
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t n_slots;
+		uint32_t slot_size;
+		uint32_t n_used;
+		uint8_t reserved[HEADER_SIZE - 20];
+	};
+
+	struct Slot {
+		uint32_t lock;
+		uint32_t sequence;
+		int64_t t_ns;
+		char source_name[N_SOURCE_NAME_CHARS];
+		char source_hash[N_SOURCE_HASH_CHARS];
+		char device_name[N_DEVICE_NAME_CHARS];
+		int32_t position;
+		int32_t velocity;
+		uint8_t decimals;
+		uint8_t n_values;
+		uint16_t reserved0;
+		int32_t values[SENSOR_MAX_VALUES];
+		uint8_t reserved1[SLOT_SIZE - 100];
+	};
+
+	static_assert(sizeof(Header) == HEADER_SIZE, "Unexpected header size");
+	static_assert(sizeof(Slot) == SLOT_SIZE, "Unexpected slot size");
+
+	int m_fd;
+	size_t m_size;
+	Header *m_header;
+	Slot *m_slots;
+	size_t m_n_slots;
+
+	// Private open-addressing hash table mapping (source, device) onto slot
+	// indices plus one; zero marks an empty entry
+	std::vector<uint32_t> m_index;
+
+	Slot *slot(const Demarshaller::Header &header, const char *device_name);
+	static void begin_write(Slot &slot);
+	static void end_write(Slot &slot, const Demarshaller::Header &header,
+	                      int64_t t_ns);
+
+public:
+	/**
+	 * Creates or truncates the file at the given path and maps a table with
+	 * the given number of slots into memory. Throws a std::system_error if
+	 * the file cannot be created or mapped.
+	 */
+	StateTable(const char *path, size_t n_slots);
+	~StateTable();
+
+	StateTable(const StateTable &) = delete;
+	StateTable &operator=(const StateTable &) = delete;
+
+	/**
+	 * The following functions update the slot of the given device, creating
+	 * it if necessary. Updates for new devices are silently dropped once all
+	 * slots are in use.
+	 */
+	void position(const Demarshaller::Header &header, const char *device_name,
+	              int32_t position, int64_t t_ns);
+
+	void velocity(const Demarshaller::Header &header, const char *device_name,
+	              int32_t velocity, int64_t t_ns);
+
+	void sensor(const Demarshaller::Header &header, const char *device_name,
+	            uint8_t decimals, const int32_t *values, size_t n_values,
+	            int64_t t_ns);
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,112 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include <ev3_event_broker/subscriber_table.hpp>
+#include <ev3_event_broker/subscription.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Struct SubscriberTable::Subscriber                                         *
+ ******************************************************************************/
+
+bool SubscriberTable::Subscriber::matches(const char *device_name) const
+{
+	if (n_patterns == 0) {
+		return true;
+	}
+	for (size_t i = 0; i < n_patterns; i++) {
+		if (Subscription::glob(patterns[i], device_name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/******************************************************************************
+ * Class SubscriberTable                                                      *
+ ******************************************************************************/
+
+SubscriberTable::SubscriberTable(int tick, int min_period)
+    : m_tick(tick), m_min_period(min_period), m_counter(0), m_n_subscribers(0)
+{
+}
+
+void SubscriberTable::subscribe(const socket::Address &address,
+                                const char *hash,
+                                const Demarshaller::Subscribe &subscribe)
+{
+	// Look for an existing subscription of this source
+	size_t i = 0;
+	for (; i < m_n_subscribers; i++) {
+		if (m_subscribers[i].address == address &&
+		    strcmp(m_subscribers[i].hash, hash) == 0) {
+			break;
+		}
+	}
+
+	// Cancel the subscription by moving the last entry into its place
+	if (subscribe.period == 0) {
+		if (i < m_n_subscribers) {
+			m_subscribers[i] = m_subscribers[--m_n_subscribers];
+		}
+		return;
+	}
+
+	Subscriber &s = m_subscribers[i];
+	if (i == m_n_subscribers) {
+		if (m_n_subscribers == MAX_SUBSCRIBERS) {
+			return;
+		}
+		m_n_subscribers++;
+		s.address = address;
+		memcpy(s.hash, hash, sizeof(s.hash));
+		s.next_tick = m_counter;
+		s.due = false;
+	}
+	s.period = std::max<uint64_t>(
+	    1, ticks(std::max<uint64_t>(subscribe.period, m_min_period)));
+	s.expires = m_counter + ticks(TIMEOUT);
+	s.n_patterns = subscribe.n_patterns;
+	memcpy(s.patterns, subscribe.patterns, sizeof(s.patterns));
+}
+
+bool SubscriberTable::next()
+{
+	bool any_due = false;
+	for (size_t i = 0; i < m_n_subscribers;) {
+		Subscriber &s = m_subscribers[i];
+		if (m_counter >= s.expires) {
+			s = m_subscribers[--m_n_subscribers];
+			continue;
+		}
+		s.due = m_counter >= s.next_tick;
+		if (s.due) {
+			// Skip missed ticks instead of sending a burst
+			s.next_tick = std::max(s.next_tick + s.period, m_counter + 1);
+			any_due = true;
+		}
+		i++;
+	}
+	m_counter++;
+	return any_due;
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,108 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file subscriber_table.hpp
+ *
+ * Keeps track of the clients that requested their own telemetry stream.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/socket.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The SubscriberTable class holds the subscriptions received from clients
+ * and decides in which ticks of the sampling timer each subscriber is due.
+ * Requested periods are rounded to a multiple of the timer interval.
+ * Subscriptions that are not renewed within TIMEOUT milliseconds are removed,
+ * such that clients disappearing from the network do not leave streams
+ * behind.
+ */
+class SubscriberTable {
+public:
+	/**
+	 * Maximum number of subscribers; further subscriptions are ignored.
+	 */
+	static constexpr size_t MAX_SUBSCRIBERS = 16;
+
+	/**
+	 * Time in milliseconds after which a subscription that was not renewed
+	 * expires.
+	 */
+	static constexpr int TIMEOUT = 2000;
+
+	struct Subscriber {
+		socket::Address address;
+		char hash[N_SOURCE_HASH_CHARS + 1];
+		uint64_t period;  // in ticks
+		uint64_t next_tick;
+		uint64_t expires;  // in ticks
+		bool due;
+		size_t n_patterns;
+		char patterns[SUBSCRIBE_MAX_PATTERNS][N_DEVICE_NAME_CHARS + 1];
+
+		/**
+		 * Returns true if the subscriber requested the given device.
+		 */
+		bool matches(const char *device_name) const;
+	};
+
+private:
+	int m_tick;
+	int m_min_period;
+	uint64_t m_counter;
+	Subscriber m_subscribers[MAX_SUBSCRIBERS];
+	size_t m_n_subscribers;
+
+	uint64_t ticks(uint64_t ms) const { return (ms + m_tick - 1) / m_tick; }
+
+public:
+	/**
+	 * Creates an empty table for a timer with the given interval in
+	 * milliseconds. Subscribers are served at most every min_period
+	 * milliseconds.
+	 */
+	SubscriberTable(int tick, int min_period);
+
+	/**
+	 * Adds, renews or, if the period is zero, removes the subscription of the
+	 * source with the given hash and address.
+	 */
+	void subscribe(const socket::Address &address, const char *hash,
+	               const Demarshaller::Subscribe &subscribe);
+
+	/**
+	 * Must be called once per timer tick. Removes expired subscriptions and
+	 * returns true if at least one subscriber is due in this tick.
+	 */
+	bool next();
+
+	size_t size() const { return m_n_subscribers; }
+
+	const Subscriber &operator[](size_t i) const { return m_subscribers[i]; }
+};
+
+}  // namespace ev3_event_broker
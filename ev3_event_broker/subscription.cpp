@@ -0,0 +1,219 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <ev3_event_broker/subscription.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Helper functions                                                           *
+ ******************************************************************************/
+
+/**
+ * Copies the characters between str and end into the given buffer. Empty
+ * components are replaced by "*". Returns false if the component is too long.
+ */
+static bool copy_component(char *tar, size_t n, const char *str,
+                           const char *end)
+{
+	if (str == end) {
+		strcpy(tar, "*");
+		return true;
+	}
+	if (size_t(end - str) > n) {
+		return false;
+	}
+	memcpy(tar, str, end - str);
+	tar[end - str] = '\0';
+	return true;
+}
+
+static size_t cache_slot(const char *name, const char *hash, size_t n)
+{
+	uint32_t h = 0x811C9DC5U;
+	for (; *name; name++) {
+		h = (h ^ uint8_t(*name)) * 0x01000193U;
+	}
+	for (; *hash; hash++) {
+		h = (h ^ uint8_t(*hash)) * 0x01000193U;
+	}
+	return h & (n - 1);
+}
+
+/******************************************************************************
+ * Class Subscription                                                         *
+ ******************************************************************************/
+
+/**
+ * Backtracks to the most recent "*" only, which suffices for this kind of
+ * pattern and keeps the run time linear in practice.
+ */
+bool Subscription::glob(const char *pattern, const char *str)
+{
+	const char *star = nullptr, *star_str = nullptr;
+	while (*str) {
+		if (*pattern == '*') {
+			star = pattern++;
+			star_str = str;
+		}
+		else if (*pattern == '?' || *pattern == *str) {
+			pattern++;
+			str++;
+		}
+		else if (star) {
+			pattern = star + 1;
+			str = ++star_str;
+		}
+		else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		pattern++;
+	}
+	return *pattern == '\0';
+}
+
+Subscription::Subscription() : m_n_patterns(0), m_any_device(0)
+{
+	clear_cache();
+}
+
+void Subscription::clear_cache()
+{
+	for (size_t i = 0; i < CACHE_SIZE; i++) {
+		m_cache[i].valid = false;
+	}
+}
+
+void Subscription::clear()
+{
+	m_n_patterns = 0;
+	m_any_device = 0;
+	clear_cache();
+}
+
+bool Subscription::add(const char *patterns)
+{
+	size_t n_patterns = m_n_patterns;
+	Mask any_device = m_any_device;
+	while (*patterns) {
+		if (n_patterns == MAX_PATTERNS) {
+			return false;
+		}
+
+		// Split the pattern into its components
+		const char *end = strchr(patterns, ',');
+		if (!end) {
+			end = patterns + strlen(patterns);
+		}
+		const char *slash = static_cast<const char *>(
+		    memchr(patterns, '/', end - patterns));
+		const char *source_end = slash ? slash : end;
+		const char *colon = static_cast<const char *>(
+		    memchr(patterns, ':', source_end - patterns));
+
+		Pattern &p = m_patterns[n_patterns];
+		if (!copy_component(p.source_name, N_SOURCE_NAME_CHARS, patterns,
+		                    colon ? colon : source_end) ||
+		    !copy_component(p.source_hash, N_SOURCE_HASH_CHARS,
+		                    colon ? colon + 1 : source_end, source_end) ||
+		    !copy_component(p.device_name, N_DEVICE_NAME_CHARS,
+		                    slash ? slash + 1 : end, end)) {
+			return false;
+		}
+		if (strcmp(p.device_name, "*") == 0) {
+			any_device |= Mask(1) << n_patterns;
+		}
+		n_patterns++;
+		patterns = (*end == ',') ? (end + 1) : end;
+	}
+
+	m_n_patterns = n_patterns;
+	m_any_device = any_device;
+	clear_cache();
+	return true;
+}
+
+Subscription::Mask Subscription::match_source(
+    const Demarshaller::Header &header)
+{
+	if (m_n_patterns == 0) {
+		return ~Mask(0);
+	}
+
+	CacheEntry &e = m_cache[cache_slot(header.source_name, header.source_hash,
+	                                   CACHE_SIZE)];
+	if (e.valid &&
+	    memcmp(e.source_name, header.source_name, sizeof(e.source_name)) ==
+	        0 &&
+	    memcmp(e.source_hash, header.source_hash, sizeof(e.source_hash)) ==
+	        0) {
+		return e.mask;
+	}
+
+	Mask mask = 0;
+	for (size_t i = 0; i < m_n_patterns; i++) {
+		if (glob(m_patterns[i].source_name, header.source_name) &&
+		    glob(m_patterns[i].source_hash, header.source_hash)) {
+			mask |= Mask(1) << i;
+		}
+	}
+
+	e.valid = true;
+	memcpy(e.source_name, header.source_name, sizeof(e.source_name));
+	memcpy(e.source_hash, header.source_hash, sizeof(e.source_hash));
+	e.mask = mask;
+	return mask;
+}
+
+bool Subscription::match_device(Mask mask, const char *device_name) const
+{
+	if (m_n_patterns == 0 || (mask & m_any_device)) {
+		return true;
+	}
+	for (size_t i = 0; mask != 0; i++, mask >>= 1) {
+		if ((mask & 1) && glob(m_patterns[i].device_name, device_name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t Subscription::device_patterns(Mask mask, const char **patterns,
+                                     size_t n_max) const
+{
+	if (m_n_patterns == 0 || (mask & m_any_device)) {
+		return 0;
+	}
+	size_t n = 0;
+	for (size_t i = 0; mask != 0; i++, mask >>= 1) {
+		if (!(mask & 1)) {
+			continue;
+		}
+		if (n == n_max) {
+			return 0;
+		}
+		patterns[n++] = m_patterns[i].device_name;
+	}
+	return n;
+}
+
+}  // namespace ev3_event_broker
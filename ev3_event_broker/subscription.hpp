@@ -0,0 +1,137 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file subscription.hpp
+ *
+ * Matches the source and device names of incoming messages against a set of
+ * subscription patterns.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The Subscription class holds a list of patterns of the form
+ * "SOURCE[:HASH][/DEVICE]". Each component may contain the wildcards "*"
+ * and "?"; omitted components match anything. An empty subscription matches
+ * all messages.
+ *
+ * Messages are matched in two steps: match_source() is called once per
+ * datagram with the message header and returns the set of patterns matching
+ * the source. The result is cached per source, such that datagrams from
+ * unsubscribed sources are usually rejected with a single table lookup.
+ * match_device() then checks individual records against the patterns in
+ * that set.
+ */
+class Subscription {
+public:
+	/**
+	 * Maximum number of patterns.
+	 */
+	static constexpr size_t MAX_PATTERNS = 32;
+
+	/**
+	 * Set of patterns, where bit i corresponds to pattern i.
+	 */
+	using Mask = uint32_t;
+
+private:
+	/**
+	 * Number of entries in the source cache. Must be a power of two.
+	 */
+	static constexpr size_t CACHE_SIZE = 64;
+
+	struct Pattern {
+		char source_name[N_SOURCE_NAME_CHARS + 1];
+		char source_hash[N_SOURCE_HASH_CHARS + 1];
+		char device_name[N_DEVICE_NAME_CHARS + 1];
+	};
+
+	struct CacheEntry {
+		bool valid;
+		char source_name[N_SOURCE_NAME_CHARS + 1];
+		char source_hash[N_SOURCE_HASH_CHARS + 1];
+		Mask mask;
+	};
+
+	Pattern m_patterns[MAX_PATTERNS];
+	size_t m_n_patterns;
+	Mask m_any_device;  // Patterns that match all devices
+	CacheEntry m_cache[CACHE_SIZE];
+
+	void clear_cache();
+
+public:
+	Subscription();
+
+	/**
+	 * Returns true if no patterns are set, i.e. all messages are accepted.
+	 */
+	bool empty() const { return m_n_patterns == 0; }
+
+	/**
+	 * Removes all patterns.
+	 */
+	void clear();
+
+	/**
+	 * Adds a comma-separated list of patterns. Returns false and leaves the
+	 * subscription unchanged if a pattern is invalid or too long, or if there
+	 * are too many patterns.
+	 */
+	bool add(const char *patterns);
+
+	/**
+	 * Returns the set of patterns matching the source of the given message.
+	 * The source name and hash must be stored in zero-padded buffers as in
+	 * Demarshaller::Header.
+	 */
+	Mask match_source(const Demarshaller::Header &header);
+
+	/**
+	 * Returns true if any of the patterns in the given set matches the
+	 * device.
+	 */
+	bool match_device(Mask mask, const char *device_name) const;
+
+	/**
+	 * Stores the device patterns of the patterns in the given set in the
+	 * given array and returns their number. Returns zero if the devices
+	 * cannot be narrowed down, i.e. if any of the patterns matches all
+	 * devices or if there are more than n_max device patterns.
+	 */
+	size_t device_patterns(Mask mask, const char **patterns,
+	                       size_t n_max) const;
+
+	/**
+	 * Matches a zero-terminated string against a pattern containing the
+	 * wildcards "*" and "?".
+	 */
+	static bool glob(const char *pattern, const char *str);
+};
+
+}  // namespace ev3_event_broker
@@ -29,16 +29,20 @@ namespace ev3_event_broker {
 TachoMotor::TachoMotor(const char *path)
     : m_fd_command(-1),
       m_fd_position(-1),
+      m_fd_speed(-1),
       m_fd_duty_cycle(-1),
+      m_fd_duty_cycle_sp(-1),
       m_fd_state(-1) {
 	m_fd_command = open_device_file(path, "/command", O_WRONLY);
 	m_fd_position = open_device_file(path, "/position", O_RDONLY);
-	m_fd_duty_cycle = open_device_file(path, "/duty_cycle_sp", O_WRONLY);
+	m_fd_speed = open_device_file(path, "/speed", O_RDONLY);
+	m_fd_duty_cycle = open_device_file(path, "/duty_cycle", O_RDONLY);
+	m_fd_duty_cycle_sp = open_device_file(path, "/duty_cycle_sp", O_WRONLY);
 	m_fd_state = open_device_file(path, "/state", O_RDONLY);
-	read_name(path);
+	read_name(path, m_name, sizeof(m_name));
 }
 
-void TachoMotor::read_name(const char *path) {
+void TachoMotor::read_name(const char *path, char *name, size_t name_size) {
 	// Read the address
 	char buf[32];
 	int fd = open_device_file(path, "/address", O_RDONLY);
@@ -46,17 +50,26 @@ void TachoMotor::read_name(const char *path) {
 	close(fd);
 
 	// Combine the address with the "motor_" prefix
-	len = snprintf(m_name, sizeof(m_name) - 1, "motor_%.*s", int(len - 1), buf);
-	m_name[len] = 0;  // Force the last byte to zero
+	len = snprintf(name, name_size - 1, "motor_%.*s", int(len - 1), buf);
+	if (len < 0 || size_t(len) >= name_size - 1) {
+		len = name_size - 2;  // Output was truncated
+	}
+	name[len] = 0;  // Force the last byte to zero
 }
 
 TachoMotor::~TachoMotor() {
 	if (m_fd_state >= 0) {
 		close(m_fd_state);
 	}
+	if (m_fd_duty_cycle_sp >= 0) {
+		close(m_fd_duty_cycle_sp);
+	}
 	if (m_fd_duty_cycle >= 0) {
 		close(m_fd_duty_cycle);
 	}
+	if (m_fd_speed >= 0) {
+		close(m_fd_speed);
+	}
 	if (m_fd_position >= 0) {
 		close(m_fd_position);
 	}
@@ -82,10 +95,39 @@ void TachoMotor::reset() {
 }
 
 int TachoMotor::get_position() const {
-	char buf[16];
-	size_t len = err(pread(m_fd_position, buf, sizeof(buf) - 1, 0));
+	return read_device_int(m_fd_position);
+}
+
+int TachoMotor::get_speed() const {
+	return read_device_int(m_fd_speed);
+}
+
+int TachoMotor::get_duty_cycle() const {
+	return read_device_int(m_fd_duty_cycle);
+}
+
+int TachoMotor::get_state() const {
+	char buf[64];
+	size_t len = err(pread(m_fd_state, buf, sizeof(buf) - 1, 0));
 	buf[len] = '\0';
-	return atoi(buf);
+
+	int state = 0;
+	if (strstr(buf, "running")) {
+		state |= MOTOR_STATE_RUNNING;
+	}
+	if (strstr(buf, "ramping")) {
+		state |= MOTOR_STATE_RAMPING;
+	}
+	if (strstr(buf, "holding")) {
+		state |= MOTOR_STATE_HOLDING;
+	}
+	if (strstr(buf, "overloaded")) {
+		state |= MOTOR_STATE_OVERLOADED;
+	}
+	if (strstr(buf, "stalled")) {
+		state |= MOTOR_STATE_STALLED;
+	}
+	return state;
 }
 
 void TachoMotor::set_duty_cycle(int duty_cycle) {
@@ -97,6 +139,6 @@ void TachoMotor::set_duty_cycle(int duty_cycle) {
 
 	char buf[16];
 	snprintf(buf, sizeof(buf), "%d\n", duty_cycle);
-	err(pwrite(m_fd_duty_cycle, buf, strnlen(buf, sizeof(buf)), 0));
+	err(pwrite(m_fd_duty_cycle_sp, buf, strnlen(buf, sizeof(buf)), 0));
 }
 }  // namespace ev3_event_broker
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include <ev3_event_broker/motor.hpp>
 
 namespace ev3_event_broker {
@@ -25,11 +27,17 @@ class TachoMotor : public Motor {
 private:
 	int m_fd_command;
 	int m_fd_position;
+	int m_fd_speed;
 	int m_fd_duty_cycle;
+	int m_fd_duty_cycle_sp;
 	int m_fd_state;
 	char m_name[17];
 
-	void read_name(const char *path);
+	/**
+	 * Reads the address of the motor in the given directory and stores the
+	 * corresponding motor name, e.g. "motor_outA", in the given buffer.
+	 */
+	static void read_name(const char *path, char *name, size_t name_size);
 
 public:
 	explicit TachoMotor(const char *path);
@@ -37,6 +45,9 @@ public:
 	void reset() override;
 	bool good() const override;
 	int get_position() const override;
+	int get_speed() const override;
+	int get_duty_cycle() const override;
+	int get_state() const override;
 	void set_duty_cycle(int duty_cycle) override;
 	const char *name() const override { return m_name; }
 };
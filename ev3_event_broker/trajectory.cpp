@@ -0,0 +1,216 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include <ev3_event_broker/controller.hpp>
+#include <ev3_event_broker/motors.hpp>
+#include <ev3_event_broker/trajectory.hpp>
+
+namespace ev3_event_broker {
+
+Trajectories::Trajectories(Motors &motors, Controller &controller)
+    : m_motors(motors), m_controller(controller)
+{
+	memset(m_buffers, 0, sizeof(m_buffers));
+}
+
+Trajectories::Buffer *Trajectories::buffer(DeviceHandle handle)
+{
+	if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+		return nullptr;
+	}
+	return &m_buffers[handle];
+}
+
+bool Trajectories::add(DeviceHandle handle, uint8_t mode, uint8_t options,
+                       const TrajectoryPoint *points, size_t n_points,
+                       double t)
+{
+	Buffer *buf = buffer(handle);
+	if (!buf) {
+		return false;
+	}
+
+	// Position trajectories drive the on-brick controller, which needs gains
+	if (mode == TRAJECTORY_MODE_POSITION && !m_controller.has_gains(handle)) {
+		buf->running = false;
+		buf->rejected = true;
+		return false;
+	}
+
+	// Start a new trajectory if requested or if nothing is being played back;
+	// point times are relative to the beginning of the trajectory
+	if ((options & TRAJECTORY_START) || !buf->running || buf->mode != mode) {
+		buf->head = 0;
+		buf->count = 0;
+		buf->running = true;
+		buf->has_prev = false;
+		buf->complete = false;
+		buf->mode = mode;
+		buf->t_start = t;
+	}
+	buf->options = options;
+	buf->complete = buf->complete || (options & TRAJECTORY_END);
+
+	// Writing the duty cycle directly overrides the position controller;
+	// position trajectories switch it to position mode in apply()
+	if (mode == TRAJECTORY_MODE_DUTY_CYCLE) {
+		m_controller.disable(handle);
+	}
+
+	for (size_t i = 0; i < n_points; i++) {
+		// Discard points that are not strictly monotonic in time
+		const TrajectoryPoint *last = buf->has_prev ? &buf->prev : nullptr;
+		if (buf->count > 0) {
+			last = &buf->points[(buf->head + buf->count - 1) % BUFFER_SIZE];
+		}
+		if (last && points[i].time <= last->time) {
+			continue;
+		}
+		if (buf->count >= BUFFER_SIZE) {
+			return false;
+		}
+		buf->points[(buf->head + buf->count) % BUFFER_SIZE] = points[i];
+		buf->count++;
+	}
+	return true;
+}
+
+void Trajectories::cancel(DeviceHandle handle)
+{
+	Buffer *buf = buffer(handle);
+	if (buf) {
+		buf->running = false;
+	}
+}
+
+void Trajectories::cancel_all()
+{
+	for (Buffer &buf : m_buffers) {
+		buf.running = false;
+	}
+}
+
+double Trajectories::interpolate(const Buffer &buf, double t)
+{
+	const TrajectoryPoint &p0 = buf.points[buf.head];
+	if (buf.count < 2 || t <= p0.time) {
+		return p0.value;
+	}
+
+	const TrajectoryPoint &p1 = buf.points[(buf.head + 1) % BUFFER_SIZE];
+	const double dt = double(p1.time) - double(p0.time);
+	const double s = (t - p0.time) / dt;
+	const double slope = (double(p1.value) - double(p0.value)) / dt;
+	if (!(buf.options & TRAJECTORY_CUBIC)) {
+		return p0.value + s * (double(p1.value) - double(p0.value));
+	}
+
+	// Cubic Hermite spline with Catmull-Rom style tangents; fall back to
+	// one-sided differences at the boundaries of the buffered segment
+	double m0 = slope, m1 = slope;
+	if (buf.has_prev) {
+		m0 = (double(p1.value) - double(buf.prev.value)) /
+		     (double(p1.time) - double(buf.prev.time));
+	}
+	if (buf.count >= 3) {
+		const TrajectoryPoint &p2 = buf.points[(buf.head + 2) % BUFFER_SIZE];
+		m1 = (double(p2.value) - double(p0.value)) /
+		     (double(p2.time) - double(p0.time));
+	}
+	const double s2 = s * s, s3 = s2 * s;
+	return (2.0 * s3 - 3.0 * s2 + 1.0) * p0.value +
+	       (s3 - 2.0 * s2 + s) * dt * m0 + (-2.0 * s3 + 3.0 * s2) * p1.value +
+	       (s3 - s2) * dt * m1;
+}
+
+void Trajectories::apply(DeviceHandle handle, const Buffer &buf, double value)
+{
+	Motor *motor = m_motors.get(handle);
+	if (!motor) {
+		return;
+	}
+	if (buf.mode == TRAJECTORY_MODE_POSITION) {
+		m_controller.update_position_target(handle, value);
+	}
+	else {
+		motor->set_duty_cycle(int(std::lround(value)));
+	}
+}
+
+void Trajectories::stop_motor(DeviceHandle handle)
+{
+	m_controller.disable(handle);
+	Motor *motor = m_motors.get(handle);
+	if (motor) {
+		motor->set_duty_cycle(0);
+	}
+}
+
+void Trajectories::update(double t, const UnderrunCallback &underrun)
+{
+	for (size_t i = 0; i < DeviceTable::MAX_DEVICES; i++) {
+		Buffer &buf = m_buffers[i];
+		if (buf.rejected) {
+			buf.rejected = false;
+			underrun(DeviceHandle(i));
+			continue;
+		}
+		if (!buf.running || buf.count == 0) {
+			continue;
+		}
+
+		// Discard all points that lie completely in the past, but keep the
+		// last one for the computation of spline tangents
+		const double t_ms = (t - buf.t_start) * 1e3;
+		while (buf.count >= 2 &&
+		       buf.points[(buf.head + 1) % BUFFER_SIZE].time <= t_ms) {
+			buf.prev = buf.points[buf.head];
+			buf.has_prev = true;
+			buf.head = (buf.head + 1) % BUFFER_SIZE;
+			buf.count--;
+		}
+
+		const DeviceHandle handle = DeviceHandle(i);
+		if (buf.count > 1 || t_ms < buf.points[buf.head].time) {
+			apply(handle, buf, interpolate(buf, t_ms));
+			continue;
+		}
+
+		// We reached the last buffered point. Hold the last value if the
+		// trajectory is complete. Otherwise this is an underrun; keep the
+		// trajectory clock running so late points can still be appended.
+		const TrajectoryPoint &last = buf.points[buf.head];
+		apply(handle, buf, last.value);
+		buf.prev = last;
+		buf.has_prev = true;
+		buf.count = 0;
+		if (buf.complete) {
+			buf.running = false;
+			continue;
+		}
+		if (buf.options & TRAJECTORY_STOP_ON_UNDERRUN) {
+			stop_motor(handle);
+		}
+		underrun(handle);
+	}
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,122 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trajectory.hpp
+ *
+ * Buffers timestamped trajectory points received from a client and plays
+ * them back at a fixed rate, independent of the network jitter.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include <ev3_event_broker/device_table.hpp>
+#include <ev3_event_broker/marshaller.hpp>
+
+namespace ev3_event_broker {
+
+class Controller;
+class Motors;
+
+/**
+ * The Trajectories class holds a fixed-capacity ring buffer of trajectory
+ * points for each motor. Points are interpolated linearly or using cubic
+ * Hermite splines and either written as duty cycle or passed as a target to
+ * the on-brick position controller.
+ */
+class Trajectories {
+public:
+	/**
+	 * Callback called whenever the playback of a trajectory runs out of points
+	 * before the client marked the trajectory as complete, or a trajectory
+	 * was rejected.
+	 */
+	using UnderrunCallback = std::function<void(DeviceHandle handle)>;
+
+	/**
+	 * Number of points that can be buffered per motor.
+	 */
+	static constexpr size_t BUFFER_SIZE = 128;
+
+private:
+	struct Buffer {
+		TrajectoryPoint points[BUFFER_SIZE];
+		TrajectoryPoint prev;
+		size_t head;
+		size_t count;
+		bool running;
+		bool has_prev;
+		bool complete;
+		bool rejected;
+		uint8_t mode;
+		uint8_t options;
+		double t_start;
+	};
+
+	Motors &m_motors;
+	Controller &m_controller;
+	Buffer m_buffers[DeviceTable::MAX_DEVICES];
+
+	Buffer *buffer(DeviceHandle handle);
+
+	static double interpolate(const Buffer &buf, double t);
+	void apply(DeviceHandle handle, const Buffer &buf, double value);
+	void stop_motor(DeviceHandle handle);
+
+public:
+	Trajectories(Motors &motors, Controller &controller);
+
+	/**
+	 * Appends the given points to the buffer of the given motor. Starts a new
+	 * trajectory if TRAJECTORY_START is set in the options, the mode changed,
+	 * or no trajectory is currently being played back. Returns false if not
+	 * all points fit into the buffer. Position trajectories are rejected and
+	 * reported as underrun in the next update() if no controller gains were
+	 * set for the motor.
+	 *
+	 * @param t is the current time in seconds.
+	 */
+	bool add(DeviceHandle handle, uint8_t mode, uint8_t options,
+	         const TrajectoryPoint *points, size_t n_points, double t);
+
+	/**
+	 * Aborts trajectory playback for the given motor without touching the
+	 * motor itself.
+	 */
+	void cancel(DeviceHandle handle);
+
+	/**
+	 * Aborts trajectory playback for all motors.
+	 */
+	void cancel_all();
+
+	/**
+	 * Advances all trajectories to the given time in seconds and writes the
+	 * interpolated values. Throws a std::system_error if accessing a motor
+	 * fails.
+	 */
+	void update(double t, const UnderrunCallback &underrun);
+};
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,164 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <ev3_event_broker/velocity_estimator.hpp>
+
+namespace ev3_event_broker {
+
+/******************************************************************************
+ * Struct VelocityEstimator::Config                                           *
+ ******************************************************************************/
+
+bool VelocityEstimator::Config::parse(const char *spec)
+{
+	char *endptr;
+	if (strcmp(spec, "none") == 0) {
+		filter = Filter::NONE;
+		return true;
+	}
+	if (strncmp(spec, "lsq", 3) == 0) {
+		filter = Filter::LEAST_SQUARES;
+		spec += 3;
+		if (*spec == '\0') {
+			return true;
+		}
+		if (*spec != ':') {
+			return false;
+		}
+		window = strtoul(spec + 1, &endptr, 10);
+		return (*endptr == '\0') && (window >= 2) && (window <= MAX_WINDOW);
+	}
+	if (strncmp(spec, "alpha-beta", 10) == 0) {
+		filter = Filter::ALPHA_BETA;
+		spec += 10;
+		if (*spec == '\0') {
+			return true;
+		}
+		if (*spec != ':') {
+			return false;
+		}
+		alpha = strtod(spec + 1, &endptr);
+		if (*endptr != ',') {
+			return false;
+		}
+		beta = strtod(endptr + 1, &endptr);
+		return (*endptr == '\0') && (alpha > 0.0) && (alpha <= 1.0) &&
+		       (beta > 0.0) && (beta <= 2.0);
+	}
+	return false;
+}
+
+/******************************************************************************
+ * Class VelocityEstimator                                                    *
+ ******************************************************************************/
+
+VelocityEstimator::VelocityEstimator(const Config &config) : m_config(config)
+{
+	memset(m_states, 0, sizeof(m_states));
+}
+
+double VelocityEstimator::update_least_squares(State &s, double t, double x)
+{
+	// Insert the sample into the ring buffer
+	const size_t n_window = m_config.window;
+	s.t[s.head] = t;
+	s.x[s.head] = x;
+	s.head = (s.head + 1) % n_window;
+	if (s.count < n_window) {
+		s.count++;
+	}
+	if (s.count < 2) {
+		return 0.0;
+	}
+
+	// Compute the slope of the regression line. Times are taken relative to
+	// the newest sample to preserve precision.
+	double t_mean = 0.0, x_mean = 0.0;
+	for (size_t i = 0; i < s.count; i++) {
+		t_mean += s.t[i] - t;
+		x_mean += s.x[i];
+	}
+	t_mean /= s.count;
+	x_mean /= s.count;
+
+	double cov = 0.0, var = 0.0;
+	for (size_t i = 0; i < s.count; i++) {
+		const double dt = (s.t[i] - t) - t_mean;
+		cov += dt * (s.x[i] - x_mean);
+		var += dt * dt;
+	}
+	return (var > 0.0) ? (cov / var) : 0.0;
+}
+
+double VelocityEstimator::update_alpha_beta(State &s, double t, double x)
+{
+	if (s.count == 0) {
+		s.count = 1;
+		s.t[0] = t;
+		s.x_est = x;
+		s.v_est = 0.0;
+		return 0.0;
+	}
+
+	const double dt = t - s.t[0];
+	s.t[0] = t;
+	if (dt <= 0.0) {
+		return s.v_est;
+	}
+
+	// Predict the position, then correct position and velocity using the
+	// residual
+	const double x_pred = s.x_est + s.v_est * dt;
+	const double r = x - x_pred;
+	s.x_est = x_pred + m_config.alpha * r;
+	s.v_est = s.v_est + (m_config.beta / dt) * r;
+	return s.v_est;
+}
+
+double VelocityEstimator::update(DeviceHandle handle, double t, double x)
+{
+	if (handle < 0 || size_t(handle) >= DeviceTable::MAX_DEVICES) {
+		return 0.0;
+	}
+	State &s = m_states[handle];
+	switch (m_config.filter) {
+		case Filter::LEAST_SQUARES:
+			return update_least_squares(s, t, x);
+		case Filter::ALPHA_BETA:
+			return update_alpha_beta(s, t, x);
+		default:
+			return 0.0;
+	}
+}
+
+void VelocityEstimator::reset(DeviceHandle handle)
+{
+	if (handle >= 0 && size_t(handle) < DeviceTable::MAX_DEVICES) {
+		memset(&m_states[handle], 0, sizeof(State));
+	}
+}
+
+void VelocityEstimator::reset_all()
+{
+	memset(m_states, 0, sizeof(m_states));
+}
+
+}  // namespace ev3_event_broker
@@ -0,0 +1,113 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file velocity_estimator.hpp
+ *
+ * Estimates the motor velocities from timestamped position samples.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <ev3_event_broker/device_table.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * The VelocityEstimator class computes a velocity estimate for each motor
+ * from position samples taken on the brick. Two filters are available: the
+ * least-squares slope over a fixed window of samples and an alpha-beta filter.
+ */
+class VelocityEstimator {
+public:
+	/**
+	 * Maximum window size of the least-squares filter.
+	 */
+	static constexpr size_t MAX_WINDOW = 16;
+
+	enum class Filter { NONE, LEAST_SQUARES, ALPHA_BETA };
+
+	struct Config {
+		Filter filter;
+		size_t window;
+		double alpha;
+		double beta;
+
+		Config()
+		    : filter(Filter::LEAST_SQUARES), window(8), alpha(0.5), beta(0.1)
+		{
+		}
+
+		/**
+		 * Parses a filter specification of the form "none", "lsq:WINDOW" or
+		 * "alpha-beta:ALPHA,BETA". Parameters may be omitted, in which case the
+		 * defaults are used. Returns false if the specification is invalid.
+		 */
+		bool parse(const char *spec);
+	};
+
+private:
+	struct State {
+		double t[MAX_WINDOW];
+		double x[MAX_WINDOW];
+		size_t head;
+		size_t count;
+		double x_est;
+		double v_est;
+	};
+
+	Config m_config;
+	State m_states[DeviceTable::MAX_DEVICES];
+
+	double update_least_squares(State &s, double t, double x);
+	double update_alpha_beta(State &s, double t, double x);
+
+public:
+	explicit VelocityEstimator(const Config &config = Config());
+
+	const Config &config() const { return m_config; }
+
+	/**
+	 * Returns true if a filter is enabled, i.e. velocities should be computed
+	 * and published.
+	 */
+	bool enabled() const { return m_config.filter != Filter::NONE; }
+
+	/**
+	 * Adds a position sample in degrees taken at time t in seconds and returns
+	 * the current velocity estimate in degrees per second.
+	 */
+	double update(DeviceHandle handle, double t, double x);
+
+	/**
+	 * Discards the sample history of the given motor, e.g. because the motor
+	 * position was reset.
+	 */
+	void reset(DeviceHandle handle);
+
+	/**
+	 * Discards the sample history of all motors.
+	 */
+	void reset_all();
+};
+
+}  // namespace ev3_event_broker
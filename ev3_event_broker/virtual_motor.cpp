@@ -16,75 +16,50 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#ifdef VIRTUAL_MOTORS
-
 #include <algorithm>
 #include <cmath>
-
-#include <time.h>
+#include <cstring>
 
 #include <ev3_event_broker/virtual_motor.hpp>
+#include <ev3_event_broker/virtual_motor_bank.hpp>
 
 namespace ev3_event_broker {
 
-static constexpr double MOTOR_TAU = 100.0e-3;
-static constexpr double MOTOR_MAX_RPM = 240.0;
-
-static double get_timestamp()
-{
-	struct timespec tp;
-	clock_gettime(CLOCK_MONOTONIC, &tp);
-	return double(tp.tv_sec) + double(tp.tv_nsec) * 1e-9;
-}
-
-VirtualMotor::VirtualMotor(const char *path)
-    : TachoMotor(path),
-      m_x0(0.0),
-      m_v0(0.0),
-      m_t0(0.0),
-      m_vtar(0.0),
-      m_pos_offs(0.0)
+VirtualMotor::VirtualMotor(const char *name, VirtualMotorBank &bank,
+                           size_t idx)
+    : m_bank(bank), m_idx(idx)
 {
+	memset(m_name, 0, sizeof(m_name));
+	strncpy(m_name, name, sizeof(m_name) - 1);
 }
 
 VirtualMotor::~VirtualMotor() {}
 
-double VirtualMotor::get_precise_velocity(double t1) const
+void VirtualMotor::reset() { m_bank.reset(m_idx); }
+
+int VirtualMotor::get_position() const
 {
-	const double t = t1 - m_t0;
-	return std::exp(-t / MOTOR_TAU) * (m_v0 - m_vtar) + m_vtar;
+	return int(std::lround(m_bank.position(m_idx)));
 }
 
-double VirtualMotor::get_precise_position(double t1) const
+int VirtualMotor::get_speed() const
 {
-	const double t = t1 - m_t0;
-	return MOTOR_TAU * (m_v0 - std::exp(-t / MOTOR_TAU) * (m_v0 - m_vtar)) +
-	       m_vtar * (t - MOTOR_TAU) + m_x0;
+	return int(std::lround(m_bank.velocity(m_idx)));
 }
 
-void VirtualMotor::reset()
+int VirtualMotor::get_duty_cycle() const
 {
-	set_duty_cycle(0);
-	m_pos_offs = get_precise_position(get_timestamp());
+	return int(std::lround(m_bank.duty_cycle(m_idx)));
 }
 
-int VirtualMotor::get_position() const
+int VirtualMotor::get_state() const
 {
-	return int((get_precise_position(get_timestamp()) - m_pos_offs) * 360.0);
+	// Motors are always operated in "run-direct" mode
+	return MOTOR_STATE_RUNNING;
 }
 
 void VirtualMotor::set_duty_cycle(int duty_cycle)
 {
-	// Get the current position and RPM
-	const double t = get_timestamp();
-	const double v0 = get_precise_velocity(t);
-	const double x0 = get_precise_position(t);
-	m_v0 = v0, m_x0 = x0, m_t0 = t;
-
-	// Compute the target RPM
-	duty_cycle = std::max(std::min(duty_cycle, 100), -100);
-	m_vtar = (double(duty_cycle) / 100.0) * (MOTOR_MAX_RPM / 60.0);
+	m_bank.set_duty_cycle(m_idx, std::max(std::min(duty_cycle, 100), -100));
 }
 }  // namespace ev3_event_broker
-
-#endif
@@ -18,27 +18,39 @@
 
 #pragma once
 
-#ifdef VIRTUAL_MOTORS
+#include <cstddef>
 
-#include <ev3_event_broker/tacho_motor.hpp>
+#include <ev3_event_broker/motor.hpp>
 
 namespace ev3_event_broker {
-class VirtualMotor : public TachoMotor {
-private:
-	double m_x0, m_v0, m_t0, m_vtar, m_pos_offs;
 
-	double get_precise_velocity(double t1) const;
-	double get_precise_position(double t1) const;
+class VirtualMotorBank;
+
+/**
+ * Purely in-memory motor. The motor state is stored in and advanced by a
+ * VirtualMotorBank.
+ */
+class VirtualMotor : public Motor {
+private:
+	VirtualMotorBank &m_bank;
+	size_t m_idx;
+	char m_name[17];
 
 public:
-	explicit VirtualMotor(const char *path);
+	/**
+	 * Creates a virtual motor referring to the motor with index idx in the
+	 * given bank. The bank must outlive the motor.
+	 */
+	VirtualMotor(const char *name, VirtualMotorBank &bank, size_t idx);
 	~VirtualMotor() override;
 	void reset() override;
+	bool good() const override { return true; }
 	int get_position() const override;
+	int get_speed() const override;
+	int get_duty_cycle() const override;
+	int get_state() const override;
 	void set_duty_cycle(int duty_cycle) override;
+	const char *name() const override { return m_name; }
 };
 
 }  // namespace ev3_event_broker
-
-#endif
-
@@ -0,0 +1,176 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <ev3_event_broker/virtual_motor_bank.hpp>
+
+namespace ev3_event_broker {
+
+/**
+ * Branch-free minimum and maximum. GCC does not if-convert std::min() and
+ * std::max() on doubles without -ffinite-math-only, which prevents the
+ * vectorisation of the update loop.
+ */
+static inline double vmax(double a, double b)
+{
+	return 0.5 * (a + b + std::abs(a - b));
+}
+
+static inline double vmin(double a, double b)
+{
+	return 0.5 * (a + b - std::abs(a - b));
+}
+
+/**
+ * Approximates exp(x) for x <= 0 with a relative error of about 1e-7. Does not
+ * call into libm and has no data-dependent branches, so loops calling this
+ * function can be vectorised by the compiler.
+ */
+static inline double fast_exp(double x)
+{
+	// exp(x) = 2^n * 2^f with integer n and f in [-0.5, 0.5]. Adding 1.5 *
+	// 2^52 rounds y to an integer stored in the lower mantissa bits.
+	static constexpr double ROUND = 6755399441055744.0;
+	const double y = vmax(x * 1.4426950408889634, -1000.0);
+	const double n_round = y + ROUND;
+	const double n = n_round - ROUND;
+	const double f = y - n;
+
+	// Taylor series of 2^f = exp(f * ln(2))
+	double p = 1.5403530393381606e-4;
+	p = p * f + 1.3333558146428443e-3;
+	p = p * f + 9.6181291076284772e-3;
+	p = p * f + 5.5504108664821580e-2;
+	p = p * f + 2.4022650695910071e-1;
+	p = p * f + 6.9314718055994531e-1;
+	p = p * f + 1.0;
+
+	// Construct 2^n by directly writing the exponent bits
+	uint64_t bits;
+	memcpy(&bits, &n_round, sizeof(bits));
+	bits = (bits + 1023U) << 52;
+	double scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return p * scale;
+}
+
+/**
+ * Relative tolerance applied to the backlash gap. Rounding in the clamp below
+ * may leave the output shaft slightly inside the gap, in which case it must
+ * still count as being in contact with the motor.
+ */
+static constexpr double EDGE = 1.0 - 1e-9;
+
+/**
+ * Advances n motors by dt seconds. The arrays must not overlap; passing them
+ * as restrict-qualified arguments saves GCC from emitting more run-time alias
+ * checks than it is willing to, which would prevent vectorisation.
+ */
+static void step_motors(size_t n, double dt, const double *__restrict tau,
+                        const double *__restrict max_speed,
+                        const double *__restrict inertia,
+                        const double *__restrict friction,
+                        const double *__restrict half_backlash,
+                        const double *__restrict duty_cycle,
+                        double *__restrict xm, double *__restrict x,
+                        double *__restrict v)
+{
+	for (size_t i = 0; i < n; i++) {
+		// Target velocity; friction acts as a dead band around zero
+		const double vt0 = duty_cycle[i] * max_speed[i];
+		const double vt =
+		    std::copysign(vmax(std::abs(vt0) - friction[i], 0.0), vt0);
+
+		// The load is disengaged while the motor moves within the backlash
+		// gap or accelerates away from the end of the gap it is touching.
+		// Bitwise operators and a select between constants keep the loop free
+		// of branches.
+		const double gap = xm[i] - x[i];
+		const bool disengaged =
+		    (std::abs(gap) < half_backlash[i] * EDGE) |
+		    ((half_backlash[i] > 0.0) & ((gap >= 0.0) != (vt >= v[i])));
+		const double engaged = disengaged ? 0.0 : 1.0;
+		const double tau_eff = tau[i] * (1.0 + engaged * inertia[i]);
+
+		// Exact solution of the first-order system over the time step
+		const double a = fast_exp(-dt / tau_eff);
+		const double dv = v[i] - vt;
+		xm[i] += vt * dt + dv * tau_eff * (1.0 - a);
+		v[i] = vt + dv * a;
+
+		// The output shaft follows the motor within the backlash gap
+		x[i] = vmin(vmax(x[i], xm[i] - half_backlash[i]),
+		            xm[i] + half_backlash[i]);
+	}
+}
+
+VirtualMotorBank::VirtualMotorBank(size_t capacity)
+    : m_t(0.0), m_initialized(false)
+{
+	for (std::vector<double> *v :
+	     {&m_tau, &m_max_speed, &m_inertia, &m_friction, &m_half_backlash,
+	      &m_duty_cycle, &m_motor_position, &m_position, &m_velocity,
+	      &m_position_offset}) {
+		v->reserve(capacity);
+	}
+}
+
+size_t VirtualMotorBank::add(const Params &params)
+{
+	m_tau.push_back(params.tau);
+	m_max_speed.push_back(params.max_speed);
+	m_inertia.push_back(params.inertia);
+	m_friction.push_back(params.friction);
+	m_half_backlash.push_back(0.5 * params.backlash);
+	m_duty_cycle.push_back(0.0);
+	m_motor_position.push_back(0.0);
+	m_position.push_back(0.0);
+	m_velocity.push_back(0.0);
+	m_position_offset.push_back(0.0);
+	return m_tau.size() - 1;
+}
+
+void VirtualMotorBank::step(double t)
+{
+	if (!m_initialized) {
+		m_initialized = true;
+		m_t = t;
+		return;
+	}
+	const double dt = std::min(t - m_t, MAX_DT);
+	m_t = t;
+	if (dt <= 0.0) {
+		return;
+	}
+
+	step_motors(size(), dt, m_tau.data(), m_max_speed.data(), m_inertia.data(),
+	            m_friction.data(), m_half_backlash.data(), m_duty_cycle.data(),
+	            m_motor_position.data(), m_position.data(), m_velocity.data());
+}
+
+void VirtualMotorBank::reset(size_t idx)
+{
+	m_duty_cycle[idx] = 0.0;
+	m_position_offset[idx] = m_position[idx];
+}
+
+}  // namespace ev3_event_broker
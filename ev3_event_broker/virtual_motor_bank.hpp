@@ -0,0 +1,152 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file virtual_motor_bank.hpp
+ *
+ * Simulates the dynamics of many virtual motors at once.
+ *
+ * @author Andreas Stöckel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace ev3_event_broker {
+
+/**
+ * The VirtualMotorBank class stores the state of all virtual motors as a
+ * structure of arrays and advances all motors in a single pass per call to
+ * step(). Each motor is modelled as a first-order system driven by the duty
+ * cycle with an optional load inertia, Coulomb friction and gear backlash.
+ */
+class VirtualMotorBank {
+public:
+	struct Params {
+		/**
+		 * Time constant of the unloaded motor in seconds.
+		 */
+		double tau;
+
+		/**
+		 * Speed at 100% duty cycle in degrees per second.
+		 */
+		double max_speed;
+
+		/**
+		 * Inertia of the load relative to the inertia of the motor. The time
+		 * constant of the motor is multiplied by (1 + inertia) whenever the
+		 * load is engaged.
+		 */
+		double inertia;
+
+		/**
+		 * Coulomb friction expressed as the speed in degrees per second that
+		 * is lost at any duty cycle.
+		 */
+		double friction;
+
+		/**
+		 * Play between the motor and the output shaft in degrees.
+		 */
+		double backlash;
+
+		Params()
+		    : tau(100.0e-3),
+		      max_speed(1440.0),
+		      inertia(0.0),
+		      friction(0.0),
+		      backlash(0.0)
+		{
+		}
+	};
+
+	/**
+	 * Maximum time step in seconds; longer gaps between two calls to step()
+	 * are truncated.
+	 */
+	static constexpr double MAX_DT = 0.1;
+
+private:
+	double m_t;
+	bool m_initialized;
+
+	// Parameters
+	std::vector<double> m_tau;
+	std::vector<double> m_max_speed;
+	std::vector<double> m_inertia;
+	std::vector<double> m_friction;
+	std::vector<double> m_half_backlash;
+
+	// State
+	std::vector<double> m_duty_cycle;
+	std::vector<double> m_motor_position;
+	std::vector<double> m_position;
+	std::vector<double> m_velocity;
+	std::vector<double> m_position_offset;
+
+public:
+	/**
+	 * Creates an empty motor bank with space for the given number of motors.
+	 */
+	explicit VirtualMotorBank(size_t capacity = 0);
+
+	/**
+	 * Adds a motor and returns its index.
+	 */
+	size_t add(const Params &params = Params());
+
+	size_t size() const { return m_tau.size(); }
+
+	/**
+	 * Advances all motors to time t in seconds.
+	 */
+	void step(double t);
+
+	/**
+	 * Stops the motor and sets the current position to zero.
+	 */
+	void reset(size_t idx);
+
+	/**
+	 * Sets the duty cycle in percent; takes effect with the next step.
+	 */
+	void set_duty_cycle(size_t idx, double duty_cycle)
+	{
+		m_duty_cycle[idx] = duty_cycle * 1e-2;
+	}
+
+	double duty_cycle(size_t idx) const { return m_duty_cycle[idx] * 1e2; }
+
+	/**
+	 * Position of the output shaft in degrees.
+	 */
+	double position(size_t idx) const
+	{
+		return m_position[idx] - m_position_offset[idx];
+	}
+
+	/**
+	 * Velocity of the motor in degrees per second.
+	 */
+	double velocity(size_t idx) const { return m_velocity[idx]; }
+};
+
+}  // namespace ev3_event_broker
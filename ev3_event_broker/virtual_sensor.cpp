@@ -0,0 +1,49 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef VIRTUAL_MOTORS
+
+#include <cmath>
+
+#include <ev3_event_broker/virtual_sensor.hpp>
+
+namespace ev3_event_broker {
+
+static constexpr double SENSOR_FREQUENCY = 0.2;
+static constexpr double SENSOR_AMPLITUDE = 10.0;
+
+VirtualSensor::VirtualSensor(const char *path, const Clock &clock)
+    : LegoSensor(path), m_clock(clock)
+{
+}
+
+VirtualSensor::~VirtualSensor() {}
+
+int VirtualSensor::get_value(size_t idx) const
+{
+	if (idx >= n_values()) {
+		return 0;
+	}
+	const double scale = SENSOR_AMPLITUDE * std::pow(10.0, decimals());
+	const double phase = 2.0 * M_PI * SENSOR_FREQUENCY * m_clock.now();
+	return LegoSensor::get_value(idx) +
+	       int(std::lround(scale * std::sin(phase + double(idx))));
+}
+}  // namespace ev3_event_broker
+
+#endif
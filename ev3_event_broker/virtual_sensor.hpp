@@ -0,0 +1,46 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef VIRTUAL_MOTORS
+
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/lego_sensor.hpp>
+
+namespace ev3_event_broker {
+/**
+ * Sensor backed by a directory mimicking /sys/class/lego-sensor. The values
+ * stored in the "value<N>" files are overlaid with a slow sine wave, so
+ * clients receive changing values without any hardware being attached. The
+ * phase of the sine wave is taken from the given clock.
+ */
+class VirtualSensor : public LegoSensor {
+private:
+	const Clock &m_clock;
+
+public:
+	explicit VirtualSensor(const char *path,
+	                       const Clock &clock = Clock::monotonic());
+	~VirtualSensor() override;
+	int get_value(size_t idx) const override;
+};
+
+}  // namespace ev3_event_broker
+
+#endif
@@ -16,11 +16,14 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <memory>
 #include <random>
+#include <vector>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -28,68 +31,602 @@
 #include <json.hpp>
 
 #include <ev3_event_broker/argparse.hpp>
+#include <ev3_event_broker/binary_writer.hpp>
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/command_parser.hpp>
+#include <ev3_event_broker/conflator.hpp>
 #include <ev3_event_broker/error.hpp>
 #include <ev3_event_broker/event_loop.hpp>
+#include <ev3_event_broker/json_writer.hpp>
 #include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/output_buffer.hpp>
+#include <ev3_event_broker/output_listener.hpp>
+#include <ev3_event_broker/predictor.hpp>
+#include <ev3_event_broker/recording.hpp>
+#include <ev3_event_broker/rtt_monitor.hpp>
+#include <ev3_event_broker/sampling_plan.hpp>
 #include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/source_directory.hpp>
 #include <ev3_event_broker/source_id.hpp>
+#include <ev3_event_broker/state_table.hpp>
+#include <ev3_event_broker/subscriber_table.hpp>
+#include <ev3_event_broker/subscription.hpp>
 
 using namespace nlohmann;
 using namespace ev3_event_broker;
 
-class Listener : public Demarshaller::Listener {
+/**
+ * Records the latest motor and sensor state in the shared StateTable, then
+ * forwards all messages to the listener producing the regular output.
+ */
+class StateTableListener : public Demarshaller::ForwardingListener {
+private:
+	StateTable &m_table;
+	const Clock &m_clock;
+
+public:
+	StateTableListener(StateTable &table, const Clock &clock,
+	                   Demarshaller::Listener &next)
+	    : ForwardingListener(next), m_table(table), m_clock(clock)
+	{
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		m_table.position(header, position.device_name, position.position,
+		                 m_clock.now_ns());
+		m_next.on_position_sensor(header, position);
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		m_table.velocity(header, velocity.device_name, velocity.velocity,
+		                 m_clock.now_ns());
+		m_next.on_velocity_sensor(header, velocity);
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		m_table.sensor(header, sensor.device_name, sensor.decimals,
+		               sensor.values, sensor.n_values, m_clock.now_ns());
+		m_next.on_sensor_values(header, sensor);
+	}
+};
+
+/**
+ * Passes the positions, velocities and duty cycles of all motors to the
+ * Predictor, then forwards all messages. Placed in front of the conflator, so
+ * the predictor sees every sample.
+ */
+class PredictorListener : public Demarshaller::ForwardingListener {
+private:
+	Predictor &m_predictor;
+	const Clock &m_clock;
+
+public:
+	PredictorListener(Predictor &predictor, const Clock &clock,
+	                  Demarshaller::Listener &next)
+	    : ForwardingListener(next), m_predictor(predictor), m_clock(clock)
+	{
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		m_predictor.position(header.source_name, position.device_name,
+		                     position.position, m_clock.now_ns());
+		m_next.on_position_sensor(header, position);
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		m_predictor.velocity(header.source_name, velocity.device_name,
+		                     velocity.velocity);
+		m_next.on_velocity_sensor(header, velocity);
+	}
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		if (telemetry.attribute == TELEMETRY_DUTY_CYCLE) {
+			m_predictor.duty_cycle(header.source_name, telemetry.device_name,
+			                       telemetry.value);
+		}
+		m_next.on_telemetry(header, telemetry);
+	}
+};
+
+/**
+ * Drops the broadcast positions, velocities and sensor values of sources that
+ * send this client its own stream, see --telemetry-period, such that each
+ * sample is written once. Packets belonging to the stream start with a marker
+ * carrying the hash of this client.
+ */
+class StreamListener : public Demarshaller::ForwardingListener {
 private:
 	SourceId &m_source_id;
+	SourceDirectory &m_directory;
 	socket::Address &m_source_address;
+	const Clock &m_clock;
+	int64_t m_timeout_ns;
+
+	// Hash of each source in the directory and the time the last packet of
+	// its stream was received
+	char m_hashes[SourceDirectory::MAX_SOURCES][N_SOURCE_HASH_CHARS + 1];
+	int64_t m_last_stream_ns[SourceDirectory::MAX_SOURCES];
+
+	size_t m_slot;
+	bool m_in_stream;
+	bool m_foreign_stream;
+	bool m_streaming;
+
+	bool forward() const
+	{
+		return !m_foreign_stream && (m_in_stream || !m_streaming);
+	}
 
 public:
-	Listener(SourceId &source_id, socket::Address &source_address)
-	    : m_source_id(source_id), m_source_address(source_address)
+	StreamListener(SourceId &source_id, SourceDirectory &directory,
+	               socket::Address &source_address, const Clock &clock,
+	               Demarshaller::Listener &next)
+	    : ForwardingListener(next),
+	      m_source_id(source_id),
+	      m_directory(directory),
+	      m_source_address(source_address),
+	      m_clock(clock),
+	      m_timeout_ns(0),
+	      m_slot(SourceDirectory::MAX_SOURCES),
+	      m_in_stream(false),
+	      m_foreign_stream(false),
+	      m_streaming(false)
 	{
+		memset(m_hashes, 0, sizeof(m_hashes));
+		memset(m_last_stream_ns, 0, sizeof(m_last_stream_ns));
 	}
 
 	/**
-	 * Implementation of the filter() function. Discards messages originating
-	 * from this device.
+	 * Sets the period of the requested streams in milliseconds. Broadcast
+	 * samples are dropped until no stream packet was received for two
+	 * periods plus the renewal interval; zero disables dropping.
 	 */
+	void set_period(int period_ms)
+	{
+		m_timeout_ns =
+		    (period_ms > 0)
+		        ? (2 * int64_t(period_ms) + SubscriberTable::TIMEOUT / 4) *
+		              1000000
+		        : 0;
+	}
+
 	bool filter(const Demarshaller::Header &header) override
 	{
-		return (strcmp(header.source_name, m_source_id.name()) != 0) ||
-		       (strcmp(header.source_hash, m_source_id.hash()) != 0);
+		m_in_stream = false;
+		m_foreign_stream = false;
+		m_streaming = false;
+		m_slot = SourceDirectory::MAX_SOURCES;
+		if (m_timeout_ns > 0) {
+			const SourceDirectory::Entry *entry =
+			    m_directory.find(m_source_address);
+			if (entry) {
+				m_slot = size_t(entry - &m_directory[0]);
+				m_streaming =
+				    strcmp(m_hashes[m_slot], header.source_hash) == 0 &&
+				    m_clock.now_ns() - m_last_stream_ns[m_slot] <
+				        m_timeout_ns;
+			}
+		}
+		return m_next.filter(header);
 	}
 
 	/**
-	 * Dump incoming position events as JSON to stdout.
+	 * Streams requested by other clients may arrive here if several clients
+	 * share a host and port; their samples are dropped as well.
 	 */
+	void on_stream(const Demarshaller::Header &header,
+	               const Demarshaller::Stream &stream) override
+	{
+		if (strcmp(stream.requester_hash, m_source_id.hash()) != 0) {
+			m_foreign_stream = true;
+		}
+		else {
+			m_in_stream = true;
+			if (m_slot < SourceDirectory::MAX_SOURCES) {
+				memcpy(m_hashes[m_slot], header.source_hash,
+				       sizeof(m_hashes[m_slot]));
+				m_last_stream_ns[m_slot] = m_clock.now_ns();
+			}
+		}
+		m_next.on_stream(header, stream);
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		if (forward()) {
+			m_next.on_position_sensor(header, position);
+		}
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		if (forward()) {
+			m_next.on_velocity_sensor(header, velocity);
+		}
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		if (forward()) {
+			m_next.on_sensor_values(header, sensor);
+		}
+	}
+};
+
+/**
+ * Forwards only those messages matching the subscription patterns. Sources
+ * are checked once per datagram, before any of its records are decoded.
+ */
+class SubscriptionListener : public Demarshaller::ForwardingListener {
+private:
+	Subscription &m_subscription;
+	Subscription::Mask m_mask;
+
+public:
+	SubscriptionListener(Subscription &subscription,
+	                     Demarshaller::Listener &next)
+	    : ForwardingListener(next), m_subscription(subscription), m_mask(0)
+	{
+	}
+
+	bool filter(const Demarshaller::Header &header) override
+	{
+		m_mask = m_subscription.match_source(header);
+		return m_mask != 0 && m_next.filter(header);
+	}
+
 	void on_position_sensor(
 	    const Demarshaller::Header &header,
 	    const Demarshaller::PositionSensor &position) override
 	{
-		const auto &ip = m_source_address;
-		std::cout << json({{"source_name", header.source_name},
-		                   {"source_hash", header.source_hash},
-		                   {"ip", {ip.a, ip.b, ip.c, ip.d}},
-		                   {"port", ip.port},
-		                   {"seq", header.sequence},
-		                   {"type", "position"},
-		                   {"device", position.device_name},
-		                   {"position", position.position}})
-		          << std::endl;
+		if (m_subscription.match_device(m_mask, position.device_name)) {
+			m_next.on_position_sensor(header, position);
+		}
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		if (m_subscription.match_device(m_mask, velocity.device_name)) {
+			m_next.on_velocity_sensor(header, velocity);
+		}
+	}
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		if (m_subscription.match_device(m_mask, telemetry.device_name)) {
+			m_next.on_telemetry(header, telemetry);
+		}
+	}
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override
+	{
+		if (m_subscription.match_device(m_mask, underrun.device_name)) {
+			m_next.on_trajectory_underrun(header, underrun);
+		}
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		if (m_subscription.match_device(m_mask, sensor.device_name)) {
+			m_next.on_sensor_values(header, sensor);
+		}
+	}
+};
+
+/**
+ * Records the address of every source other than this client in the source
+ * directory, such that commands can address sources by name.
+ */
+class SourceDirectoryListener : public Demarshaller::ForwardingListener {
+private:
+	SourceId &m_source_id;
+	SourceDirectory &m_directory;
+	socket::Address &m_source_address;
+	const Clock &m_clock;
+
+public:
+	SourceDirectoryListener(SourceId &source_id, SourceDirectory &directory,
+	                        socket::Address &source_address,
+	                        const Clock &clock, Demarshaller::Listener &next)
+	    : ForwardingListener(next),
+	      m_source_id(source_id),
+	      m_directory(directory),
+	      m_source_address(source_address),
+	      m_clock(clock)
+	{
+	}
+
+	bool filter(const Demarshaller::Header &header) override
+	{
+		if (!m_source_id.matches(header.source_name, header.source_hash)) {
+			m_directory.update(header, m_source_address, m_clock.now_ns());
+		}
+		return m_next.filter(header);
+	}
+};
+
+/**
+ * Passes heartbeats and pongs to the RttMonitor. Placed after the
+ * SubscriptionListener, such that only subscribed sources are pinged; records
+ * of datagrams rejected by the next listener are decoded but not forwarded.
+ */
+class RttListener : public Demarshaller::ForwardingListener {
+private:
+	RttMonitor &m_monitor;
+	const Clock &m_clock;
+	bool m_forward;
+
+public:
+	RttListener(RttMonitor &monitor, const Clock &clock,
+	            Demarshaller::Listener &next)
+	    : ForwardingListener(next),
+	      m_monitor(monitor),
+	      m_clock(clock),
+	      m_forward(false)
+	{
+	}
+
+	bool filter(const Demarshaller::Header &header) override
+	{
+		m_forward = m_next.filter(header);
+		return true;
+	}
+
+	void on_position_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::PositionSensor &position) override
+	{
+		if (m_forward) {
+			m_next.on_position_sensor(header, position);
+		}
+	}
+
+	void on_velocity_sensor(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::VelocitySensor &velocity) override
+	{
+		if (m_forward) {
+			m_next.on_velocity_sensor(header, velocity);
+		}
+	}
+
+	void on_telemetry(const Demarshaller::Header &header,
+	                  const Demarshaller::Telemetry &telemetry) override
+	{
+		if (m_forward) {
+			m_next.on_telemetry(header, telemetry);
+		}
+	}
+
+	void on_set_duty_cycle(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::SetDutyCycle &set_duty_cycle) override
+	{
+		if (m_forward) {
+			m_next.on_set_duty_cycle(header, set_duty_cycle);
+		}
+	}
+
+	void on_set_position_target(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::SetTarget &set_target) override
+	{
+		if (m_forward) {
+			m_next.on_set_position_target(header, set_target);
+		}
+	}
+
+	void on_set_velocity_target(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::SetTarget &set_target) override
+	{
+		if (m_forward) {
+			m_next.on_set_velocity_target(header, set_target);
+		}
+	}
+
+	void on_trajectory(const Demarshaller::Header &header,
+	                   const Demarshaller::Trajectory &trajectory) override
+	{
+		if (m_forward) {
+			m_next.on_trajectory(header, trajectory);
+		}
+	}
+
+	void on_trajectory_underrun(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::TrajectoryUnderrun &underrun) override
+	{
+		if (m_forward) {
+			m_next.on_trajectory_underrun(header, underrun);
+		}
+	}
+
+	void on_sensor_values(const Demarshaller::Header &header,
+	                      const Demarshaller::SensorValues &sensor) override
+	{
+		if (m_forward) {
+			m_next.on_sensor_values(header, sensor);
+		}
+	}
+
+	void on_set_sensor_mode(
+	    const Demarshaller::Header &header,
+	    const Demarshaller::SetSensorMode &set_sensor_mode) override
+	{
+		if (m_forward) {
+			m_next.on_set_sensor_mode(header, set_sensor_mode);
+		}
 	}
 
 	void on_heartbeat(const Demarshaller::Header &header) override
 	{
-		const auto &ip = m_source_address;
-		std::cout << json({{"source_name", header.source_name},
-		                   {"source_hash", header.source_hash},
-		                   {"ip", {ip.a, ip.b, ip.c, ip.d}},
-		                   {"port", ip.port},
-		                   {"seq", header.sequence},
-		                   {"type", "heartbeat"}})
-		          << std::endl;
+		m_monitor.on_heartbeat(header);
+		if (m_forward) {
+			m_next.on_heartbeat(header);
+		}
+	}
+
+	void on_reset(const Demarshaller::Header &header) override
+	{
+		if (m_forward) {
+			m_next.on_reset(header);
+		}
+	}
+
+	void on_ping(const Demarshaller::Header &header,
+	             const Demarshaller::Ping &ping) override
+	{
+		if (m_forward) {
+			m_next.on_ping(header, ping);
+		}
+	}
+
+	void on_pong(const Demarshaller::Header &header,
+	             const Demarshaller::Pong &pong) override
+	{
+		m_monitor.on_pong(header, pong, m_clock.now_ns());
+		if (m_forward) {
+			m_next.on_pong(header, pong);
+		}
+	}
+
+	void on_report_mode(const Demarshaller::Header &header,
+	                    const Demarshaller::ReportMode &mode) override
+	{
+		if (m_forward) {
+			m_next.on_report_mode(header, mode);
+		}
+	}
+
+	void on_subscribe(const Demarshaller::Header &header,
+	                  const Demarshaller::Subscribe &subscribe) override
+	{
+		if (m_forward) {
+			m_next.on_subscribe(header, subscribe);
+		}
+	}
+
+	void on_stream(const Demarshaller::Header &header,
+	               const Demarshaller::Stream &stream) override
+	{
+		if (m_forward) {
+			m_next.on_stream(header, stream);
+		}
 	}
 };
 
+/**
+ * Converts a floating point controller parameter to the fixed-point
+ * representation used on the wire.
+ */
+static int32_t to_milli(double value)
+{
+	return int32_t(std::round(value * 1000.0));
+}
+
+/**
+ * Sends the trajectory described by the given JSON message.
+ */
+static void write_trajectory(Marshaller &marshaller, const json &msg)
+{
+	const std::string device = msg["device"].get<std::string>();
+	const std::string mode = msg.value("mode", "duty_cycle");
+	const std::string interpolation = msg.value("interpolation", "linear");
+	const std::string underrun = msg.value("underrun", "hold");
+
+	uint8_t options = 0;
+	if (interpolation == "cubic") {
+		options |= TRAJECTORY_CUBIC;
+	}
+	if (underrun == "stop") {
+		options |= TRAJECTORY_STOP_ON_UNDERRUN;
+	}
+	if (msg.value("start", false)) {
+		options |= TRAJECTORY_START;
+	}
+	if (msg.value("end", false)) {
+		options |= TRAJECTORY_END;
+	}
+
+	const json &points = msg["points"];
+	std::vector<TrajectoryPoint> buf(points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		buf[i].time = points[i][0].get<uint32_t>();
+		buf[i].value = points[i][1].get<int32_t>();
+	}
+	marshaller.write_trajectory_chunked(
+	    device.c_str(),
+	    (mode == "position") ? TRAJECTORY_MODE_POSITION
+	                         : TRAJECTORY_MODE_DUTY_CYCLE,
+	    options, buf.data(), buf.size());
+}
+
+/**
+ * Sends a command decoded by the CommandParser.
+ */
+static void write_command(Marshaller &marshaller, const CommandParser &parser,
+                          const Command &cmd)
+{
+	switch (cmd.type) {
+		case Command::Type::SET_DUTY_CYCLE:
+			marshaller.write_set_duty_cycle(cmd.device_name, cmd.value);
+			break;
+		case Command::Type::SET_POSITION_TARGET:
+			marshaller.write_set_position_target(cmd.device_name, cmd.value,
+			                                     cmd.kp, cmd.ki, cmd.kd);
+			break;
+		case Command::Type::SET_VELOCITY_TARGET:
+			marshaller.write_set_velocity_target(cmd.device_name, cmd.value,
+			                                     cmd.kp, cmd.ki, cmd.kd);
+			break;
+		case Command::Type::TRAJECTORY:
+			marshaller.write_trajectory_chunked(
+			    cmd.device_name, cmd.trajectory_mode, cmd.trajectory_options,
+			    parser.points(cmd), cmd.n_points);
+			break;
+		case Command::Type::SET_SENSOR_MODE:
+			marshaller.write_set_sensor_mode(cmd.device_name, cmd.mode);
+			break;
+		case Command::Type::RESET:
+			marshaller.write_reset();
+			break;
+	}
+}
+
+/**
+ * Size of the buffer holding incoming commands; this limits the length of a
+ * single line.
+ */
+static constexpr size_t STDIN_BUF_SIZE = 1 << 20;
+
 static void make_nonblock(int fd)
 {
 	int flags = err(fcntl(fd, F_GETFL));
@@ -100,6 +637,17 @@ int main(int argc, const char *argv[])
 {
 	int port;
 	std::string device_name = "EV3_CLIENT";
+	bool binary = false;
+	std::string state_table_path;
+	std::string record_path;
+	int conflate_ms = 0;
+	int ping_rate = 0;
+	int ping_report_ms = 1000;
+	int telemetry_period = 0;
+	Predictor::Config predictor_config;
+	size_t output_capacity = OutputBuffer::DEFAULT_CAPACITY;
+	OutputBuffer::Policy overflow_policy = OutputBuffer::Policy::DROP;
+	Subscription subscription;
 
 	Argparse(argv[0],
 	         "Dispatches incoming EV3 Event Broker messages as JSON on stdout "
@@ -115,15 +663,142 @@ int main(int argc, const char *argv[])
 		             device_name = value;
 		             return true;
 	             })
+	    .add_arg("format",
+	             "Output format; either \"json\" for one JSON object per line "
+	             "or \"binary\" for fixed-layout little-endian records",
+	             "json",
+	             [&](const char *value) -> bool {
+		             binary = strcmp(value, "binary") == 0;
+		             return binary || strcmp(value, "json") == 0;
+	             })
+	    .add_arg("state-table",
+	             "File in which the latest state of each remote device is "
+	             "published for other processes; use a path in /dev/shm for "
+	             "a shared memory segment or \"none\" to disable",
+	             "none",
+	             [&](const char *value) -> bool {
+		             state_table_path =
+		                 (strcmp(value, "none") == 0) ? "" : value;
+		             return true;
+	             })
+	    .add_arg("record",
+	             "Appends all received datagrams with their kernel receive "
+	             "timestamps to the given file for later replay with "
+	             "ev3_broker_replay; \"none\" disables recording",
+	             "none",
+	             [&](const char *value) -> bool {
+		             record_path = (strcmp(value, "none") == 0) ? "" : value;
+		             return true;
+	             })
+	    .add_arg("conflate",
+	             "Interval in milliseconds in which the latest record per "
+	             "source, device and type is written; older records received "
+	             "in the same interval are discarded. Zero writes all records "
+	             "immediately",
+	             "0",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             conflate_ms = strtol(value, &endptr, 10);
+		             return *endptr == '\0' && conflate_ms >= 0;
+	             })
+	    .add_arg("output-buffer",
+	             "Size in bytes of the buffer holding output that could not "
+	             "be written to stdout yet",
+	             "4194304",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             const long long size = strtoll(value, &endptr, 10);
+		             output_capacity = size_t(size);
+		             return *endptr == '\0' &&
+		                    size >= int64_t(OutputBuffer::MIN_CAPACITY);
+	             })
+	    .add_arg("overflow",
+	             "What to do if the output buffer is full: \"drop\" discards "
+	             "the buffered output, \"conflate\" only writes the latest "
+	             "record per source, device and type until the buffer is "
+	             "empty, \"block\" waits for the reader",
+	             "drop",
+	             [&](const char *value) -> bool {
+		             return OutputBuffer::parse_policy(value, overflow_policy);
+	             })
+	    .add_arg("telemetry-period",
+	             "Requests a separate stream of the subscribed motor "
+	             "positions, velocities and sensor values from each server "
+	             "at this period in milliseconds instead of using the "
+	             "broadcast; zero uses the broadcast",
+	             "0",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             telemetry_period = strtol(value, &endptr, 10);
+		             return *endptr == '\0' && telemetry_period >= 0;
+	             })
+	    .add_arg("ping-rate",
+	             "Number of pings sent to each server per second to measure "
+	             "the round trip time; zero disables pinging",
+	             "0",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             ping_rate = strtol(value, &endptr, 10);
+		             return *endptr == '\0' && ping_rate >= 0 &&
+		                    ping_rate <= 1000;
+	             })
+	    .add_arg("ping-report",
+	             "Interval in milliseconds in which round trip time "
+	             "statistics are written if --ping-rate is non-zero",
+	             "1000",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             ping_report_ms = strtol(value, &endptr, 10);
+		             return *endptr == '\0' && ping_report_ms > 0;
+	             })
+	    .add_arg("predict",
+	             "Adds the motor positions extrapolated to the current time "
+	             "to the output; either \"none\", \"velocity\" (constant "
+	             "velocity) or \"motor:TAU,MAX_SPEED\" (first-order motor "
+	             "model driven by the last known duty cycle, with the time "
+	             "constant TAU in milliseconds and the speed at 100% duty "
+	             "cycle in degrees per second)",
+	             "none",
+	             [&](const char *value) -> bool {
+		             return predictor_config.parse(value);
+	             })
+	    .add_arg("predict-lead",
+	             "Time in milliseconds the positions are extrapolated beyond "
+	             "the current time, e.g. half the round trip time plus the "
+	             "sampling period",
+	             "10",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             predictor_config.lead = strtod(value, &endptr) * 1e-3;
+		             return *endptr == '\0' && predictor_config.lead >= 0.0;
+	             })
+	    .add_arg("subscribe",
+	             "Comma-separated list of SOURCE[:HASH][/DEVICE] patterns; "
+	             "only messages matching at least one pattern are written. "
+	             "Patterns may contain the wildcards \"*\" and \"?\"",
+	             "*",
+	             [&](const char *value) -> bool {
+		             return strcmp(value, "*") == 0 || subscription.add(value);
+	             })
 	    .parse(argc, argv);
 
 	socket::Address source_address(0, 0, 0, 0, 0);
 	socket::Address listen_address(0, 0, 0, 0, port);
 	socket::Address target_address(0, 0, 0, 0, port);
 	socket::UDP sock(listen_address);
-	printf("Listening on %d.%d.%d.%d:%d as \"%s\"...\n", listen_address.a,
-	       listen_address.b, listen_address.c, listen_address.d, port,
-	       device_name.c_str());
+	std::unique_ptr<Recorder> recorder;
+	if (!record_path.empty()) {
+		recorder.reset(new Recorder(record_path.c_str()));
+		sock.enable_timestamps();
+	}
+	fprintf(binary ? stderr : stdout,
+	        "Listening on %d.%d.%d.%d:%d as \"%s\"...\n", listen_address.a,
+	        listen_address.b, listen_address.c, listen_address.d, port,
+	        device_name.c_str());
+	fflush(stdout);
+
+	// All timestamps taken by the client are read from this clock
+	Clock &clock = Clock::monotonic();
 
 	SourceId source_id(device_name.c_str());
 	Marshaller marshaller(
@@ -135,66 +810,508 @@ int main(int argc, const char *argv[])
 	    source_id.name(), source_id.hash());
 
 	Demarshaller demarshaller;
-	Listener listener(source_id, source_address);
+	OutputBuffer output(STDOUT_FILENO, output_capacity, overflow_policy);
+	JsonWriter json_writer(output);
+	BinaryWriter binary_writer(output);
+	Predictor predictor(predictor_config);
+	JsonListener json_listener(source_id, source_address, json_writer,
+	                           &predictor, clock);
+	BinaryListener binary_listener(source_id, source_address, binary_writer,
+	                               &predictor, clock);
+	Demarshaller::Listener &output_listener =
+	    binary ? static_cast<Demarshaller::Listener &>(binary_listener)
+	           : json_listener;
+
+	// Optionally coalesce the output; the state table still sees all records.
+	// With the "conflate" overflow policy, records are only coalesced while
+	// the output buffer is congested.
+	const bool conflate_on_overflow =
+	    overflow_policy == OutputBuffer::Policy::CONFLATE;
+	Demarshaller::Listener *next_listener = &output_listener;
+	std::unique_ptr<Conflator> conflator;
+	if (conflate_ms > 0 || conflate_on_overflow) {
+		conflator.reset(new Conflator(*next_listener, source_address));
+		conflator->set_passthrough(conflate_ms == 0);
+		next_listener = conflator.get();
+	}
+
+	std::unique_ptr<StateTable> state_table;
+	std::unique_ptr<StateTableListener> state_table_listener;
+	if (!state_table_path.empty()) {
+		state_table.reset(new StateTable(state_table_path.c_str(),
+		                                 StateTable::DEFAULT_N_SLOTS));
+		state_table_listener.reset(
+		    new StateTableListener(*state_table, clock, *next_listener));
+		next_listener = state_table_listener.get();
+	}
+	std::unique_ptr<PredictorListener> predictor_listener;
+	if (predictor.enabled()) {
+		predictor_listener.reset(
+		    new PredictorListener(predictor, clock, *next_listener));
+		next_listener = predictor_listener.get();
+	}
+	SourceDirectory directory;
+	RttMonitor rtt_monitor(directory, source_id);
+	std::unique_ptr<RttListener> rtt_listener;
+	if (ping_rate > 0) {
+		rtt_listener.reset(
+		    new RttListener(rtt_monitor, clock, *next_listener));
+		next_listener = rtt_listener.get();
+	}
+	SubscriptionListener subscription_listener(subscription, *next_listener);
+	next_listener = &subscription_listener;
+	StreamListener stream_listener(source_id, directory, source_address,
+	                               clock, *next_listener);
+	stream_listener.set_period(telemetry_period);
+	next_listener = &stream_listener;
+	SourceDirectoryListener listener(source_id, directory, source_address,
+	                                 clock, *next_listener);
+
+	// Passes the records to the output buffer and reports discarded output
+	uint64_t dropped_bytes = 0;
+	auto flush_output = [&]() {
+		if (binary) {
+			binary_writer.flush();
+		}
+		else {
+			json_writer.flush();
+		}
+		if (output.dropped_bytes() != dropped_bytes) {
+			dropped_bytes = output.dropped_bytes();
+			if (binary) {
+				binary_writer.overflow(dropped_bytes);
+				binary_writer.flush();
+			}
+			else {
+				json_writer.begin("overflow");
+				json_writer.field("dropped_bytes", int64_t(dropped_bytes));
+				json_writer.end();
+				json_writer.flush();
+			}
+		}
+	};
+
+	// Writes the records coalesced by the conflator followed by a summary
+	auto emit_conflated = [&]() {
+		uint32_t n_updates;
+		const uint32_t n_records = conflator->emit(n_updates);
+		if (n_updates == 0) {
+			return;
+		}
+		if (binary) {
+			binary_writer.conflate(n_updates, n_records);
+		}
+		else {
+			json_writer.begin("conflate");
+			json_writer.field("updates", int64_t(n_updates));
+			json_writer.field("records", int64_t(n_records));
+			json_writer.end();
+		}
+		flush_output();
+	};
 
 	auto handle_sock = [&]() -> bool {
 		socket::Message msg;
-		if (!sock.recv(source_address, msg)) {
+		if (recorder) {
+			int64_t t_ns;
+			if (!sock.recv(source_address, msg, t_ns)) {
+				return false;
+			}
+			recorder->record(t_ns, source_address, msg.buf(), msg.size());
+		}
+		else if (!sock.recv(source_address, msg)) {
 			return false;
 		}
 		demarshaller.parse(listener, msg.buf(), msg.size());
+		flush_output();
+		if (conflate_on_overflow && conflate_ms == 0 && output.congested()) {
+			conflator->set_passthrough(false);
+		}
 		return true;
 	};
 
-	size_t line_buf_size = 1024;
-	char *line_buf = static_cast<char *>(malloc(line_buf_size));
-	make_nonblock(STDIN_FILENO);
-	auto handle_stdin = [&]() -> bool {
-		try {
-			// Read a new line from standard in
-			ssize_t ret = getline(&line_buf, &line_buf_size, stdin);
-			if (ret < 0 &&
-			    (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
-				return true;
-			}
-			else if (ret < 0) {
-				return false;
+	auto handle_output = [&]() -> bool {
+		output.drain();
+		if (conflate_on_overflow && conflate_ms == 0 &&
+		    !conflator->passthrough() && !output.pending()) {
+			emit_conflated();
+			conflator->set_passthrough(true);
+		}
+		return true;
+	};
+
+	auto write_error = [&](const char *what) {
+		if (binary) {
+			binary_writer.error(what);
+		}
+		else {
+			// Limit the length of the message such that the escaped string
+			// fits into a single record
+			char buf[128];
+			snprintf(buf, sizeof(buf), "%s", what);
+			json_writer.begin("error");
+			json_writer.field("what", buf);
+			json_writer.end();
+		}
+		flush_output();
+	};
+
+	// Commands addressed to a different target than the buffered ones are
+	// sent in a separate datagram
+	auto set_target = [&](const socket::Address &address) {
+		if (address != target_address) {
+			marshaller.flush();
+			target_address = address;
+		}
+	};
+
+	// Tells the predictor about commands sent to the current target that
+	// change the duty cycle of a motor
+	auto predict_command = [&](Command::Type type, const char *device,
+	                           int32_t value) {
+		if (!predictor.enabled()) {
+			return;
+		}
+		const SourceDirectory::Entry *entry = directory.find(target_address);
+		if (!entry) {
+			return;
+		}
+		switch (type) {
+			case Command::Type::SET_DUTY_CYCLE:
+				predictor.duty_cycle(entry->name, device, value);
+				break;
+			case Command::Type::SET_POSITION_TARGET:
+			case Command::Type::SET_VELOCITY_TARGET:
+			case Command::Type::TRAJECTORY:
+				predictor.clear_duty_cycle(entry->name, device);
+				break;
+			case Command::Type::RESET:
+				predictor.clear_duty_cycle(entry->name, nullptr);
+				break;
+			case Command::Type::SET_SENSOR_MODE:
+				break;
+		}
+	};
+
+	// Pings all servers; each ping is sent in its own datagram
+	auto handle_ping_timer = [&]() -> bool {
+		rtt_monitor.ping([&](const socket::Address &address, uint32_t nonce) {
+			set_target(address);
+			marshaller.write_ping(nonce, clock.now_ns()).flush();
+		});
+		return true;
+	};
+
+	// Writes the round trip time statistics and the clock offset estimates
+	// of all pinged servers
+	auto handle_ping_report_timer = [&]() -> bool {
+		const int64_t t_ns = clock.now_ns();
+		rtt_monitor.report([&](const RttMonitor::Source &source) {
+			const LatencyHistogram &h = source.histogram;
+			const ClockEstimator &estimator = source.clock;
+			const int64_t offset = estimator.offset(t_ns);
+			const int64_t skew = std::llround(estimator.skew() * 1e9);
+			const int64_t delay = estimator.delay() / 1000;
+			if (binary) {
+				binary_writer.rtt(source.header, source.address,
+				                  source.n_sent, source.n_received,
+				                  h.percentile(0.5), h.percentile(0.95),
+				                  h.percentile(0.99), h.max());
+				if (estimator.valid()) {
+					binary_writer.clock(
+					    source.header, source.address, offset,
+					    int32_t(std::max<int64_t>(
+					        std::min<int64_t>(skew, INT32_MAX), INT32_MIN)),
+					    uint32_t(delay));
+				}
+			}
+			else {
+				json_writer.begin(source.header, source.address, "rtt");
+				json_writer.field("sent", int64_t(source.n_sent));
+				json_writer.field("received", int64_t(source.n_received));
+				json_writer.field_fixed("p50", h.percentile(0.5), 3);
+				json_writer.field_fixed("p95", h.percentile(0.95), 3);
+				json_writer.field_fixed("p99", h.percentile(0.99), 3);
+				json_writer.field_fixed("max", h.max(), 3);
+				json_writer.end();
+				if (estimator.valid()) {
+					json_writer.begin(source.header, source.address, "clock");
+					json_writer.field_fixed("offset", offset, 6);
+					json_writer.field_fixed("skew", skew, 3);
+					json_writer.field_fixed("delay", delay, 3);
+					json_writer.end();
+				}
+			}
+		});
+		flush_output();
+		return true;
+	};
+
+	// Requests a stream from every known source matching the subscription,
+	// or cancels the streams if the period is zero. Requests must be renewed
+	// before they expire on the server.
+	auto request_streams = [&](int period) {
+		for (size_t i = 0; i < directory.size(); i++) {
+			const SourceDirectory::Entry &entry = directory[i];
+			Demarshaller::Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.source_name, entry.name, sizeof(entry.name));
+			memcpy(header.source_hash, entry.hash, sizeof(entry.hash));
+			const Subscription::Mask mask = subscription.match_source(header);
+			if (!mask) {
+				continue;
 			}
+			const char *patterns[SUBSCRIBE_MAX_PATTERNS];
+			const size_t n_patterns = subscription.device_patterns(
+			    mask, patterns, SUBSCRIBE_MAX_PATTERNS);
+			set_target(entry.address);
+			marshaller.write_subscribe(period, patterns, n_patterns);
+		}
+		marshaller.flush();
+	};
+
+	auto handle_stream_timer = [&]() -> bool {
+		if (telemetry_period > 0) {
+			request_streams(telemetry_period);
+		}
+		return true;
+	};
 
-			// Try to parse the line as JSON
-			json msg = json::parse(line_buf);
+	// Generic handler for commands the CommandParser does not understand
+	auto handle_json = [&](const json &msg) {
+		// Replace the subscription patterns; an empty list subscribes to all
+		// messages
+		if (msg["type"].get<std::string>() == "subscribe") {
+			Subscription new_subscription;
+			for (const json &pattern : msg["patterns"]) {
+				const std::string str = pattern.get<std::string>();
+				if (!new_subscription.add(str.c_str())) {
+					write_error(("Invalid pattern \"" + str + "\"").c_str());
+					return;
+				}
+			}
+			subscription = new_subscription;
+			rtt_monitor.reset_pingable();
 
-			// Parse the target address and port
-			target_address.a = msg["ip"][0].get<int>();
-			target_address.b = msg["ip"][1].get<int>();
-			target_address.c = msg["ip"][2].get<int>();
-			target_address.d = msg["ip"][3].get<int>();
-			target_address.port = msg["port"].get<int>();
+			// Optionally change the period of the requested streams
+			if (msg.count("period")) {
+				const int period = msg["period"].get<int>();
+				if (period < 0) {
+					write_error("Invalid period");
+					return;
+				}
+				if (period == 0 && telemetry_period > 0) {
+					request_streams(0);
+				}
+				telemetry_period = period;
+				stream_listener.set_period(telemetry_period);
+			}
+			handle_stream_timer();
+			return;
+		}
 
-			// Read message-type dependent information and send the
-			// corresponding message
-			const std::string type = msg["type"].get<std::string>();
-			if (type == "set_duty_cycle") {
-				std::string device = msg["device"].get<std::string>();
-				int duty_cycle = msg["duty_cycle"].get<int>();
-				marshaller.write_set_duty_cycle(device.c_str(), duty_cycle);
+		// Look up the target by name or parse the target address and port
+		if (msg.count("target")) {
+			const std::string name = msg["target"].get<std::string>();
+			const SourceDirectory::Entry *entry = directory.find(name.c_str());
+			if (!entry) {
+				write_error(("Unknown target \"" + name + "\"").c_str());
+				return;
 			}
-			else if (type == "reset") {
-				marshaller.write_reset();
+			set_target(entry->address);
+		}
+		else {
+			set_target(socket::Address(
+			    msg["ip"][0].get<int>(), msg["ip"][1].get<int>(),
+			    msg["ip"][2].get<int>(), msg["ip"][3].get<int>(),
+			    msg["port"].get<int>()));
+		}
+
+		// Read message-type dependent information and send the
+		// corresponding message
+		const std::string type = msg["type"].get<std::string>();
+		if (type == "set_duty_cycle") {
+			std::string device = msg["device"].get<std::string>();
+			int duty_cycle = msg["duty_cycle"].get<int>();
+			marshaller.write_set_duty_cycle(device.c_str(), duty_cycle);
+			predict_command(Command::Type::SET_DUTY_CYCLE, device.c_str(),
+			                duty_cycle);
+		}
+		else if (type == "set_position_target") {
+			std::string device = msg["device"].get<std::string>();
+			marshaller.write_set_position_target(
+			    device.c_str(), msg["position"].get<int>(),
+			    to_milli(msg.value("kp", 0.0)), to_milli(msg.value("ki", 0.0)),
+			    to_milli(msg.value("kd", 0.0)));
+			predict_command(Command::Type::SET_POSITION_TARGET, device.c_str(),
+			                0);
+		}
+		else if (type == "set_velocity_target") {
+			std::string device = msg["device"].get<std::string>();
+			marshaller.write_set_velocity_target(
+			    device.c_str(), msg["velocity"].get<int>(),
+			    to_milli(msg.value("kp", 0.0)), to_milli(msg.value("ki", 0.0)),
+			    to_milli(msg.value("kd", 0.0)));
+			predict_command(Command::Type::SET_VELOCITY_TARGET, device.c_str(),
+			                0);
+		}
+		else if (type == "trajectory") {
+			write_trajectory(marshaller, msg);
+			predict_command(Command::Type::TRAJECTORY,
+			                msg["device"].get<std::string>().c_str(), 0);
+		}
+		else if (type == "set_sensor_mode") {
+			std::string device = msg["device"].get<std::string>();
+			std::string mode = msg["mode"].get<std::string>();
+			marshaller.write_set_sensor_mode(device.c_str(), mode.c_str());
+		}
+		else if (type == "reset") {
+			marshaller.write_reset();
+			predict_command(Command::Type::RESET, nullptr, 0);
+		}
+	};
+
+	// Each line is either a single command or an array of commands. The
+	// commands of a line are sent in one datagram per target.
+	CommandParser parser;
+	auto handle_line = [&](const char *line) {
+		if (parser.parse(line)) {
+			// Resolve the targets given by name
+			socket::Address targets[CommandParser::MAX_COMMANDS];
+			bool done[CommandParser::MAX_COMMANDS] = {false};
+			for (size_t i = 0; i < parser.size(); i++) {
+				const Command &cmd = parser[i];
+				targets[i] = cmd.target;
+				if (cmd.target_name[0]) {
+					const SourceDirectory::Entry *entry =
+					    directory.find(cmd.target_name);
+					if (entry) {
+						targets[i] = entry->address;
+					}
+					else {
+						char what[64];
+						snprintf(what, sizeof(what), "Unknown target \"%s\"",
+						         cmd.target_name);
+						write_error(what);
+						done[i] = true;
+					}
+				}
+			}
+
+			for (size_t i = 0; i < parser.size(); i++) {
+				if (done[i]) {
+					continue;
+				}
+				set_target(targets[i]);
+				for (size_t j = i; j < parser.size(); j++) {
+					if (!done[j] && targets[j] == targets[i]) {
+						const Command &cmd = parser[j];
+						write_command(marshaller, parser, cmd);
+						predict_command(cmd.type, cmd.device_name, cmd.value);
+						done[j] = true;
+					}
+				}
 			}
 		}
-		catch (json::exception &e) {
-			std::cout << json({{"type", "error"}, {"what", e.what()}})
-			          << std::endl;
+		else {
+			try {
+				json msg = json::parse(line);
+				if (msg.is_array()) {
+					for (const json &elem : msg) {
+						handle_json(elem);
+					}
+				}
+				else {
+					handle_json(msg);
+				}
+			}
+			catch (json::exception &e) {
+				write_error(e.what());
+			}
 		}
 		marshaller.flush();
-		return true;
 	};
 
-	EventLoop()
-	    .register_event(sock, handle_sock)
+	// Read standard input in chunks and handle all complete lines; the buffer
+	// is allocated once
+	std::vector<char> line_buf(STDIN_BUF_SIZE);
+	size_t line_buf_ptr = 0;
+	bool discard_line = false;
+	make_nonblock(STDIN_FILENO);
+	auto handle_stdin = [&]() -> bool {
+		const ssize_t ret = read(STDIN_FILENO, line_buf.data() + line_buf_ptr,
+		                         line_buf.size() - line_buf_ptr - 1);
+		if (ret < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+
+		// At the end of the input, handle a final line without line break
+		size_t n = line_buf_ptr + ret;
+		if (ret == 0 && n > 0) {
+			line_buf[n++] = '\n';
+		}
+
+		char *line = line_buf.data();
+		char *end = line_buf.data() + n;
+		char *nl;
+
+		// Drop the remainder of a line that did not fit into the buffer
+		if (discard_line) {
+			nl = static_cast<char *>(memchr(line, '\n', end - line));
+			if (!nl) {
+				return ret > 0;
+			}
+			line = nl + 1;
+			discard_line = false;
+		}
+
+		while ((nl = static_cast<char *>(memchr(line, '\n', end - line)))) {
+			*nl = '\0';
+			handle_line(line);
+			line = nl + 1;
+		}
+
+		// Keep the incomplete last line; discard it up to the next line break
+		// if it fills the buffer
+		line_buf_ptr = end - line;
+		if (line_buf_ptr == line_buf.size() - 1) {
+			write_error("Line too long");
+			line_buf_ptr = 0;
+			discard_line = true;
+		}
+		memmove(line_buf.data(), line, line_buf_ptr);
+		return ret > 0;
+	};
+
+	EventLoop loop(clock);
+	loop.register_event(sock, handle_sock)
 	    .register_event_fd(STDIN_FILENO, handle_stdin)
-	    .run();
+	    .register_output_fd(
+	        output.fd(), [&]() -> bool { return output.pending(); },
+	        handle_output);
+	loop.register_timer(SubscriberTable::TIMEOUT / 4, handle_stream_timer);
+	if (ping_rate > 0) {
+		loop.register_timer(std::max(1, 1000 / ping_rate), handle_ping_timer)
+		    .register_timer(ping_report_ms, handle_ping_report_timer);
+	}
+	if (conflate_ms > 0) {
+		loop.register_timer(conflate_ms, [&]() -> bool {
+			// Keep coalescing while the reader does not keep up
+			if (!conflate_on_overflow || !output.congested()) {
+				emit_conflated();
+			}
+			return true;
+		});
+	}
+	loop.run();
+
+	// Write the remaining output before exiting
+	flush_output();
+	output.drain_blocking();
+	if (dropped_bytes > 0) {
+		fprintf(stderr, "Discarded %llu bytes of output\n",
+		        (unsigned long long)dropped_bytes);
+	}
 
 	return 0;
 }
@@ -0,0 +1,204 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <time.h>
+#include <unistd.h>
+
+#include <ev3_event_broker/argparse.hpp>
+#include <ev3_event_broker/binary_writer.hpp>
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/json_writer.hpp>
+#include <ev3_event_broker/marshaller.hpp>
+#include <ev3_event_broker/output_buffer.hpp>
+#include <ev3_event_broker/output_listener.hpp>
+#include <ev3_event_broker/recording.hpp>
+#include <ev3_event_broker/socket.hpp>
+#include <ev3_event_broker/source_id.hpp>
+
+using namespace ev3_event_broker;
+
+/**
+ * Parses a non-negative floating point number.
+ */
+static bool parse_non_negative(const char *value, double &tar)
+{
+	char *endptr;
+	tar = strtod(value, &endptr);
+	return (*endptr == '\0') && (tar >= 0.0);
+}
+
+/**
+ * Parses an IPv4 address of the form "A.B.C.D".
+ */
+static bool parse_address(const char *value, socket::Address &addr)
+{
+	unsigned int a, b, c, d;
+	char tail;
+	if (sscanf(value, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 ||
+	    a > 255 || b > 255 || c > 255 || d > 255) {
+		return false;
+	}
+	addr = socket::Address(a, b, c, d, addr.port);
+	return true;
+}
+
+/**
+ * Sleeps until the given CLOCK_MONOTONIC time in nanoseconds.
+ */
+static void sleep_until(int64_t t_ns)
+{
+	struct timespec ts;
+	ts.tv_sec = t_ns / 1000000000;
+	ts.tv_nsec = t_ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+	       EINTR) {
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	std::string path;
+	double speed, start;
+	bool has_target = false;
+	socket::Address target;
+	std::string format;
+
+	Argparse(argv[0],
+	         "Replays a recording made with \"ev3_broker_client --record\", "
+	         "either by sending the datagrams to a UDP port or by writing "
+	         "them to stdout in the client output format.")
+	    .add_arg("file", "The recording to replay", nullptr,
+	             [&](const char *value) -> bool {
+		             path = value;
+		             return true;
+	             })
+	    .add_arg("speed",
+	             "Playback speed relative to the original timing; zero "
+	             "replays as fast as possible",
+	             "1",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, speed);
+	             })
+	    .add_arg("start",
+	             "Offset in seconds from the beginning of the recording at "
+	             "which the replay starts",
+	             "0",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, start);
+	             })
+	    .add_arg("target",
+	             "IPv4 address the datagrams are additionally sent to; "
+	             "\"none\" does not send them",
+	             "none",
+	             [&](const char *value) -> bool {
+		             if (strcmp(value, "none") == 0) {
+			             return true;
+		             }
+		             has_target = true;
+		             return parse_address(value, target);
+	             })
+	    .add_arg("port", "The UDP port the datagrams are sent to", "4721",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             target.port = strtol(value, &endptr, 10);
+		             return *endptr == '\0';
+	             })
+	    .add_arg("format",
+	             "Output format; either \"json\", \"binary\" or \"none\"; "
+	             "without a target \"none\" still parses the datagrams",
+	             "json",
+	             [&](const char *value) -> bool {
+		             format = value;
+		             return format == "json" || format == "binary" ||
+		                    format == "none";
+	             })
+	    .parse(argc, argv);
+
+	RecordingReader reader(path.c_str());
+	RecordingReader::Datagram datagram;
+	if (!reader.next(datagram)) {
+		fprintf(stderr, "Recording is empty\n");
+		return EXIT_FAILURE;
+	}
+	const int64_t t0_rec = datagram.t_ns + int64_t(std::llround(start * 1e9));
+	reader.seek(t0_rec);
+
+	// Datagrams are sent if a target is given and decoded unless the format
+	// is "none"; without a target they are always parsed
+	std::unique_ptr<socket::UDP> sock;
+	if (has_target) {
+		sock.reset(new socket::UDP(socket::Address(0, 0, 0, 0, 0)));
+	}
+	OutputBuffer output(STDOUT_FILENO, OutputBuffer::DEFAULT_CAPACITY,
+	                    OutputBuffer::Policy::BLOCK);
+	JsonWriter json_writer(output);
+	BinaryWriter binary_writer(output);
+	SourceId source_id("EV3_REPLAY");
+	socket::Address source_address;
+	JsonListener json_listener(source_id, source_address, json_writer);
+	BinaryListener binary_listener(source_id, source_address, binary_writer);
+	Demarshaller::Listener null_listener;
+	Demarshaller::Listener &listener =
+	    (format == "json")
+	        ? static_cast<Demarshaller::Listener &>(json_listener)
+	        : (format == "binary") ? binary_listener : null_listener;
+
+	Demarshaller demarshaller;
+	const int64_t t0 = Clock::monotonic().now_ns();
+	uint64_t n_datagrams = 0, n_bytes = 0;
+	while (reader.next(datagram)) {
+		// Wait until the datagram is due; write pending output first
+		if (speed > 0.0) {
+			const int64_t t = t0 + int64_t((datagram.t_ns - t0_rec) / speed);
+			if (t > Clock::monotonic().now_ns()) {
+				json_writer.flush();
+				binary_writer.flush();
+				sleep_until(t);
+			}
+		}
+
+		if (sock) {
+			sock->send(target, socket::Message(datagram.buf, datagram.size));
+		}
+		if (!sock || format != "none") {
+			source_address = datagram.address;
+			demarshaller.parse(listener, datagram.buf, datagram.size);
+		}
+		n_datagrams++;
+		n_bytes += datagram.size;
+	}
+	json_writer.flush();
+	binary_writer.flush();
+	output.drain_blocking();
+
+	const double dt = double(Clock::monotonic().now_ns() - t0) * 1e-9;
+	fprintf(stderr,
+	        "Replayed %llu datagrams (%llu bytes) in %.3f s, %.0f datagrams "
+	        "per second\n",
+	        (unsigned long long)n_datagrams, (unsigned long long)n_bytes, dt,
+	        double(n_datagrams) / std::max(dt, 1e-9));
+	return EXIT_SUCCESS;
+}
@@ -17,188 +17,83 @@
  */
 
 #include <cstdio>
-#include <cstring>
-#include <system_error>
+#include <cstdlib>
 
 #include <ev3_event_broker/argparse.hpp>
 #include <ev3_event_broker/event_loop.hpp>
-#include <ev3_event_broker/marshaller.hpp>
 #include <ev3_event_broker/motors.hpp>
-#include <ev3_event_broker/socket.hpp>
-#include <ev3_event_broker/source_id.hpp>
+#include <ev3_event_broker/sensors.hpp>
+#include <ev3_event_broker/server.hpp>
 
-using namespace ev3_event_broker;
-
-class Listener : public Demarshaller::Listener {
-private:
-	bool &m_conflict;
-	SourceId &m_source_id;
-	Motors &m_motors;
-
-public:
-	Listener(bool &conflict, SourceId &source_id, Motors &motors)
-	    : m_conflict(conflict), m_source_id(source_id), m_motors(motors)
-	{
-	}
-
-	/**
-	 * Implementation of the filter() function. Discards messages originating
-	 * from this device.
-	 */
-	bool filter(const Demarshaller::Header &header) override
-	{
-		return (strcmp(header.source_name, m_source_id.name()) != 0) ||
-		       (strcmp(header.source_hash, m_source_id.hash()) != 0);
-	}
-
-	void on_set_duty_cycle(
-	    const Demarshaller::Header &,
-	    const Demarshaller::SetDutyCycle &set_duty_cycle) override
-	{
-		try {
-			Motor *motor = m_motors.find(set_duty_cycle.device_name);
-			if (motor) {
-				motor->set_duty_cycle(set_duty_cycle.duty_cycle);
-			}
-		}
-		catch (std::system_error &) {
-			m_motors.rescan();
-		}
-	}
-
-	void on_reset(const Demarshaller::Header &) override
-	{
-		for (auto &motor : m_motors.motors()) {
-			try {
-				motor->reset();
-			}
-			catch (std::system_error &) {
-				// Do nothing here, just continue resetting
-			}
-		}
-	}
+#ifdef VIRTUAL_MOTORS
+#include <ev3_event_broker/virtual_motor.hpp>
+#include <ev3_event_broker/virtual_motor_bank.hpp>
+#endif
 
-	void on_heartbeat(const Demarshaller::Header &header) override
-	{
-		m_conflict |= (strcmp(header.source_name, m_source_id.name()) == 0);
-	}
-};
+using namespace ev3_event_broker;
 
 int main(int argc, const char *argv[])
 {
 	uint16_t port;
+	Server::Config config;
 #ifndef VIRTUAL_MOTORS
-	std::string device_name = "EV3";
+	config.name = "EV3";
 #else
-	std::string device_name = "EV3_VIRT";
+	config.name = "EV3_VIRT";
 #endif
 
-	Argparse(argv[0],
-	         "Dispatches incoming EV3 Event Broker messages as JSON on stdout "
-	         "and reads JSON commands from stdin.")
+	Argparse argparse(argv[0],
+	                  "Broadcasts the state of all motors and sensors attached "
+	                  "to this device and executes incoming commands.");
+	argparse
 	    .add_arg("port", "The UDP port to listen on", "4721",
 	             [&](const char *value) -> bool {
 		             char *endptr;
 		             port = strtol(value, &endptr, 10);
 		             return *endptr == '\0';
 	             })
-	    .add_arg("name", "Name of this device", device_name.c_str(),
+	    .add_arg("name", "Name of this device", config.name.c_str(),
 	             [&](const char *value) -> bool {
-		             device_name = value;
+		             config.name = value;
 		             return true;
-	             })
-	    .parse(argc, argv);
+	             });
+	config.add_args(argparse).parse(argc, argv);
 
-	// Create the UDP socket and setup all addresses
-	socket::Address listen_address(0, 0, 0, 0, port);
-	socket::Address broadcast_address(255, 255, 255, 255, port);
-	socket::UDP sock(listen_address);
+	// Listen on all interfaces, broadcast to the same port
+	config.listen_address = socket::Address(0, 0, 0, 0, port);
+	config.broadcast_address = socket::Address(255, 255, 255, 255, port);
 	fprintf(stderr, "Listening on %d.%d.%d.%d:%d as \"%s\"...\n",
-	        listen_address.a, listen_address.b, listen_address.c,
-	        listen_address.d, port, device_name.c_str());
+	        config.listen_address.a, config.listen_address.b,
+	        config.listen_address.c, config.listen_address.d, port,
+	        config.name.c_str());
 
-	// Fetch all motors
+	// Fetch all motors and sensors
+#ifndef VIRTUAL_MOTORS
 	Motors motors;
-
-	// Create a marshaller instance with a randomized source_id and connect it
-	// to the socket
-	SourceId source_id(device_name.c_str());
-	Marshaller marshaller(
-	    [&](const uint8_t *buf, size_t buf_size) -> bool {
-		    socket::Message msg(buf, buf_size);
-		    sock.send(broadcast_address, msg);
-		    return true;
-	    },
-	    source_id.name(), source_id.hash());
-
-	// Setup the demarshaller for incoming messages, create a variable
-	// indicating whether there was a conflict or not.
-	bool conflict = false;
-	Listener listener(conflict, source_id, motors);
-	Demarshaller demarshaller;
-
-	// Periodically send all sensor data
-	bool sensor_broadcast_enabled = false;
-	auto handle_sensor_timer = [&]() -> bool {
-		if (!sensor_broadcast_enabled) {
-			return true;
-		}
-		try {
-			for (const auto &motor : motors.motors()) {
-				marshaller.write_position_sensor(motor->name(),
-				                                 motor->get_position());
-			}
-			marshaller.flush();
-		}
-		catch (std::system_error &e) {
-			motors.rescan();
-		}
-		return bool(marshaller);
-	};
-
-	// Rescan available motors from time to time
-	auto handle_rescan_timer = [&]() -> bool {
-		motors.rescan();
-		return true;
-	};
-
-	// Timer sending a regular heartbeat
-	int n_heartbeat = 0;
-	auto handle_hearbeat_timer = [&]() -> bool {
-		n_heartbeat++;
-		if (!sensor_broadcast_enabled && conflict) {
-			fprintf(stderr,
-			        "ERROR: Another device is already active with name \"%s\". Aborting.\n",
-			        source_id.name());
-			exit(EXIT_FAILURE);
-		}
-		else if (n_heartbeat > 4 && !conflict) {
-			sensor_broadcast_enabled = true;
-		}
-		marshaller.write_heartbeat();
-		marshaller.flush();
-		return true;
-	};
-
-	// Handle incoming commands
-	auto handle_sock = [&]() -> bool {
-		socket::Address addr;
-		socket::Message msg;
-		if (!sock.recv(addr, msg)) {
-			return false;  // Socket was closed
-		}
-		demarshaller.parse(listener, msg.buf(), msg.size());
+#else
+	// Simulate a motor attached to each output port
+	VirtualMotorBank bank(4);
+	Motors motors(nullptr);
+	for (char port = 'A'; port <= 'D'; port++) {
+		char name[17];
+		snprintf(name, sizeof(name), "motor_out%c", port);
+		motors.add(
+		    std::unique_ptr<Motor>(new VirtualMotor(name, bank, bank.add())));
+	}
+#endif
+	Sensors sensors;
+
+	// Run the server
+	Server server(config, motors, sensors);
+	EventLoop event_loop;
+	server.register_with(event_loop);
+#ifdef VIRTUAL_MOTORS
+	event_loop.register_timer(1, [&]() -> bool {
+		bank.step(event_loop.clock().now());
 		return true;
-	};
-
-	// Run the event loop
-	EventLoop()
-	    .register_timer(10, handle_sensor_timer)
-	    .register_timer(1000, handle_rescan_timer)
-	    .register_timer(250, handle_hearbeat_timer)
-	    .register_event(sock, handle_sock)
-	    .run();
+	});
+#endif
+	event_loop.run();
 
-	return 0;
+	return server.failed() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-
@@ -0,0 +1,270 @@
+/**
+ *  EV3 Event Broker -- Talk to Lego Robots using UDP
+ *  Copyright (C) 2019  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ev3_event_broker/argparse.hpp>
+#include <ev3_event_broker/clock.hpp>
+#include <ev3_event_broker/event_loop.hpp>
+#include <ev3_event_broker/motors.hpp>
+#include <ev3_event_broker/sensors.hpp>
+#include <ev3_event_broker/server.hpp>
+#include <ev3_event_broker/virtual_motor.hpp>
+#include <ev3_event_broker/virtual_motor_bank.hpp>
+
+using namespace ev3_event_broker;
+
+/**
+ * A simulated brick consisting of a set of in-memory motors and a server. The
+ * motor state is stored in a bank shared by all bricks.
+ */
+struct Brick {
+	Motors motors;
+	Sensors sensors;
+	std::unique_ptr<Server> server;
+
+	Brick(const Server::Config &config, size_t n_motors,
+	      VirtualMotorBank &bank, const VirtualMotorBank::Params &params,
+	      const Clock &clock)
+	    : motors(nullptr), sensors(nullptr, clock)
+	{
+		for (size_t i = 0; i < n_motors; i++) {
+			char name[17];
+			snprintf(name, sizeof(name), "motor_out%c", char('A' + i));
+			motors.add(std::unique_ptr<Motor>(
+			    new VirtualMotor(name, bank, bank.add(params))));
+		}
+		server.reset(new Server(config, motors, sensors, clock));
+	}
+};
+
+/**
+ * Parses a non-negative floating point number.
+ */
+static bool parse_non_negative(const char *value, double &tar)
+{
+	char *endptr;
+	tar = strtod(value, &endptr);
+	return (*endptr == '\0') && (tar >= 0.0);
+}
+
+/**
+ * Parses an IPv4 address of the form "A.B.C.D".
+ */
+static bool parse_address(const char *value, socket::Address &addr)
+{
+	unsigned int a, b, c, d;
+	char tail;
+	if (sscanf(value, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 ||
+	    a > 255 || b > 255 || c > 255 || d > 255) {
+		return false;
+	}
+	addr = socket::Address(a, b, c, d, addr.port);
+	return true;
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t n_bricks, n_motors;
+	int physics_period;
+	double duration;
+	bool virtual_time = false;
+	VirtualMotorBank::Params params;
+	uint16_t port;
+	bool bind_loopback = false;
+	bool has_target = false;
+	std::string name_prefix;
+	socket::Address target;
+	Server::Config config;
+
+	Argparse argparse(argv[0],
+	                  "Simulates a number of EV3 bricks with virtual motors "
+	                  "in a single process.");
+	argparse
+	    .add_arg("bricks", "Number of simulated bricks", "10",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             n_bricks = strtoul(value, &endptr, 10);
+		             return (*endptr == '\0') && (n_bricks > 0) &&
+		                    (n_bricks <= 65000);
+	             })
+	    .add_arg("motors", "Number of virtual motors per brick", "4",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             n_motors = strtoul(value, &endptr, 10);
+		             return (*endptr == '\0') && (n_motors > 0) &&
+		                    (n_motors <= 26);
+	             })
+	    .add_arg("physics-period",
+	             "Interval in which the motor dynamics are updated in "
+	             "milliseconds",
+	             "1",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             physics_period = strtol(value, &endptr, 10);
+		             return (*endptr == '\0') && (physics_period > 0);
+	             })
+	    .add_arg("inertia",
+	             "Load inertia relative to the motor inertia",
+	             "0",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, params.inertia);
+	             })
+	    .add_arg("friction",
+	             "Coulomb friction as the speed lost at any duty cycle in "
+	             "degrees per second",
+	             "0",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, params.friction);
+	             })
+	    .add_arg("backlash", "Gear backlash in degrees", "0",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, params.backlash);
+	             })
+	    .add_switch("virtual-time",
+	                "Run on a simulated clock that skips to the next timer "
+	                "instead of waiting; runs faster than real time and is "
+	                "deterministic",
+	                [&](const char *) -> bool {
+		                virtual_time = true;
+		                return true;
+	                })
+	    .add_arg("duration",
+	             "Stop after the given number of seconds; zero runs forever",
+	             "0",
+	             [&](const char *value) -> bool {
+		             return parse_non_negative(value, duration) &&
+		                    (duration < 2.0e6);
+	             })
+	    .add_arg("port",
+	             "The UDP port the clients listen on; messages are sent to "
+	             "this port",
+	             "4721",
+	             [&](const char *value) -> bool {
+		             char *endptr;
+		             const long value_port = strtol(value, &endptr, 10);
+		             port = uint16_t(value_port);
+		             return (*endptr == '\0') && (value_port > 0) &&
+		                    (value_port <= 65535);
+	             })
+	    .add_arg("bind",
+	             "Either \"port\" (brick i listens on 0.0.0.0 and port + 1 + "
+	             "i) or \"loopback\" (brick i listens on its own loopback "
+	             "address 127.1.X.Y and the given port)",
+	             "port",
+	             [&](const char *value) -> bool {
+		             bind_loopback = strcmp(value, "loopback") == 0;
+		             return bind_loopback || (strcmp(value, "port") == 0);
+	             })
+	    .add_arg("target",
+	             "IPv4 address messages are sent to; defaults to "
+	             "255.255.255.255 when binding to ports and 127.0.0.1 when "
+	             "binding to loopback addresses",
+	             "auto",
+	             [&](const char *value) -> bool {
+		             if (strcmp(value, "auto") == 0) {
+			             return true;
+		             }
+		             has_target = true;
+		             return parse_address(value, target);
+	             })
+	    .add_arg("name", "Name prefix of the simulated bricks", "SIM",
+	             [&](const char *value) -> bool {
+		             name_prefix = value;
+		             return true;
+	             });
+	config.add_args(argparse).parse(argc, argv);
+
+	// Each brick needs its own port or loopback address and a unique name
+	// that fits into the message header
+	if (bind_loopback ? (n_bricks > 256 * 250)
+	                  : (size_t(port) + n_bricks > 65535)) {
+		fprintf(stderr, "Too many bricks for the given port or bind mode\n");
+		return EXIT_FAILURE;
+	}
+	if (snprintf(nullptr, 0, "%s_%d", name_prefix.c_str(),
+	             int(n_bricks - 1)) > int(N_SOURCE_NAME_CHARS)) {
+		fprintf(stderr, "Name prefix \"%s\" is too long for %d bricks\n",
+		        name_prefix.c_str(), int(n_bricks));
+		return EXIT_FAILURE;
+	}
+
+	if (!has_target) {
+		target = bind_loopback ? socket::Address(127, 0, 0, 1)
+		                       : socket::Address(255, 255, 255, 255);
+	}
+	target.port = port;
+
+	// Create all bricks
+	MonotonicClock real_clock;
+	VirtualClock sim_clock;
+	Clock &clock = virtual_time ? static_cast<Clock &>(sim_clock) : real_clock;
+	VirtualMotorBank bank(n_bricks * n_motors);
+	std::vector<std::unique_ptr<Brick>> bricks;
+	bricks.reserve(n_bricks);
+	const uint64_t impairment_seed = config.impairment.seed;
+	for (size_t i = 0; i < n_bricks; i++) {
+		char name[N_SOURCE_NAME_CHARS + 1];
+		snprintf(name, sizeof(name), "%s_%d", name_prefix.c_str(), int(i));
+		config.name = name;
+		config.impairment.seed = impairment_seed + i;
+		config.broadcast_address = target;
+		if (bind_loopback) {
+			config.listen_address = socket::Address(
+			    127, 1, uint8_t(i / 250), uint8_t(1 + i % 250), port);
+		}
+		else {
+			config.listen_address =
+			    socket::Address(0, 0, 0, 0, uint16_t(port + 1 + i));
+		}
+		bricks.emplace_back(new Brick(config, n_motors, bank, params, clock));
+	}
+	fprintf(stderr,
+	        "Simulating %d bricks with %d motors each, sending to "
+	        "%d.%d.%d.%d:%d...\n",
+	        int(n_bricks), int(n_motors), target.a, target.b, target.c,
+	        target.d, target.port);
+
+	// Run all bricks in the same event loop, advance all motors at once
+	EventLoop event_loop(clock);
+	for (auto &brick : bricks) {
+		brick->server->register_with(event_loop);
+	}
+	event_loop.register_timer(physics_period, [&]() -> bool {
+		bank.step(clock.now());
+		return true;
+	});
+	if (duration > 0.0) {
+		event_loop.register_timer(int(std::lround(duration * 1e3)),
+		                          []() -> bool { return false; });
+	}
+	event_loop.run();
+
+	for (const auto &brick : bricks) {
+		if (brick->server->failed()) {
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
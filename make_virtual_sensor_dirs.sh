@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Virtual motors are simulated in memory; only the sensors are read from a
+# directory structure mimicking /sys/class/lego-sensor
+function make_sensor_dir {
+	mkdir -p "$1"
+	echo "$3" > "$1/mode"
+	echo "$4" > "$1/num_values"
+	echo 0 > "$1/decimals"
+	for i in 0 1 2 3 4 5 6 7; do
+		echo 0 > "$1/value$i"
+	done
+	echo "ev3-ports:$2" > "$1/address"
+}
+
+make_sensor_dir sensors/sensor0 in1 TOUCH 1
+make_sensor_dir sensors/sensor1 in2 "GYRO-G&A" 2
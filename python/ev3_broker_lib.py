@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+#  EV3 Event Broker -- Talk to Lego Robots using UDP
+#  Copyright (C) 2019  Andreas Stöckel
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# ctypes binding of libev3_broker_client.so, see ev3_broker_client.h
+
+import ctypes
+import ctypes.util
+import os
+
+POSITION = 0x01
+VELOCITY = 0x02
+TELEMETRY = 0x03
+SENSOR = 0x04
+TRAJECTORY_UNDERRUN = 0x05
+HEARTBEAT = 0x06
+REPORT_MODE = 0x07
+
+TRAJECTORY_MODE_DUTY_CYCLE = 0x00
+TRAJECTORY_MODE_POSITION = 0x01
+TRAJECTORY_CUBIC = 0x01
+TRAJECTORY_STOP_ON_UNDERRUN = 0x02
+TRAJECTORY_START = 0x04
+TRAJECTORY_END = 0x08
+
+
+class Event(ctypes.Structure):
+    _fields_ = [
+        ("type", ctypes.c_uint32),
+        ("seq", ctypes.c_uint32),
+        ("t_ns", ctypes.c_int64),
+        ("source_name", ctypes.c_char * 17),
+        ("source_hash", ctypes.c_char * 9),
+        ("device", ctypes.c_char * 17),
+        ("ip", ctypes.c_uint8 * 4),
+        ("port", ctypes.c_uint16),
+        ("attribute", ctypes.c_uint8),
+        ("decimals", ctypes.c_uint8),
+        ("n_values", ctypes.c_uint8),
+        ("value", ctypes.c_int32),
+        ("values", ctypes.c_int32 * 8),
+    ]
+
+
+def load_library(path=None):
+    if path is None:
+        path = os.path.join(os.path.dirname(__file__), '..',
+                            'libev3_broker_client.so')
+        if not os.path.exists(path):
+            path = ctypes.util.find_library('ev3_broker_client')
+    lib = ctypes.CDLL(path, use_errno=True)
+
+    P, S, I32 = ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int32
+    D = ctypes.c_double
+    for name, restype, argtypes in [
+        ("open", P, [ctypes.c_int, S, ctypes.c_size_t]),
+        ("close", None, [P]),
+        ("fd", ctypes.c_int, [P]),
+        ("drain", ctypes.c_size_t, [P, ctypes.POINTER(Event), ctypes.c_size_t]),
+        ("dropped", ctypes.c_uint64, [P]),
+        ("set_duty_cycle", ctypes.c_int, [P, S, S, I32]),
+        ("set_position_target", ctypes.c_int, [P, S, S, I32, D, D, D]),
+        ("set_velocity_target", ctypes.c_int, [P, S, S, I32, D, D, D]),
+        ("trajectory", ctypes.c_int, [
+            P, S, S, ctypes.c_uint8, ctypes.c_uint8,
+            ctypes.POINTER(ctypes.c_uint32),
+            ctypes.POINTER(ctypes.c_int32), ctypes.c_size_t
+        ]),
+        ("set_sensor_mode", ctypes.c_int, [P, S, S, S]),
+        ("reset", ctypes.c_int, [P, S]),
+    ]:
+        fun = getattr(lib, "ev3_broker_client_" + name)
+        fun.restype, fun.argtypes = restype, argtypes
+    return lib
+
+
+def _check(res):
+    if res < 0:
+        errno = ctypes.get_errno()
+        raise OSError(errno, os.strerror(errno))
+
+
+class Client:
+    """
+    In-process client; receives messages on a background thread. Commands are
+    addressed to sources by name and can only be sent after the source has
+    been heard from.
+    """
+
+    def __init__(self, port=4721, name="EV3_CLIENT", queue_size=4096,
+                 lib=None):
+        self.lib = load_library() if lib is None else lib
+        self.handle = self.lib.ev3_broker_client_open(port, name.encode(),
+                                                      queue_size)
+        if not self.handle:
+            _check(-1)
+        self.buf = (Event * 256)()
+
+    def close(self):
+        if self.handle:
+            self.lib.ev3_broker_client_close(self.handle)
+            self.handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def fileno(self):
+        return self.lib.ev3_broker_client_fd(self.handle)
+
+    def drain(self):
+        """
+        Returns a list of all queued events.
+        """
+        res = []
+        while True:
+            n = self.lib.ev3_broker_client_drain(self.handle, self.buf,
+                                                 len(self.buf))
+            res.extend(Event.from_buffer_copy(self.buf[i]) for i in range(n))
+            if n < len(self.buf):
+                return res
+
+    def dropped(self):
+        return self.lib.ev3_broker_client_dropped(self.handle)
+
+    def set_duty_cycle(self, source, device, duty_cycle):
+        _check(
+            self.lib.ev3_broker_client_set_duty_cycle(
+                self.handle, source.encode(), device.encode(), duty_cycle))
+
+    def set_position_target(self, source, device, position, kp, ki=0.0,
+                            kd=0.0):
+        _check(
+            self.lib.ev3_broker_client_set_position_target(
+                self.handle, source.encode(), device.encode(), position, kp,
+                ki, kd))
+
+    def set_velocity_target(self, source, device, velocity, kp, ki=0.0,
+                            kd=0.0):
+        _check(
+            self.lib.ev3_broker_client_set_velocity_target(
+                self.handle, source.encode(), device.encode(), velocity, kp,
+                ki, kd))
+
+    def trajectory(self, source, device, points, mode=TRAJECTORY_MODE_DUTY_CYCLE,
+                   options=TRAJECTORY_START):
+        n = len(points)
+        times = (ctypes.c_uint32 * n)(*(int(p[0]) for p in points))
+        values = (ctypes.c_int32 * n)(*(int(p[1]) for p in points))
+        _check(
+            self.lib.ev3_broker_client_trajectory(self.handle, source.encode(),
+                                                  device.encode(), mode,
+                                                  options, times, values, n))
+
+    def set_sensor_mode(self, source, device, mode):
+        _check(
+            self.lib.ev3_broker_client_set_sensor_mode(
+                self.handle, source.encode(), device.encode(), mode.encode()))
+
+    def reset(self, source):
+        _check(self.lib.ev3_broker_client_reset(self.handle, source.encode()))
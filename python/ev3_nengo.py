@@ -19,6 +19,7 @@
 import json
 import logging
 import numpy as np
+import struct
 import subprocess
 import sys
 import threading
@@ -39,15 +40,14 @@ class Ev3BrokerClientWrapper:
             "source_hash": None,
             "position": {},
             "position_offs": {},
+            "sensor": {},
             "duty_cycle": {},
             "last_time": {},
         }
 
     def get_source_for_message(self, msg):
         # Make sure all the important message parts are there
-        if not all(
-                s in msg
-                for s in ("source_name", "source_hash", "ip", "port")):
+        if not all(s in msg for s in ("source_name", "source_hash")):
             return None
 
         # Fetch the source entry
@@ -57,13 +57,34 @@ class Ev3BrokerClientWrapper:
                   msg["source_hash"] + "\"")
             self.sources[source_name] = self.get_empty_source()
         dev = self.sources[source_name]
-        if dev["source_hash"] != msg["source_hash"]:
-            dev["source_hash"] = msg["source_hash"]
-            dev["ip"] = msg["ip"]
-            dev["port"] = msg["port"]
+        dev["source_hash"] = msg["source_hash"]
 
         return dev
 
+    def handle_message(self, msg):
+        type_ = msg["type"]
+        if type_ == "error":
+            logger.error(msg["what"])
+            return
+        if type_ == "overflow":
+            logger.warning("Client discarded %d bytes of output",
+                           msg["dropped_bytes"])
+            return
+
+        source = self.get_source_for_message(msg)
+        if source is None:
+            return
+
+        if type_ == "position":
+            dev = msg["device"]
+            if not dev in source["position"]:
+                print("New device \"" + msg["source_name"] + ":" +
+                      msg["source_hash"] + ":" + dev + "\"")
+                source["position_offs"][dev] = msg["position"]
+            source["position"][dev] = msg["position"]
+        elif type_ == "sensor":
+            source["sensor"][msg["device"]] = msg["values"]
+
     @staticmethod
     def parse_subprocess_output(self, stdout):
         for line in iter(stdout.readline, b''):
@@ -71,39 +92,95 @@ class Ev3BrokerClientWrapper:
                 msg = json.loads(str(line, 'utf-8'))
                 if not "type" in msg:
                     continue
-                type_ = msg["type"]
-                if type_ == "error":
-                    logger.error(msg["what"])
-                    continue
-
-                source = self.get_source_for_message(msg)
-                if source is None:
-                    continue
-
-                type_ = None if not "type" in msg else msg["type"]
-                if type_ == "position":
-                    dev = msg["device"]
-                    if not dev in source["position"]:
-                        print("New device \"" + msg["source_name"] + ":" +
-                              msg["source_hash"] + ":" + dev + "\"")
-                        source["position_offs"][dev] = msg["position"]
-                    source["position"][dev] = msg["position"]
-                if not "type" in msg:
-                    continue
-
+                self.handle_message(msg)
             except json.JSONDecodeError:
                 pass
         stdout.close()
 
+    # Record layouts of the "--format=binary" output, see binary_writer.hpp
+    BINARY_HEADER = struct.Struct('<HBB')
+    BINARY_SOURCE = struct.Struct('<HH4B16s8s')
+    BINARY_DEVICE = struct.Struct('<HH16s')
+    BINARY_PREFIX = struct.Struct('<HHI')
+    BINARY_INT32 = struct.Struct('<i')
+    BINARY_SENSOR = struct.Struct('<BBH8i')
+
+    @staticmethod
+    def parse_subprocess_output_binary(self, stdout):
+        sources, devices = {}, {}
+        buf, ptr = b'', 0
+        H, P = Ev3BrokerClientWrapper.BINARY_HEADER, \
+               Ev3BrokerClientWrapper.BINARY_PREFIX
+        while True:
+            chunk = stdout.read1(65536)
+            if not chunk:
+                break
+            buf = buf[ptr:] + chunk
+            ptr = 0
+            while len(buf) - ptr >= H.size:
+                size, type_, _ = H.unpack_from(buf, ptr)
+                if size < H.size:
+                    logger.error("Invalid binary record")
+                    stdout.close()
+                    return
+                if len(buf) - ptr < size:
+                    break
+                offs, ptr = ptr + H.size, ptr + size
+                if type_ == 0x01:
+                    id_, port, a, b, c, d, name, hash_ = \
+                        self.BINARY_SOURCE.unpack_from(buf, offs)
+                    sources[id_] = {
+                        "source_name": str(name.rstrip(b'\0'), 'utf-8'),
+                        "source_hash": str(hash_.rstrip(b'\0'), 'utf-8'),
+                        "ip": [a, b, c, d],
+                        "port": port,
+                    }
+                elif type_ == 0x02:
+                    id_, _, name = self.BINARY_DEVICE.unpack_from(buf, offs)
+                    devices[id_] = str(name.rstrip(b'\0'), 'utf-8')
+                elif type_ == 0x03:
+                    self.handle_message({
+                        "type": "error",
+                        "what": str(buf[offs:ptr], 'utf-8', 'replace')
+                    })
+                elif type_ == 0x04:
+                    sources, devices = {}, {}
+                elif type_ == 0x06:
+                    sources, devices = {}, {}
+                    self.handle_message({
+                        "type": "overflow",
+                        "dropped_bytes": struct.unpack_from('<Q', buf, offs)[0]
+                    })
+                elif type_ == 0x10 or type_ == 0x13:
+                    source_id, device_id, seq = P.unpack_from(buf, offs)
+                    if not source_id in sources or not device_id in devices:
+                        continue
+                    msg = dict(sources[source_id])
+                    msg["device"] = devices[device_id]
+                    offs += P.size
+                    if type_ == 0x10:
+                        msg["type"] = "position"
+                        msg["position"], = self.BINARY_INT32.unpack_from(
+                            buf, offs)
+                    else:
+                        decimals, n, _, *values = \
+                            self.BINARY_SENSOR.unpack_from(buf, offs)
+                        msg["type"] = "sensor"
+                        msg["values"] = [
+                            v * 10.0**(-decimals) for v in values[:n]
+                        ]
+                    self.handle_message(msg)
+        stdout.close()
+
     @classmethod
-    def inst(class_, exe=None, port=None, name=None):
-        key = (exe, port, name)
+    def inst(class_, exe=None, port=None, name=None, binary=True):
+        key = (exe, port, name, binary)
         if not key in class_._insts:
             class_._insts[key] = Ev3BrokerClientWrapper(
-                exe=exe, port=port, name=name)
+                exe=exe, port=port, name=name, binary=binary)
         return class_._insts[key]
 
-    def __init__(self, exe=None, port=None, name=None):
+    def __init__(self, exe=None, port=None, name=None, binary=True):
         # Per default, search the event broker executable in PATH
         if exe is None:
             exe = 'ev3_broker_client'
@@ -116,22 +193,28 @@ class Ev3BrokerClientWrapper:
         # the network
         self.sources = {}
 
-        # Open the executable
+        # Open the executable. In binary mode stderr must not be mixed into the
+        # record stream.
+        args = [exe, '--port=' + str(port), '--name=' + name]
+        if binary:
+            args.append('--format=binary')
         self.process = subprocess.Popen(
-            [exe, '-p', str(port), '-n', name],
+            args,
             stdout=subprocess.PIPE,
             stdin=subprocess.PIPE,
-            stderr=subprocess.STDOUT,
-            bufsize=1,
+            stderr=None if binary else subprocess.STDOUT,
+            bufsize=-1 if binary else 1,
             close_fds=ON_POSIX)
         self.thread = threading.Thread(
-            target=Ev3BrokerClientWrapper.parse_subprocess_output,
+            target=Ev3BrokerClientWrapper.parse_subprocess_output_binary
+            if binary else Ev3BrokerClientWrapper.parse_subprocess_output,
             args=(self, self.process.stdout))
         self.thread.start()
 
-    def send_message(self, source, tag=None, min_msg_delay=10e-3, **kwargs):
+    def send_message(self, target, tag=None, min_msg_delay=10e-3, **kwargs):
         # Fetch the current time
         t = time.time()
+        source = self.sources[target]
 
         # If a "tag" is specified, limit the number of messages for that tag
         if not tag is None:
@@ -141,11 +224,12 @@ class Ev3BrokerClientWrapper:
                 return False
             source["last_time"][tag] = t
 
-        # Abort if the source does not have an ip/port
-        if not (("ip" in source) and ("port" in source)):
+        # Abort if no message has been received from the source yet; the
+        # client would not know its address
+        if source["source_hash"] is None:
             return False
 
-        msg = {**{"ip": source["ip"], "port": source["port"]}, **kwargs}
+        msg = {**{"target": target}, **kwargs}
         self.process.stdin.write((json.dumps(msg) + '\n').encode('utf-8'))
         self.process.stdin.flush()
 
@@ -171,13 +255,87 @@ class Ev3BrokerClientWrapper:
 
         # Send the message
         if self.send_message(
-                source,
+                target,
                 device,
                 type="set_duty_cycle",
                 device=device,
                 duty_cycle=duty_cycle):
             source["duty_cycle"][device] = duty_cycle
 
+    def set_target(self, target, device, kind, value, kp, ki=0.0, kd=0.0):
+        # Cancel if the subprocess is no longer open
+        if self.process is None:
+            return False
+
+        # Create an empty source if the given target does not exist
+        if not target in self.sources:
+            self.sources[target] = self.get_empty_source()
+        source = self.sources[target]
+
+        # Setting a target disables direct duty cycle control
+        source["duty_cycle"][device] = None
+
+        return self.send_message(
+            target,
+            device,
+            type="set_" + kind + "_target",
+            device=device,
+            kp=kp,
+            ki=ki,
+            kd=kd,
+            **{kind: int(round(value))})
+
+    def set_position_target(self, target, device, position, kp, ki=0.0,
+                            kd=0.0):
+        return self.set_target(target, device, "position", position, kp, ki,
+                               kd)
+
+    def set_velocity_target(self, target, device, velocity, kp, ki=0.0,
+                            kd=0.0):
+        return self.set_target(target, device, "velocity", velocity, kp, ki,
+                               kd)
+
+    def send_trajectory(self,
+                        target,
+                        device,
+                        points,
+                        mode="duty_cycle",
+                        interpolation="linear",
+                        underrun="hold",
+                        start=False,
+                        end=False):
+        # Cancel if the subprocess is no longer open
+        if self.process is None:
+            return False
+
+        # Create an empty source if the given target does not exist
+        if not target in self.sources:
+            self.sources[target] = self.get_empty_source()
+
+        return self.send_message(
+            target,
+            None,
+            type="trajectory",
+            device=device,
+            mode=mode,
+            interpolation=interpolation,
+            underrun=underrun,
+            start=start,
+            end=end,
+            points=[[int(t), int(round(v))] for t, v in points])
+
+    def set_sensor_mode(self, target, device, mode):
+        # Cancel if the subprocess is no longer open
+        if self.process is None or not target in self.sources:
+            return False
+
+        return self.send_message(
+            target,
+            None,
+            type="set_sensor_mode",
+            device=device,
+            mode=mode)
+
     def reset(self, target=None, repeat=10, reset_position=True):
         # Cancel if the subprocess is no longer open
         if self.process is None:
@@ -186,7 +344,7 @@ class Ev3BrokerClientWrapper:
         for i in range(repeat):
             for source_name, source in self.sources.items():
                 if (target is None) or (target == source_name):
-                    self.send_message(source, None, type="reset")
+                    self.send_message(source_name, None, type="reset")
             time.sleep(0.02)
 
         # Reset the positions and position offsets
@@ -212,6 +370,58 @@ class Ev3BrokerClientWrapper:
         self.close()
 
 
+class StateTableReader:
+    """
+    Reads the state table published by "ev3_broker_client --state-table=PATH"
+    (see state_table.hpp) through a NumPy view of the mapped file.
+    """
+
+    HEADER_DTYPE = np.dtype([
+        ("magic", "<u4"),
+        ("version", "<u4"),
+        ("n_slots", "<u4"),
+        ("slot_size", "<u4"),
+        ("n_used", "<u4"),
+    ])
+
+    SLOT_DTYPE = np.dtype({
+        "names": [
+            "lock", "seq", "t_ns", "source_name", "source_hash", "device",
+            "position", "velocity", "decimals", "n_values", "values"
+        ],
+        "formats": [
+            "<u4", "<u4", "<i8", "S16", "S8", "S16", "<i4", "<i4", "u1",
+            "u1", ("<i4", 8)
+        ],
+        "offsets": [0, 4, 8, 16, 32, 40, 56, 60, 64, 65, 68],
+        "itemsize": 128,
+    })
+
+    def __init__(self, path):
+        header = np.memmap(path, dtype=self.HEADER_DTYPE, mode='r', shape=(1,))
+        if header["magic"][0] != 0x53335645 or header["version"][0] != 1:
+            raise RuntimeError("Not a version 1 state table: " + path)
+        self.header = header
+        self.slots = np.memmap(path,
+                               dtype=self.SLOT_DTYPE,
+                               mode='r',
+                               offset=64,
+                               shape=(int(header["n_slots"][0]), ))
+
+    def snapshot(self):
+        """
+        Returns a consistent copy of all slots in use. Slots that are being
+        written while copying are read again.
+        """
+        n = int(self.header["n_used"][0])
+        while True:
+            lock0 = self.slots["lock"][:n].copy()
+            res = self.slots[:n].copy()
+            lock1 = self.slots["lock"][:n]
+            if np.all((lock0 == lock1) & (lock0 % 2 == 0)):
+                return res
+
+
 def make_node_fun(target, exe=None, port=None, name=None):
     # Fetch a new instance of the client wrapper
     inst = Ev3BrokerClientWrapper.inst(exe=exe, port=port, name=name)